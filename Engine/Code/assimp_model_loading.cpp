@@ -4,38 +4,130 @@
 
 #include "assimp_model_loading.h"
 #include "engine.h"
+#include "cooked_mesh.h"
+#include "cooked_texture.h"
+#include <string.h>
+#include <thread>
+#include <glm/gtc/packing.hpp>
+
+// The cook step's view of a model, written out as one cooked mesh file
+struct CookedModel
+{
+    std::vector<CookedSubmesh>  submeshes;
+    std::vector<CookedMaterial> materials;
+    std::vector<u8>             vertices;
+    std::vector<u32>            indices;
+    vec3                        aabbMin;
+    vec3                        aabbMax;
+    bool                        quantize;
+    vec3                        positionOffset; // Positions are stored relative to it...
+    f32                         positionScale;  // ...and divided by it, into the snorm16 range
+};
+
+static void AddAttribute(CookedSubmesh& submesh, u8 location, u8 componentCount, GLenum type, bool normalized, u8 size)
+{
+    // Written to the cooked file as is, so the padding is set too
+    VertexBufferAttribute& attribute = submesh.attributes[submesh.attributeCount++];
+    attribute.location = location;
+    attribute.componentCount = componentCount;
+    attribute.offset = submesh.stride;
+    attribute.normalized = normalized;
+    attribute.type = (u16)type;
+    attribute.integer = false;
+    attribute.padding = 0;
+    submesh.stride += size;
+}
+
+template <typename T>
+static void WriteVertexData(u8*& cursor, const T& value)
+{
+    memcpy(cursor, &value, sizeof(T));
+    cursor += sizeof(T);
+}
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+// Quantized unit vectors go through INT_2_10_10_10_REV, the shader reads them as normalized floats
+static void WriteDirection(u8*& cursor, const aiVector3D& direction, bool quantize)
 {
-    std::vector<float> vertices;
-    std::vector<u32> indices;
+    // Degenerate UVs leave zero tangents, which would normalize to NaN
+    vec3 v(direction.x, direction.y, direction.z);
+    if (glm::dot(v, v) <= 0.f)
+        v = vec3(1.f, 0.f, 0.f);
+    if (quantize)
+        WriteVertexData(cursor, glm::packSnorm3x10_1x2(vec4(glm::normalize(v), 0.f)));
+    else
+        WriteVertexData(cursor, v);
+}
+
+void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, CookedModel& model)
+{
+    const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr;
+    const bool hasTangentSpace = mesh->mTangents != nullptr && mesh->mBitangents != nullptr;
+    const bool quantize = model.quantize;
+
+    // create the vertex format, 24 bytes quantized against 56 in floats
+    CookedSubmesh submesh = {};
+    if (quantize)
+    {
+        AddAttribute(submesh, 0, 3, GL_SHORT, true, 4 * sizeof(i16)); // The fourth keeps the next attribute aligned
+        AddAttribute(submesh, 1, 4, GL_INT_2_10_10_10_REV, true, sizeof(u32));
+        if (hasTexCoords)
+            AddAttribute(submesh, 2, 2, GL_HALF_FLOAT, false, 2 * sizeof(u16));
+        if (hasTangentSpace)
+        {
+            AddAttribute(submesh, 3, 4, GL_INT_2_10_10_10_REV, true, sizeof(u32));
+            AddAttribute(submesh, 4, 4, GL_INT_2_10_10_10_REV, true, sizeof(u32));
+        }
+    }
+    else
+    {
+        AddAttribute(submesh, 0, 3, GL_FLOAT, false, 3 * sizeof(float));
+        AddAttribute(submesh, 1, 3, GL_FLOAT, false, 3 * sizeof(float));
+        if (hasTexCoords)
+            AddAttribute(submesh, 2, 2, GL_FLOAT, false, 2 * sizeof(float));
+        if (hasTangentSpace)
+        {
+            AddAttribute(submesh, 3, 3, GL_FLOAT, false, 3 * sizeof(float));
+            AddAttribute(submesh, 4, 3, GL_FLOAT, false, 3 * sizeof(float));
+        }
+    }
 
-    bool hasTexCoords = false;
-    bool hasTangentSpace = false;
+    // process vertices straight into their interleaved slots
+    const u32 firstByte = model.vertices.size();
+    submesh.vertexOffset = firstByte;
+    model.vertices.resize(firstByte + mesh->mNumVertices * submesh.stride);
 
-    // process vertices
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
     {
-        vertices.push_back(mesh->mVertices[i].x);
-        vertices.push_back(mesh->mVertices[i].y);
-        vertices.push_back(mesh->mVertices[i].z);
-        vertices.push_back(mesh->mNormals[i].x);
-        vertices.push_back(mesh->mNormals[i].y);
-        vertices.push_back(mesh->mNormals[i].z);
+        u8* vertex = &model.vertices[firstByte + i * submesh.stride];
+        const vec3 position(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        model.aabbMin = glm::min(model.aabbMin, position);
+        model.aabbMax = glm::max(model.aabbMax, position);
+        if (quantize)
+        {
+            const vec3 normalized = (position - model.positionOffset) / model.positionScale;
+            WriteVertexData(vertex, glm::packSnorm1x16(normalized.x));
+            WriteVertexData(vertex, glm::packSnorm1x16(normalized.y));
+            WriteVertexData(vertex, glm::packSnorm1x16(normalized.z));
+            WriteVertexData(vertex, (u16)0);
+        }
+        else
+        {
+            WriteVertexData(vertex, position);
+        }
+        WriteDirection(vertex, mesh->mNormals[i], quantize);
 
-        if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+        if (hasTexCoords)
         {
-            hasTexCoords = true;
-            vertices.push_back(mesh->mTextureCoords[0][i].x);
-            vertices.push_back(mesh->mTextureCoords[0][i].y);
+            const vec2 texCoord(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+            if (quantize)
+                WriteVertexData(vertex, glm::packHalf2x16(texCoord));
+            else
+                WriteVertexData(vertex, texCoord);
         }
 
-        if (mesh->mTangents != nullptr && mesh->mBitangents)
+        if (hasTangentSpace)
         {
-            hasTangentSpace = true;
-            vertices.push_back(mesh->mTangents[i].x);
-            vertices.push_back(mesh->mTangents[i].y);
-            vertices.push_back(mesh->mTangents[i].z);
+            WriteDirection(vertex, mesh->mTangents[i], quantize);
 
             // For some reason ASSIMP gives me the bitangents flipped.
             // Maybe it's my fault, but when I generate my own geometry
@@ -45,127 +137,172 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 bas
             // I think that (even if the documentation says the opposite)
             // it returns a left-handed tangent space matrix.
             // SOLUTION: I invert the components of the bitangent here.
-            vertices.push_back(-mesh->mBitangents[i].x);
-            vertices.push_back(-mesh->mBitangents[i].y);
-            vertices.push_back(-mesh->mBitangents[i].z);
+            WriteDirection(vertex, -mesh->mBitangents[i], quantize);
         }
     }
 
-    // process indices
+    // process indices, faces are all triangles after aiProcess_Triangulate and SortByPType
+    submesh.indexOffset = model.indices.size() * sizeof(u32);
     for (unsigned int i = 0; i < mesh->mNumFaces; i++)
     {
-        aiFace face = mesh->mFaces[i];
-        for (unsigned int j = 0; j < face.mNumIndices; j++)
-        {
-            indices.push_back(face.mIndices[j]);
-        }
+        const aiFace& face = mesh->mFaces[i];
+        model.indices.insert(model.indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
     }
+    submesh.indexCount = model.indices.size() - submesh.indexOffset / sizeof(u32);
 
-    // store the proper (previously proceessed) material for this mesh
-    submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
-
-    // create the vertex format
-    VertexBufferLayout vertexBufferLayout = {};
-    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
-    vertexBufferLayout.stride = 6 * sizeof(float);
+    // ratio of the surface to the UV area it covers, mip streaming turns it into texels per pixel
     if (hasTexCoords)
     {
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
-        vertexBufferLayout.stride += 2 * sizeof(float);
+        double worldArea = 0.0, uvArea = 0.0;
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+        {
+            const aiFace& face = mesh->mFaces[i];
+            if (face.mNumIndices != 3)
+                continue;
+            const aiVector3D& p0 = mesh->mVertices[face.mIndices[0]];
+            const aiVector3D& t0 = mesh->mTextureCoords[0][face.mIndices[0]];
+            const aiVector3D e1 = mesh->mVertices[face.mIndices[1]] - p0, e2 = mesh->mVertices[face.mIndices[2]] - p0;
+            const aiVector3D u1 = mesh->mTextureCoords[0][face.mIndices[1]] - t0, u2 = mesh->mTextureCoords[0][face.mIndices[2]] - t0;
+            worldArea += 0.5 * (e1 ^ e2).Length();
+            uvArea += 0.5 * fabs(u1.x * u2.y - u1.y * u2.x);
+        }
+        if (uvArea > 0.0)
+            submesh.worldPerUV = (f32)sqrt(worldArea / uvArea);
     }
-    if (hasTangentSpace)
-    {
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
-        vertexBufferLayout.stride += 3 * sizeof(float);
 
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
-        vertexBufferLayout.stride += 3 * sizeof(float);
-    }
+    // store the proper (previously proceessed) material for this mesh
+    submesh.materialIndex = mesh->mMaterialIndex;
 
-    // add the submesh into the mesh
-    Submesh submesh = {};
-    submesh.vertexBufferLayout = vertexBufferLayout;
-    submesh.vertices.swap(vertices);
-    submesh.indices.swap(indices);
-    myMesh->submeshes.push_back(submesh);
+    model.submeshes.push_back(submesh);
 }
 
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+static void CopyCookedString(char* destination, u32 capacity, const char* source)
+{
+    if (strlen(source) >= capacity)
+        ELOG("Cooked string truncated: %s", source);
+    strncpy(destination, source, capacity - 1);
+    destination[capacity - 1] = '\0';
+}
+
+void ProcessAssimpMaterial(aiMaterial* material, CookedMaterial& myMaterial)
 {
     aiString name;
     aiColor3D diffuseColor;
     aiColor3D emissiveColor;
     aiColor3D specularColor;
-    ai_real shininess;
+    ai_real shininess = 0;
     material->Get(AI_MATKEY_NAME, name);
     material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
     material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor);
     material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
     material->Get(AI_MATKEY_SHININESS, shininess);
 
-    myMaterial.name = name.C_Str();
+    CopyCookedString(myMaterial.name, COOKED_NAME_LENGTH, name.C_Str());
     myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
     myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
     myMaterial.smoothness = shininess / 256.0f;
 
-    aiString aiFilename;
-    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-    {
-        material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
-    {
-        material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-    {
-        material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
+    // Textures are loaded with the model at runtime, only their paths are cooked
+    const aiTextureType textureTypes[CookedTexture_Count] = {
+        aiTextureType_DIFFUSE,
+        aiTextureType_EMISSIVE,
+        aiTextureType_SPECULAR,
+        aiTextureType_NORMALS,
+        aiTextureType_HEIGHT,
+    };
+    for (u32 i = 0; i < CookedTexture_Count; ++i)
     {
-        material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
-    {
-        material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+        aiString aiFilename;
+        if (material->GetTextureCount(textureTypes[i]) > 0)
+        {
+            material->GetTexture(textureTypes[i], 0, &aiFilename);
+            CopyCookedString(myMaterial.texturePaths[i], COOKED_PATH_LENGTH, aiFilename.C_Str());
+        }
     }
 
     //myMaterial.createNormalFromBump();
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+void ProcessAssimpNode(const aiScene* scene, aiNode* node, CookedModel& model)
 {
     // process all the node's meshes (if any)
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
         aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        ProcessAssimpMesh(scene, mesh, model);
     }
 
     // then do the same for each of its children
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        ProcessAssimpNode(scene, node->mChildren[i], model);
     }
 }
 
-u32 LoadModel(App* app, const char* filename)
+static bool WriteCookedModel(const CookedModel& model, const char* cookedPath)
+{
+    CookedMeshHeader header = {};
+    header.magic = COOKED_MESH_MAGIC;
+    header.version = COOKED_MESH_VERSION;
+    header.submeshCount = model.submeshes.size();
+    header.materialCount = model.materials.size();
+    header.vertexDataOffset = sizeof(CookedMeshHeader) +
+                              model.submeshes.size() * sizeof(CookedSubmesh) +
+                              model.materials.size() * sizeof(CookedMaterial);
+    header.vertexDataSize = model.vertices.size();
+    header.indexDataOffset = header.vertexDataOffset + header.vertexDataSize;
+    header.indexDataSize = model.indices.size() * sizeof(u32);
+    header.aabbMin = model.aabbMin;
+    header.aabbMax = model.aabbMax;
+    header.positionOffset = model.positionOffset;
+    header.positionScale = model.positionScale;
+
+    FILE* file = fopen(cookedPath, "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing cooked mesh %s", cookedPath);
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(model.submeshes.data(), sizeof(CookedSubmesh), model.submeshes.size(), file);
+    fwrite(model.materials.data(), sizeof(CookedMaterial), model.materials.size(), file);
+    fwrite(model.vertices.data(), 1, model.vertices.size(), file);
+    fwrite(model.indices.data(), sizeof(u32), model.indices.size(), file);
+    const bool written = ferror(file) == 0;
+    fclose(file);
+
+    if (!written)
+    {
+        ELOG("Error writing cooked mesh %s", cookedPath);
+        remove(cookedPath);
+    }
+    return written;
+}
+
+// Center and extent of every vertex in the scene, the quantization range shared by its submeshes
+static void ComputePositionRange(const aiScene* scene, CookedModel& model)
+{
+    vec3 rangeMin(FLT_MAX), rangeMax(-FLT_MAX);
+    for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+    {
+        const aiMesh* mesh = scene->mMeshes[i];
+        for (unsigned int j = 0; j < mesh->mNumVertices; ++j)
+        {
+            const vec3 position(mesh->mVertices[j].x, mesh->mVertices[j].y, mesh->mVertices[j].z);
+            rangeMin = glm::min(rangeMin, position);
+            rangeMax = glm::max(rangeMax, position);
+        }
+    }
+    if (rangeMin.x > rangeMax.x)
+        return;
+
+    // One scale for all axes, so the dequantization folded into the world matrix leaves directions alone
+    const vec3 halfExtent = (rangeMax - rangeMin) * 0.5f;
+    model.positionOffset = (rangeMin + rangeMax) * 0.5f;
+    model.positionScale = glm::max(glm::max(halfExtent.x, halfExtent.y), glm::max(halfExtent.z, FLT_MIN));
+}
+
+bool CookModel(const char* filename, bool quantizeVertices)
 {
     const aiScene* scene = aiImportFile(filename,
         aiProcess_Triangulate |
@@ -180,70 +317,75 @@ u32 LoadModel(App* app, const char* filename)
     if (!scene)
     {
         ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-        return UINT32_MAX;
+        return false;
     }
 
-    app->meshes.push_back(Mesh{});
-    Mesh& mesh = app->meshes.back();
-    u32 meshIdx = (u32)app->meshes.size() - 1u;
-
-    app->models.push_back(Model{});
-    Model& model = app->models.back();
-    model.meshIdx = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
-
-    String directory = GetDirectoryPart(MakeString(filename));
+    CookedModel model = {};
+    model.aabbMin = vec3(FLT_MAX);
+    model.aabbMax = vec3(-FLT_MAX);
+    model.quantize = quantizeVertices;
+    model.positionOffset = vec3(0.f);
+    model.positionScale = 1.f;
+    if (quantizeVertices)
+        ComputePositionRange(scene, model);
 
     // Create a list of materials
-    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    model.materials.resize(scene->mNumMaterials);
     for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
     {
-        app->materials.push_back(Material{});
-        Material& material = app->materials.back();
-        ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+        model.materials[i] = CookedMaterial{};
+        ProcessAssimpMaterial(scene->mMaterials[i], model.materials[i]);
     }
 
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+    ProcessAssimpNode(scene, scene->mRootNode, model);
 
-    aiReleaseImport(scene);
+    // Rounding may move a vertex half a step, keep the bounds conservative
+    if (quantizeVertices)
+    {
+        model.aabbMin -= vec3(model.positionScale / 32767.f);
+        model.aabbMax += vec3(model.positionScale / 32767.f);
+    }
 
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
+    aiReleaseImport(scene);
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    // Its textures are cooked with it, loading the model then does not have to
+    String directory = GetDirectoryPart(MakeString(filename));
+    for (const CookedMaterial& material : model.materials)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+        for (u32 i = 0; i < CookedTexture_Count; ++i)
+        {
+            if (material.texturePaths[i][0] == '\0')
+                continue;
+            String filepath = MakePath(directory, MakeString(material.texturePaths[i]));
+            CookTexture(filepath.str, GetCookedTextureUsage((CookedTexture)i), std::thread::hardware_concurrency());
+        }
     }
 
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+    const std::string cookedPath = GetCookedMeshPath(filename);
+    if (!WriteCookedModel(model, cookedPath.c_str()))
+        return false;
 
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
-
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
+    ILOG("Cooked %s into %s", filename, cookedPath.c_str());
+    return true;
+}
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+u32 LoadModel(App* app, const char* filename)
+{
+    // Cook on demand when the cooked file is missing or older than its source, e.g. after an edit
+    const std::string cookedPath = GetCookedMeshPath(filename);
+    const u64 cookedTimestamp = GetFileLastWriteTimestamp(cookedPath.c_str());
+    if (cookedTimestamp == 0 || cookedTimestamp < GetFileLastWriteTimestamp(filename))
     {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
-
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
+        if (!CookModel(filename))
+            return UINT32_MAX;
     }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
+    u32 modelIdx = LoadCookedModel(app, cookedPath.c_str());
+    if (modelIdx == UINT32_MAX && cookedTimestamp != 0)
+    {
+        // Written by an older build, cook it again with this one
+        if (CookModel(filename))
+            modelIdx = LoadCookedModel(app, cookedPath.c_str());
+    }
     return modelIdx;
-}
\ No newline at end of file
+}
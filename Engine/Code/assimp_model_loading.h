@@ -8,4 +8,9 @@
 
 struct App;
 
-u32 LoadModel(App* app, const char* filename);
\ No newline at end of file
+// Imports the model with assimp and writes its cooked mesh next to it, see cooked_mesh.h. Quantized
+// vertices hold snorm16 positions, INT_2_10_10_10_REV normals and tangents and half float UVs.
+bool CookModel(const char* filename, bool quantizeVertices = true);
+
+// Loads the cooked mesh of the model, cooking it first if it is missing or out of date
+u32 LoadModel(App* app, const char* filename);
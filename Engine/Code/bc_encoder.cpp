@@ -0,0 +1,387 @@
+//
+// bc_encoder.cpp: Endpoints come from the principal axis of each block's colors, the nearest
+// palette entry search runs through FindNearestColors so it uses the SIMD kernels. BC7 only
+// writes mode 6 blocks (one subset, RGBA endpoints, 4 bit indices), the mode that suits
+// smooth color and alpha gradients and keeps the encoder simple.
+//
+
+#include "bc_encoder.h"
+#include "simd_math.h"
+#include <string.h>
+#include <float.h>
+#include <thread>
+
+#define BC_BLOCK_PIXELS 16
+#define BC_MIN_ROWS_PER_THREAD 16 // Below this a thread costs more to start than it saves
+
+// Block pixels in the planar layout FindNearestColors takes
+struct BlockPixels
+{
+    f32 channels[4][BC_BLOCK_PIXELS];
+};
+
+static u32 GetBCBlockSize(BCFormat format)
+{
+    return format == BCFormat_BC1 || format == BCFormat_BC4 ? 8 : 16;
+}
+
+u32 GetBCImageSize(BCFormat format, u32 width, u32 height)
+{
+    return ((width + 3) / 4) * ((height + 3) / 4) * GetBCBlockSize(format);
+}
+
+static void ReadBlock(const u8* rgba, u32 width, u32 height, u32 blockX, u32 blockY, u8 pixels[BC_BLOCK_PIXELS][4])
+{
+    for (u32 y = 0; y < 4; ++y)
+    {
+        const u32 sourceY = glm::min(blockY * 4 + y, height - 1);
+        for (u32 x = 0; x < 4; ++x)
+        {
+            const u32 sourceX = glm::min(blockX * 4 + x, width - 1);
+            memcpy(pixels[y * 4 + x], rgba + (sourceY * width + sourceX) * 4, 4);
+        }
+    }
+}
+
+static BlockPixels ToPlanar(const u8 pixels[BC_BLOCK_PIXELS][4], u32 channelCount)
+{
+    BlockPixels block = {};
+    for (u32 c = 0; c < channelCount; ++c)
+        for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+            block.channels[c][i] = pixels[i][c];
+    return block;
+}
+
+// The line through the block's colors that loses the least, found by power iteration on the
+// covariance matrix. Returns the two ends of the colors projected onto it.
+static void FitEndpoints(const BlockPixels& block, u32 channelCount, glm::vec4& endpoint0, glm::vec4& endpoint1)
+{
+    glm::vec4 mean(0.f);
+    for (u32 c = 0; c < channelCount; ++c)
+    {
+        for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+            mean[c] += block.channels[c][i];
+        mean[c] /= BC_BLOCK_PIXELS;
+    }
+
+    glm::mat4 covariance(0.f);
+    for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+        for (u32 c0 = 0; c0 < channelCount; ++c0)
+            for (u32 c1 = 0; c1 < channelCount; ++c1)
+                covariance[c0][c1] += (block.channels[c0][i] - mean[c0]) * (block.channels[c1][i] - mean[c1]);
+
+    glm::vec4 axis(0.f);
+    for (u32 c = 0; c < channelCount; ++c)
+        axis[c] = 1.f;
+    for (u32 iteration = 0; iteration < 8; ++iteration)
+    {
+        glm::vec4 next = covariance * axis;
+        const f32 length = glm::length(next);
+        if (length < 1e-6f)
+            break;
+        axis = next / length;
+    }
+
+    f32 minT = FLT_MAX;
+    f32 maxT = -FLT_MAX;
+    for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+    {
+        glm::vec4 pixel(block.channels[0][i], block.channels[1][i], block.channels[2][i], block.channels[3][i]);
+        const f32 t = glm::dot(pixel - mean, axis);
+        minT = glm::min(minT, t);
+        maxT = glm::max(maxT, t);
+    }
+
+    endpoint0 = glm::clamp(mean + axis * maxT, glm::vec4(0.f), glm::vec4(255.f));
+    endpoint1 = glm::clamp(mean + axis * minT, glm::vec4(0.f), glm::vec4(255.f));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BC1
+
+static u16 PackRGB565(const glm::vec4& color)
+{
+    const u32 r = (u32)glm::round(color.r * 31.f / 255.f);
+    const u32 g = (u32)glm::round(color.g * 63.f / 255.f);
+    const u32 b = (u32)glm::round(color.b * 31.f / 255.f);
+    return (u16)((r << 11) | (g << 5) | b);
+}
+
+static glm::vec4 UnpackRGB565(u16 color)
+{
+    const u32 r = (color >> 11) & 31;
+    const u32 g = (color >> 5) & 63;
+    const u32 b = color & 31;
+    return glm::vec4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 0.f);
+}
+
+// Always in four color mode, the only one BC3 color blocks have
+static void EncodeBC1Block(const u8 pixels[BC_BLOCK_PIXELS][4], u8* output)
+{
+    const BlockPixels block = ToPlanar(pixels, 3);
+
+    glm::vec4 endpoint0, endpoint1;
+    FitEndpoints(block, 3, endpoint0, endpoint1);
+
+    // Pull the ends in a little, the extremes are often single outliers
+    const glm::vec4 inset = (endpoint0 - endpoint1) / 16.f;
+    u16 color0 = PackRGB565(endpoint0 - inset);
+    u16 color1 = PackRGB565(endpoint1 + inset);
+    if (color0 < color1)
+    {
+        u16 swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+
+    u32 indexBits = 0;
+    if (color0 != color1)
+    {
+        glm::vec4 palette[4];
+        palette[0] = UnpackRGB565(color0);
+        palette[1] = UnpackRGB565(color1);
+        palette[2] = (2.f * palette[0] + palette[1]) / 3.f;
+        palette[3] = (palette[0] + 2.f * palette[1]) / 3.f;
+
+        u8 indices[BC_BLOCK_PIXELS];
+        FindNearestColors(&block.channels[0][0], BC_BLOCK_PIXELS, palette, 4, indices);
+        for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+            indexBits |= (u32)indices[i] << (2 * i);
+    }
+
+    output[0] = color0 & 0xFF;
+    output[1] = color0 >> 8;
+    output[2] = color1 & 0xFF;
+    output[3] = color1 >> 8;
+    memcpy(output + 4, &indexBits, 4);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BC4, one channel. Two of them make BC5, one holds the alpha of BC3
+
+// Rounding up picks the nearest palette value that is not below the pixel, the maximum is an endpoint
+static void EncodeBC4Block(const u8 pixels[BC_BLOCK_PIXELS][4], u32 channel, u8* output, bool roundUp = false)
+{
+    u8 minValue = 255;
+    u8 maxValue = 0;
+    for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+    {
+        minValue = glm::min(minValue, pixels[i][channel]);
+        maxValue = glm::max(maxValue, pixels[i][channel]);
+    }
+
+    // Eight value mode: both ends and six steps between them
+    u64 indexBits = 0;
+    if (maxValue != minValue)
+    {
+        f32 palette[8];
+        palette[0] = maxValue;
+        palette[1] = minValue;
+        for (u32 j = 2; j < 8; ++j)
+            palette[j] = ((8 - j) * maxValue + (j - 1) * minValue) / 7.f;
+
+        for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+        {
+            u32 bestIndex = 0;
+            f32 bestError = FLT_MAX;
+            for (u32 j = 0; j < 8; ++j)
+            {
+                const f32 error = glm::abs(palette[j] - pixels[i][channel]);
+                if (roundUp && palette[j] < pixels[i][channel])
+                    continue;
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestIndex = j;
+                }
+            }
+            indexBits |= (u64)bestIndex << (3 * i);
+        }
+    }
+
+    output[0] = maxValue;
+    output[1] = minValue;
+    for (u32 i = 0; i < 6; ++i)
+        output[2 + i] = (u8)(indexBits >> (8 * i));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BC7 mode 6
+
+static const u32 BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Endpoint
+{
+    u8 color[4]; // 7 bits per channel
+    u8 pBit;     // Shared lowest bit of all four channels
+};
+
+static BC7Endpoint QuantizeBC7Endpoint(const glm::vec4& color)
+{
+    BC7Endpoint best = {};
+    f32 bestError = FLT_MAX;
+    for (u8 pBit = 0; pBit < 2; ++pBit)
+    {
+        BC7Endpoint endpoint = {};
+        endpoint.pBit = pBit;
+        f32 error = 0.f;
+        for (u32 c = 0; c < 4; ++c)
+        {
+            endpoint.color[c] = (u8)glm::clamp(glm::round((color[c] - pBit) / 2.f), 0.f, 127.f);
+            const f32 d = (endpoint.color[c] * 2 + pBit) - color[c];
+            error += d * d;
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            best = endpoint;
+        }
+    }
+    return best;
+}
+
+static f32 BuildBC7Palette(const BC7Endpoint& endpoint0, const BC7Endpoint& endpoint1, const BlockPixels& block, u8 indices[BC_BLOCK_PIXELS])
+{
+    glm::vec4 palette[16];
+    for (u32 j = 0; j < 16; ++j)
+    {
+        for (u32 c = 0; c < 4; ++c)
+        {
+            const u32 value0 = endpoint0.color[c] * 2 + endpoint0.pBit;
+            const u32 value1 = endpoint1.color[c] * 2 + endpoint1.pBit;
+            palette[j][c] = (f32)(((64 - BC7Weights[j]) * value0 + BC7Weights[j] * value1 + 32) >> 6);
+        }
+    }
+    return FindNearestColors(&block.channels[0][0], BC_BLOCK_PIXELS, palette, 16, indices);
+}
+
+// Least squares endpoints for the chosen indices, the fit the principal axis only approximates
+static bool RefineBC7Endpoints(const BlockPixels& block, const u8 indices[BC_BLOCK_PIXELS], glm::vec4& endpoint0, glm::vec4& endpoint1)
+{
+    f32 aa = 0.f, ab = 0.f, bb = 0.f;
+    glm::vec4 ax(0.f), bx(0.f);
+    for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+    {
+        const f32 w = BC7Weights[indices[i]] / 64.f;
+        const glm::vec4 pixel(block.channels[0][i], block.channels[1][i], block.channels[2][i], block.channels[3][i]);
+        aa += (1.f - w) * (1.f - w);
+        ab += (1.f - w) * w;
+        bb += w * w;
+        ax += (1.f - w) * pixel;
+        bx += w * pixel;
+    }
+
+    const f32 determinant = aa * bb - ab * ab;
+    if (glm::abs(determinant) < 1e-6f)
+        return false;
+
+    endpoint0 = glm::clamp((ax * bb - bx * ab) / determinant, glm::vec4(0.f), glm::vec4(255.f));
+    endpoint1 = glm::clamp((bx * aa - ax * ab) / determinant, glm::vec4(0.f), glm::vec4(255.f));
+    return true;
+}
+
+struct BitWriter
+{
+    u8* output;
+    u32 position;
+};
+
+static void WriteBits(BitWriter& writer, u32 value, u32 bitCount)
+{
+    for (u32 i = 0; i < bitCount; ++i, ++writer.position)
+        if (value & (1u << i))
+            writer.output[writer.position / 8] |= 1u << (writer.position % 8);
+}
+
+static void EncodeBC7Block(const u8 pixels[BC_BLOCK_PIXELS][4], u8* output)
+{
+    const BlockPixels block = ToPlanar(pixels, 4);
+
+    glm::vec4 fit0, fit1;
+    FitEndpoints(block, 4, fit0, fit1);
+    BC7Endpoint endpoint0 = QuantizeBC7Endpoint(fit0);
+    BC7Endpoint endpoint1 = QuantizeBC7Endpoint(fit1);
+    u8 indices[BC_BLOCK_PIXELS];
+    f32 error = BuildBC7Palette(endpoint0, endpoint1, block, indices);
+
+    if (error > 0.f && RefineBC7Endpoints(block, indices, fit0, fit1))
+    {
+        BC7Endpoint refined0 = QuantizeBC7Endpoint(fit0);
+        BC7Endpoint refined1 = QuantizeBC7Endpoint(fit1);
+        u8 refinedIndices[BC_BLOCK_PIXELS];
+        if (BuildBC7Palette(refined0, refined1, block, refinedIndices) < error)
+        {
+            endpoint0 = refined0;
+            endpoint1 = refined1;
+            memcpy(indices, refinedIndices, sizeof(indices));
+        }
+    }
+
+    // The first index is stored with its top bit dropped, so it has to be below 8
+    if (indices[0] >= 8)
+    {
+        BC7Endpoint swap = endpoint0;
+        endpoint0 = endpoint1;
+        endpoint1 = swap;
+        for (u32 i = 0; i < BC_BLOCK_PIXELS; ++i)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(output, 0, 16);
+    BitWriter writer = { output, 0 };
+    WriteBits(writer, 1 << 6, 7); // Mode 6
+    for (u32 c = 0; c < 4; ++c)
+    {
+        WriteBits(writer, endpoint0.color[c], 7);
+        WriteBits(writer, endpoint1.color[c], 7);
+    }
+    WriteBits(writer, endpoint0.pBit, 1);
+    WriteBits(writer, endpoint1.pBit, 1);
+    WriteBits(writer, indices[0], 3);
+    for (u32 i = 1; i < BC_BLOCK_PIXELS; ++i)
+        WriteBits(writer, indices[i], 4);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void EncodeBlock(BCFormat format, const u8 pixels[BC_BLOCK_PIXELS][4], u8* output)
+{
+    switch (format)
+    {
+        case BCFormat_BC1: EncodeBC1Block(pixels, output); break;
+        case BCFormat_BC3: EncodeBC4Block(pixels, 3, output); EncodeBC1Block(pixels, output + 8); break;
+        case BCFormat_BC5: EncodeBC4Block(pixels, 0, output); EncodeBC4Block(pixels, 1, output + 8); break;
+        case BCFormat_BC7: EncodeBC7Block(pixels, output); break;
+        case BCFormat_BC4: EncodeBC4Block(pixels, 0, output, true); break;
+        default: ASSERT(false, "Unknown block compression format");
+    }
+}
+
+void EncodeBCImage(BCFormat format, const u8* rgba, u32 width, u32 height, u8* output, u32 maxThreads)
+{
+    const u32 blocksX = (width + 3) / 4;
+    const u32 blocksY = (height + 3) / 4;
+    const u32 blockSize = GetBCBlockSize(format);
+
+    // Every block is independent, threads take interleaved rows of them
+    const u32 threadCount = glm::clamp(blocksY / BC_MIN_ROWS_PER_THREAD, 1u, glm::max(maxThreads, 1u));
+    auto encodeRows = [&](u32 firstRow)
+    {
+        u8 pixels[BC_BLOCK_PIXELS][4];
+        for (u32 blockY = firstRow; blockY < blocksY; blockY += threadCount)
+        {
+            for (u32 blockX = 0; blockX < blocksX; ++blockX)
+            {
+                ReadBlock(rgba, width, height, blockX, blockY, pixels);
+                EncodeBlock(format, pixels, output + (blockY * blocksX + blockX) * blockSize);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (u32 i = 1; i < threadCount; ++i)
+        threads.emplace_back(encodeRows, i);
+    encodeRows(0);
+    for (std::thread& thread : threads)
+        thread.join();
+}
@@ -0,0 +1,24 @@
+//
+// bc_encoder.h: CPU encoders for the block compressed texture formats. Every format works on
+// 4x4 pixel blocks, images whose size is not a multiple of 4 repeat their last row and column.
+//
+
+#pragma once
+
+#include "platform.h"
+
+enum BCFormat
+{
+    BCFormat_BC1, // RGB, 4 bits per pixel
+    BCFormat_BC3, // RGBA with interpolated alpha, 8 bits per pixel
+    BCFormat_BC5, // Two independent channels (normal map xy), 8 bits per pixel
+    BCFormat_BC7, // RGBA at higher quality than BC1/BC3, 8 bits per pixel
+    BCFormat_BC4, // One channel rounded up, so a height map still bounds the surface, 4 bits per pixel
+    BCFormat_Count
+};
+
+u32 GetBCImageSize(BCFormat format, u32 width, u32 height);
+
+// Encodes a tightly packed RGBA8 image. Rows of blocks are spread over up to maxThreads threads, callers
+// that already run on a worker pass 1 and encode inline.
+void EncodeBCImage(BCFormat format, const u8* rgba, u32 width, u32 height, u8* output, u32 maxThreads);
@@ -41,6 +41,13 @@ void MapBuffer(Buffer& buffer, GLenum access)
     buffer.head = 0;
 }
 
+void MapBufferRange(Buffer& buffer, u32 offset, u32 length, u32 access)
+{
+    glBindBuffer(buffer.type, buffer.handle);
+    buffer.data = (u8*)glMapBufferRange(buffer.type, offset, length, access);
+    buffer.head = 0;
+}
+
 void UnmapBuffer(Buffer& buffer)
 {
     glUnmapBuffer(buffer.type);
@@ -57,6 +64,7 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
 {
     ASSERT(buffer.data != NULL, "The buffer must be mapped first");
     AlignHead(buffer, alignment);
+    ASSERT(buffer.head + size <= buffer.size, "Trying to push more data than the buffer can hold");
     memcpy((u8*)buffer.data + buffer.head, data, size);
     buffer.head += size;
 }
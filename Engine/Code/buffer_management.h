@@ -16,6 +16,8 @@ void BindBuffer(const Buffer& buffer);
 
 void MapBuffer(Buffer& buffer, GLenum access);
 
+void MapBufferRange(Buffer& buffer, u32 offset, u32 length, u32 access);
+
 void UnmapBuffer(Buffer& buffer);
 
 void AlignHead(Buffer& buffer, u32 alignment);
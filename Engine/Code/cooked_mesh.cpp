@@ -0,0 +1,166 @@
+#include "cooked_mesh.h"
+#include <string.h>
+
+std::string GetCookedMeshPath(const char* filename)
+{
+    return ReplaceExtension(filename, COOKED_MESH_EXTENSION);
+}
+
+TextureUsage GetCookedTextureUsage(CookedTexture slot)
+{
+    switch (slot)
+    {
+        case CookedTexture_Albedo:  return TextureUsage_Color;
+        case CookedTexture_Normals: return TextureUsage_Normal;
+        case CookedTexture_Bump:    return TextureUsage_Height;
+        default:                    return TextureUsage_Mask;
+    }
+}
+
+static bool IsValidCookedMesh(const MappedFile& file, const char* cookedPath)
+{
+    if (file.size < sizeof(CookedMeshHeader))
+    {
+        ELOG("Cooked mesh %s is truncated", cookedPath);
+        return false;
+    }
+
+    const CookedMeshHeader& header = *(const CookedMeshHeader*)file.data;
+    if (header.magic != COOKED_MESH_MAGIC || header.version != COOKED_MESH_VERSION)
+    {
+        ILOG("Cooked mesh %s is from another format version", cookedPath);
+        return false;
+    }
+
+    const u64 tablesEnd = sizeof(CookedMeshHeader) +
+                          (u64)header.submeshCount * sizeof(CookedSubmesh) +
+                          (u64)header.materialCount * sizeof(CookedMaterial);
+    if (tablesEnd > header.vertexDataOffset ||
+        (u64)header.vertexDataOffset + header.vertexDataSize > file.size ||
+        (u64)header.indexDataOffset + header.indexDataSize > file.size)
+    {
+        ELOG("Cooked mesh %s is truncated", cookedPath);
+        return false;
+    }
+
+    const CookedSubmesh* submeshes = (const CookedSubmesh*)(file.data + sizeof(CookedMeshHeader));
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        if (submeshes[i].materialIndex >= header.materialCount)
+        {
+            ELOG("Cooked mesh %s has a submesh without material", cookedPath);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void LoadCookedMaterial(App* app, const CookedMaterial& cooked, String directory, Material& material)
+{
+    material.name = std::string(cooked.name, strnlen(cooked.name, COOKED_NAME_LENGTH));
+    material.albedo = cooked.albedo;
+    material.emissive = cooked.emissive;
+    material.smoothness = cooked.smoothness;
+
+    ResourceHandle* textures[CookedTexture_Count] = {
+        &material.albedoTexture,
+        &material.emissiveTexture,
+        &material.specularTexture,
+        &material.normalsTexture,
+        &material.bumpTexture,
+    };
+    for (u32 i = 0; i < CookedTexture_Count; ++i)
+    {
+        if (cooked.texturePaths[i][0] == '\0')
+            continue;
+        std::string filename(cooked.texturePaths[i], strnlen(cooked.texturePaths[i], COOKED_PATH_LENGTH));
+        String filepath = MakePath(directory, MakeString(filename.c_str()));
+        *textures[i] = LoadTexture2D(app, filepath.str, GetCookedTextureUsage((CookedTexture)i));
+    }
+}
+
+u32 LoadCookedModel(App* app, const char* cookedPath)
+{
+    MappedFile file = MapFile(cookedPath);
+    if (!file.data)
+        return UINT32_MAX;
+
+    if (!IsValidCookedMesh(file, cookedPath))
+    {
+        UnmapFile(file);
+        return UINT32_MAX;
+    }
+
+    const CookedMeshHeader& header = *(const CookedMeshHeader*)file.data;
+    const CookedSubmesh* cookedSubmeshes = (const CookedSubmesh*)(file.data + sizeof(CookedMeshHeader));
+    const CookedMaterial* cookedMaterials = (const CookedMaterial*)(cookedSubmeshes + header.submeshCount);
+
+    const u32 modelIdx = AllocateModel(app);
+    Model& model = app->models[modelIdx];
+
+    // Models loaded from the same file share the mesh, each one gets its own materials
+    const u32 pathId = InternPath(app->resourcePaths, cookedPath);
+    model.mesh = FindResource(app->meshRegistry, pathId);
+    const bool upload = !IsResourceAlive(app->meshRegistry, model.mesh);
+    if (upload)
+    {
+        model.mesh = CreateResource(app->meshRegistry, pathId);
+        if (app->meshes.size() < app->meshRegistry.slots.size())
+            app->meshes.resize(app->meshRegistry.slots.size());
+        app->meshes[model.mesh.index] = Mesh{};
+    }
+    AcquireResource(app->meshRegistry, model.mesh);
+
+    String directory = GetDirectoryPart(MakeString(cookedPath));
+
+    for (u32 i = 0; i < header.materialCount; ++i)
+    {
+        const u32 materialIdx = AllocateMaterial(app);
+        LoadCookedMaterial(app, cookedMaterials[i], directory, app->materials[materialIdx]);
+        model.materials.push_back(materialIdx);
+    }
+
+    for (u32 i = 0; i < header.submeshCount; ++i)
+        model.materialIdx.push_back(model.materials[cookedSubmeshes[i].materialIndex]);
+
+    if (!upload)
+    {
+        UnmapFile(file);
+        return modelIdx;
+    }
+
+    Mesh& mesh = app->meshes[model.mesh.index];
+    mesh.aabbMin = header.aabbMin;
+    mesh.aabbMax = header.aabbMax;
+    mesh.dequantize = glm::translate(header.positionOffset) * glm::scale(vec3(header.positionScale));
+
+    mesh.submeshes.resize(header.submeshCount);
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        const CookedSubmesh& cooked = cookedSubmeshes[i];
+        Submesh& submesh = mesh.submeshes[i];
+        submesh.vertexBufferLayout.stride = cooked.stride;
+        submesh.vertexBufferLayout.attributes.assign(cooked.attributes, cooked.attributes + glm::min<u32>(cooked.attributeCount, COOKED_MAX_ATTRIBUTES));
+        submesh.vertexOffset = cooked.vertexOffset;
+        submesh.indexOffset = cooked.indexOffset;
+        submesh.indexCount = cooked.indexCount;
+        submesh.worldPerUV = cooked.worldPerUV;
+    }
+
+    // The blobs are already in their GPU layout, the mapping is uploaded as is
+    glGenBuffers(1, &mesh.vertexBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, header.vertexDataSize, file.data + header.vertexDataOffset, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &mesh.indexBufferHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, header.indexDataSize, file.data + header.indexDataOffset, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    SetResourceSize(app->meshRegistry, model.mesh, (u64)header.vertexDataSize + header.indexDataSize);
+
+    UnmapFile(file);
+    return modelIdx;
+}
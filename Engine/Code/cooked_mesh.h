@@ -0,0 +1,77 @@
+//
+// cooked_mesh.h: Binary mesh files written by the cook step (see CookModel) and loaded at runtime
+// without assimp. The vertex and index blobs are already interleaved for the GPU, so loading one
+// is a file mapping and two buffer uploads.
+//
+// Layout: CookedMeshHeader, CookedSubmesh[submeshCount], CookedMaterial[materialCount],
+// then the vertex blob and the index blob at the offsets written in the header.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define COOKED_MESH_MAGIC     0x48534D43 // "CMSH"
+#define COOKED_MESH_VERSION   3          // Bump on any change to the structs below
+#define COOKED_MESH_EXTENSION ".mesh"
+
+#define COOKED_MAX_ATTRIBUTES 8
+#define COOKED_NAME_LENGTH    64
+#define COOKED_PATH_LENGTH    128
+
+enum CookedTexture
+{
+    CookedTexture_Albedo,
+    CookedTexture_Emissive,
+    CookedTexture_Specular,
+    CookedTexture_Normals,
+    CookedTexture_Bump,
+    CookedTexture_Count
+};
+
+struct CookedMeshHeader
+{
+    u32  magic;
+    u32  version;
+    u32  submeshCount;
+    u32  materialCount;
+    u32  vertexDataOffset; // Bytes from the start of the file
+    u32  vertexDataSize;
+    u32  indexDataOffset;
+    u32  indexDataSize;
+    vec3 aabbMin;
+    vec3 aabbMax;
+    vec3 positionOffset; // Object space position = stored position * positionScale + positionOffset
+    f32  positionScale;
+};
+
+struct CookedSubmesh
+{
+    u32                   vertexOffset;  // Bytes into the vertex blob
+    u32                   indexOffset;   // Bytes into the index blob
+    u32                   indexCount;
+    u32                   materialIndex; // Into the material table of the same file
+    f32                   worldPerUV;    // Average object space length of one UV unit, 0 without UVs
+    u8                    stride;
+    u8                    attributeCount;
+    u8                    padding[2];
+    VertexBufferAttribute attributes[COOKED_MAX_ATTRIBUTES];
+};
+
+struct CookedMaterial
+{
+    char name[COOKED_NAME_LENGTH];
+    vec3 albedo;
+    vec3 emissive;
+    f32  smoothness;
+    char texturePaths[CookedTexture_Count][COOKED_PATH_LENGTH]; // Relative to the model, empty if unused
+};
+
+// Compressed format each material texture is cooked to
+TextureUsage GetCookedTextureUsage(CookedTexture slot);
+
+// "Cube/Plane.obj" is cooked to "Cube/Plane.mesh"
+std::string GetCookedMeshPath(const char* filename);
+
+// Maps the file and uploads it, UINT32_MAX if it is missing or from another format version
+u32 LoadCookedModel(App* app, const char* cookedPath);
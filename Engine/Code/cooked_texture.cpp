@@ -0,0 +1,298 @@
+#include "cooked_texture.h"
+#include <stb_image.h>
+
+// S3TC is an extension glad was not generated with, RGTC and BPTC are core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+std::string GetCookedTexturePath(const char* filename)
+{
+    return ReplaceExtension(filename, COOKED_TEXTURE_EXTENSION);
+}
+
+static BCFormat ChooseBCFormat(TextureUsage usage, bool hasAlpha)
+{
+    switch (usage)
+    {
+        case TextureUsage_Normal: return BCFormat_BC5;
+        case TextureUsage_Height: return BCFormat_BC4;
+        case TextureUsage_Mask:   return hasAlpha ? BCFormat_BC3 : BCFormat_BC1;
+        default:                  return BCFormat_BC7;
+    }
+}
+
+static GLenum GetBCInternalFormat(BCFormat format)
+{
+    switch (format)
+    {
+        case BCFormat_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BCFormat_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BCFormat_BC5: return GL_COMPRESSED_RG_RGTC2;
+        case BCFormat_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        case BCFormat_BC4: return GL_COMPRESSED_RED_RGTC1;
+        default:           return GL_NONE;
+    }
+}
+
+// Box filter, an odd size folds its last row or column into the one before
+static void DownsampleLevel(const u8* source, u32 width, u32 height, TextureUsage usage, u8* destination)
+{
+    const u32 nextWidth = glm::max(width / 2, 1u);
+    const u32 nextHeight = glm::max(height / 2, 1u);
+    for (u32 y = 0; y < nextHeight; ++y)
+    {
+        for (u32 x = 0; x < nextWidth; ++x)
+        {
+            const u32 x0 = glm::min(x * 2, width - 1), x1 = glm::min(x * 2 + 1, width - 1);
+            const u32 y0 = glm::min(y * 2, height - 1), y1 = glm::min(y * 2 + 1, height - 1);
+            const u8* texels[4] = {
+                source + (y0 * width + x0) * 4,
+                source + (y0 * width + x1) * 4,
+                source + (y1 * width + x0) * 4,
+                source + (y1 * width + x1) * 4,
+            };
+
+            vec4 sum(0.f);
+            for (const u8* texel : texels)
+                sum += vec4(texel[0], texel[1], texel[2], texel[3]);
+            vec4 average = sum / 4.f;
+
+            // Averaged normals are shorter than one, the xy a BC5 texture keeps has to be of a unit vector
+            if (usage == TextureUsage_Normal)
+            {
+                vec3 normal = vec3(average) / 127.5f - 1.f;
+                if (glm::length(normal) > 1e-4f)
+                    average = vec4((glm::normalize(normal) + 1.f) * 127.5f, average.a);
+            }
+
+            u8* output = destination + (y * nextWidth + x) * 4;
+            for (u32 c = 0; c < 4; ++c)
+                output[c] = (u8)glm::clamp(glm::round(average[c]), 0.f, 255.f);
+        }
+    }
+}
+
+// Heights from the first channel, each texel the highest of its footprint so relief mapping can skip
+// whole cells. Odd sizes fold their last row and column into the last texel.
+static void DownsampleMaxLevel(const u8* source, u32 width, u32 height, u8* destination)
+{
+    const u32 nextWidth = glm::max(width / 2, 1u);
+    const u32 nextHeight = glm::max(height / 2, 1u);
+    for (u32 y = 0; y < nextHeight; ++y)
+    {
+        for (u32 x = 0; x < nextWidth; ++x)
+        {
+            const u32 x1 = x + 1 == nextWidth ? width : x * 2 + 2;
+            const u32 y1 = y + 1 == nextHeight ? height : y * 2 + 2;
+            u8 maxHeight = 0;
+            for (u32 sy = y * 2; sy < y1; ++sy)
+                for (u32 sx = x * 2; sx < x1; ++sx)
+                    maxHeight = glm::max(maxHeight, source[(sy * width + sx) * 4]);
+
+            u8* output = destination + (y * nextWidth + x) * 4;
+            output[0] = output[1] = output[2] = maxHeight;
+            output[3] = 255;
+        }
+    }
+}
+
+bool CookTexture(const char* filename, TextureUsage usage, u32 maxThreads)
+{
+    // Flipped like LoadImage, so the cooked texture matches the uncompressed one
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(true);
+    u8* pixels = stbi_load(filename, &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        ELOG("Could not open file %s", filename);
+        return false;
+    }
+
+    bool hasAlpha = false;
+    if (channels == 4)
+        for (u32 i = 0; i < (u32)(width * height); ++i)
+            hasAlpha |= pixels[i * 4 + 3] != 255;
+    const BCFormat format = ChooseBCFormat(usage, hasAlpha);
+
+    CookedTextureHeader header = {};
+    header.magic = COOKED_TEXTURE_MAGIC;
+    header.version = COOKED_TEXTURE_VERSION;
+    header.usage = usage;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+
+    CookedTextureLevel levels[COOKED_TEXTURE_MAX_LEVELS] = {};
+    std::vector<u8> levelData;
+    std::vector<u8> level(pixels, pixels + width * height * 4);
+    std::vector<u8> nextLevel;
+    stbi_image_free(pixels);
+
+    u32 levelWidth = width;
+    u32 levelHeight = height;
+    for (;;)
+    {
+        CookedTextureLevel& cookedLevel = levels[header.levelCount++];
+        cookedLevel.width = levelWidth;
+        cookedLevel.height = levelHeight;
+        cookedLevel.size = GetBCImageSize(format, levelWidth, levelHeight);
+        cookedLevel.offset = levelData.size();
+        levelData.resize(levelData.size() + cookedLevel.size);
+        EncodeBCImage(format, level.data(), levelWidth, levelHeight, levelData.data() + cookedLevel.offset, maxThreads);
+
+        if ((levelWidth == 1 && levelHeight == 1) || header.levelCount == COOKED_TEXTURE_MAX_LEVELS)
+            break;
+
+        nextLevel.resize(glm::max(levelWidth / 2, 1u) * glm::max(levelHeight / 2, 1u) * 4);
+        if (usage == TextureUsage_Height)
+            DownsampleMaxLevel(level.data(), levelWidth, levelHeight, nextLevel.data());
+        else
+            DownsampleLevel(level.data(), levelWidth, levelHeight, usage, nextLevel.data());
+        level.swap(nextLevel);
+        levelWidth = glm::max(levelWidth / 2, 1u);
+        levelHeight = glm::max(levelHeight / 2, 1u);
+    }
+
+    const u32 dataOffset = sizeof(CookedTextureHeader) + header.levelCount * sizeof(CookedTextureLevel);
+    for (u32 i = 0; i < header.levelCount; ++i)
+        levels[i].offset += dataOffset;
+
+    const std::string cookedPath = GetCookedTexturePath(filename);
+    FILE* file = fopen(cookedPath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing cooked texture %s", cookedPath.c_str());
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(levels, sizeof(CookedTextureLevel), header.levelCount, file);
+    fwrite(levelData.data(), 1, levelData.size(), file);
+    const bool written = ferror(file) == 0;
+    fclose(file);
+
+    if (!written)
+    {
+        ELOG("Error writing cooked texture %s", cookedPath.c_str());
+        remove(cookedPath.c_str());
+    }
+    return written;
+}
+
+static bool IsValidCookedTexture(const MappedFile& file, TextureUsage usage)
+{
+    if (file.size < sizeof(CookedTextureHeader))
+        return false;
+
+    const CookedTextureHeader& header = *(const CookedTextureHeader*)file.data;
+    if (header.magic != COOKED_TEXTURE_MAGIC || header.version != COOKED_TEXTURE_VERSION ||
+        header.usage != (u32)usage || header.format >= BCFormat_Count ||
+        header.levelCount == 0 || header.levelCount > COOKED_TEXTURE_MAX_LEVELS)
+        return false;
+
+    if (sizeof(CookedTextureHeader) + header.levelCount * sizeof(CookedTextureLevel) > file.size)
+        return false;
+
+    const CookedTextureLevel* levels = (const CookedTextureLevel*)(file.data + sizeof(CookedTextureHeader));
+    for (u32 i = 0; i < header.levelCount; ++i)
+        if ((u64)levels[i].offset + levels[i].size > file.size)
+            return false;
+    return true;
+}
+
+bool MapCookedTexture(const char* filename, TextureUsage usage, bool s3tcSupported, MappedFile& file)
+{
+    // Cooked on first use, and again when the image is newer or the cooked file is from another version
+    const std::string cookedPath = GetCookedTexturePath(filename);
+    const u64 cookedTimestamp = GetFileLastWriteTimestamp(cookedPath.c_str());
+    bool cooked = false;
+    if (cookedTimestamp == 0 || cookedTimestamp < GetFileLastWriteTimestamp(filename))
+    {
+        if (!CookTexture(filename, usage))
+            return false;
+        cooked = true;
+    }
+
+    file = MapFile(cookedPath.c_str());
+    if (!IsValidCookedTexture(file, usage))
+    {
+        UnmapFile(file);
+        if (cooked || !CookTexture(filename, usage))
+            return false;
+        file = MapFile(cookedPath.c_str());
+        if (!IsValidCookedTexture(file, usage))
+        {
+            UnmapFile(file);
+            return false;
+        }
+    }
+
+    const BCFormat format = (BCFormat)((const CookedTextureHeader*)file.data)->format;
+    if ((format == BCFormat_BC1 || format == BCFormat_BC3) && !s3tcSupported)
+    {
+        UnmapFile(file);
+        return false;
+    }
+    return true;
+}
+
+const CookedTextureLevel* GetCookedLevels(const MappedFile& file)
+{
+    return (const CookedTextureLevel*)(file.data + sizeof(CookedTextureHeader));
+}
+
+u32 GetCookedLevelCount(const MappedFile& file)
+{
+    return ((const CookedTextureHeader*)file.data)->levelCount;
+}
+
+u64 GetCookedLevelBytes(const MappedFile& file, u32 beginLevel, u32 endLevel)
+{
+    const CookedTextureLevel* levels = GetCookedLevels(file);
+    u64 bytes = 0;
+    for (u32 i = beginLevel; i < endLevel; ++i)
+        bytes += levels[i].size;
+    return bytes;
+}
+
+GLuint AllocateCookedTexture(const MappedFile& file, u32 firstLevel)
+{
+    const CookedTextureHeader& header = *(const CookedTextureHeader*)file.data;
+    const CookedTextureLevel& first = GetCookedLevels(file)[firstLevel];
+
+    // Immutable storage, so streaming can copy levels between two of them
+    GLuint texHandle;
+    glGenTextures(1, &texHandle);
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    glTexStorage2D(GL_TEXTURE_2D, header.levelCount - firstLevel, GetBCInternalFormat((BCFormat)header.format), first.width, first.height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levelCount - firstLevel - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return texHandle;
+}
+
+void UploadCookedLevels(const MappedFile& file, GLuint texHandle, u32 firstLevel, u32 beginLevel, u32 endLevel)
+{
+    const CookedTextureHeader& header = *(const CookedTextureHeader*)file.data;
+    const CookedTextureLevel* levels = GetCookedLevels(file);
+    const GLenum internalFormat = GetBCInternalFormat((BCFormat)header.format);
+
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    for (u32 i = beginLevel; i < endLevel; ++i)
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, i - firstLevel, 0, 0, levels[i].width, levels[i].height, internalFormat, levels[i].size, file.data + levels[i].offset);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLuint CreateTextureFromCooked(const MappedFile& file, u32 firstLevel)
+{
+    GLuint texHandle = AllocateCookedTexture(file, firstLevel);
+    UploadCookedLevels(file, texHandle, firstLevel, firstLevel, GetCookedLevelCount(file));
+    return texHandle;
+}
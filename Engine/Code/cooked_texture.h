@@ -0,0 +1,66 @@
+//
+// cooked_texture.h: Textures cooked to a block compressed format with their whole mip chain,
+// so loading one is a file mapping and one glCompressedTexImage2D per level.
+//
+// Layout: CookedTextureHeader, CookedTextureLevel[levelCount], then the level data at the
+// offsets written in the level table, largest level first.
+//
+
+#pragma once
+
+#include "engine.h"
+#include "bc_encoder.h"
+
+#define COOKED_TEXTURE_MAGIC      0x58455443 // "CTEX"
+#define COOKED_TEXTURE_VERSION    1          // Bump on any change to the structs below or the encoders
+#define COOKED_TEXTURE_EXTENSION  ".tex"
+#define COOKED_TEXTURE_MAX_LEVELS 16
+
+struct CookedTextureHeader
+{
+    u32 magic;
+    u32 version;
+    u32 usage;  // TextureUsage it was cooked for, the format depends on it
+    u32 format; // BCFormat
+    u32 width;
+    u32 height;
+    u32 levelCount;
+};
+
+struct CookedTextureLevel
+{
+    u32 offset; // Bytes from the start of the file
+    u32 size;
+    u32 width;
+    u32 height;
+};
+
+// "Cube/toy_box_normal.png" is cooked to "Cube/toy_box_normal.tex"
+std::string GetCookedTexturePath(const char* filename);
+
+// Decodes the image, builds its mips and writes the cooked texture next to it. The texture loader
+// workers cook on their own thread, the offline cook spreads each level over maxThreads.
+bool CookTexture(const char* filename, TextureUsage usage, u32 maxThreads = 1);
+
+// Maps the cooked file of the image, cooking it first if it is missing or out of date. False when the
+// image can not be cooked or it needs S3TC and the driver lacks it, the caller then loads it uncompressed.
+// Safe to call from any thread.
+bool MapCookedTexture(const char* filename, TextureUsage usage, bool s3tcSupported, MappedFile& file);
+
+// The functions below take a file MapCookedTexture mapped. A GL texture made from it holds the
+// cooked levels from firstLevel on, its level 0 is cooked level firstLevel.
+
+u32 GetCookedLevelCount(const MappedFile& file);
+
+const CookedTextureLevel* GetCookedLevels(const MappedFile& file);
+
+// Size of the cooked levels in [beginLevel, endLevel)
+u64 GetCookedLevelBytes(const MappedFile& file, u32 beginLevel, u32 endLevel);
+
+// Storage and sampling state for the levels from firstLevel on, without their data
+GLuint AllocateCookedTexture(const MappedFile& file, u32 firstLevel);
+
+void UploadCookedLevels(const MappedFile& file, GLuint texHandle, u32 firstLevel, u32 beginLevel, u32 endLevel);
+
+// Allocates and uploads every level from firstLevel on
+GLuint CreateTextureFromCooked(const MappedFile& file, u32 firstLevel = 0);
@@ -9,19 +9,137 @@
 #include <imgui.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <ctype.h>
 
 #include "assimp_model_loading.h"
 #include "buffer_management.h"
+#include "texture_loader.h"
+#include "texture_streaming.h"
+#include "simd_math.h"
 
 #define BINDING(b) b
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+// Linked programs are saved next to the executable's working directory, one file per key
+#define PROGRAM_CACHE_DIRECTORY "shadercache"
+#define PROGRAM_CACHE_MAGIC     0x31475250 // "PRG1"
+
+// GL_KHR_parallel_shader_compile, not part of the loaded core profile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+struct ProgramCacheHeader
 {
-    GLchar  infoLogBuffer[1024] = {};
-    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
-    GLsizei infoLogSize;
-    GLint   success;
+    u32 magic;
+    u32 binaryFormat;
+    u32 binarySize;
+};
+
+// FNV-1a, continued from the given hash so several strings can be chained
+u64 HashBytes(const void* data, u32 size, u64 hash = 0xcbf29ce484222325ull)
+{
+    const u8* bytes = (const u8*)data;
+    for (u32 i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+u64 HashShaderSources(const GLchar* const* sources, const GLint* lengths, u32 count, u64 hash)
+{
+    for (u32 i = 0; i < count; ++i)
+        hash = HashBytes(sources[i], lengths[i], hash);
+    return hash;
+}
+
+// Binaries are only valid for the driver that produced them
+u64 HashDriver()
+{
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    const char* version = (const char*)glGetString(GL_VERSION);
+    u64 hash = HashBytes(renderer, strlen(renderer));
+    return HashBytes(version, strlen(version), hash);
+}
+
+bool ProgramBinariesSupported()
+{
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    return formatCount > 0;
+}
+
+GLuint LoadCachedProgram(u64 key)
+{
+    if (!ProgramBinariesSupported())
+        return 0;
+
+    char filepath[64];
+    sprintf(filepath, PROGRAM_CACHE_DIRECTORY "/%016llx.bin", (unsigned long long)key);
+    FILE* file = fopen(filepath, "rb");
+    if (!file)
+        return 0;
+
+    ProgramCacheHeader header = {};
+    std::vector<u8> binary;
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_CACHE_MAGIC)
+    {
+        binary.resize(header.binarySize);
+        if (fread(binary.data(), 1, binary.size(), file) != binary.size())
+            binary.clear();
+    }
+    fclose(file);
+    if (binary.empty())
+        return 0;
+
+    // A driver update can reject the binary even with the same strings, then compile again
+    GLuint programHandle = glCreateProgram();
+    glProgramBinary(programHandle, header.binaryFormat, binary.data(), binary.size());
+    GLint success;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glDeleteProgram(programHandle);
+        return 0;
+    }
+    return programHandle;
+}
 
+void StoreCachedProgram(u64 key, GLuint programHandle)
+{
+    if (!ProgramBinariesSupported())
+        return;
+
+    GLint binarySize = 0;
+    glGetProgramiv(programHandle, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+    if (binarySize <= 0)
+        return;
+
+    ProgramCacheHeader header = {};
+    header.magic = PROGRAM_CACHE_MAGIC;
+    std::vector<u8> binary(binarySize);
+    GLsizei writtenSize = 0;
+    glGetProgramBinary(programHandle, binarySize, &writtenSize, &header.binaryFormat, binary.data());
+    header.binarySize = writtenSize;
+
+    char filepath[64];
+    sprintf(filepath, PROGRAM_CACHE_DIRECTORY "/%016llx.bin", (unsigned long long)key);
+    CreateDirectoryIfMissing(PROGRAM_CACHE_DIRECTORY);
+    FILE* file = fopen(filepath, "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing program cache %s", filepath);
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(binary.data(), 1, writtenSize, file);
+    fclose(file);
+}
+
+// Hands the shaders to the driver without waiting for them, FinishProgram reads the results
+void SubmitProgramFromSource(Program& program, const std::string& programSource, const char* shaderName, const char* featureDefines)
+{
     char versionString[] = "#version 430\n";
     char shaderNameDefine[128];
     sprintf(shaderNameDefine, "#define %s\n", shaderName);
@@ -31,87 +149,421 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     const GLchar* vertexShaderSource[] = {
         versionString,
         shaderNameDefine,
+        featureDefines,
         vertexShaderDefine,
-        programSource.str
+        programSource.c_str()
     };
     const GLint vertexShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(featureDefines),
         (GLint) strlen(vertexShaderDefine),
-        (GLint) programSource.len
+        (GLint) programSource.size()
     };
     const GLchar* fragmentShaderSource[] = {
         versionString,
         shaderNameDefine,
+        featureDefines,
         fragmentShaderDefine,
-        programSource.str
+        programSource.c_str()
     };
     const GLint fragmentShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(featureDefines),
         (GLint) strlen(fragmentShaderDefine),
-        (GLint) programSource.len
+        (GLint) programSource.size()
     };
 
+    program.cacheKey = HashShaderSources(vertexShaderSource, vertexShaderLengths, ARRAY_COUNT(vertexShaderSource), HashDriver());
+    program.cacheKey = HashShaderSources(fragmentShaderSource, fragmentShaderLengths, ARRAY_COUNT(fragmentShaderSource), program.cacheKey);
+    program.handle = LoadCachedProgram(program.cacheKey);
+    program.pending = program.handle == 0;
+    if (!program.pending)
+        return;
+
     GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
     glCompileShader(vshader);
-    glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-    }
 
     GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
     glCompileShader(fshader);
-    glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+
+    program.handle = glCreateProgram();
+    glAttachShader(program.handle, vshader);
+    glAttachShader(program.handle, fshader);
+    glProgramParameteri(program.handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program.handle);
+
+    program.pendingShaders[0] = vshader;
+    program.pendingShaders[1] = fshader;
+    program.pendingShaderCount = 2;
+}
+
+void SubmitComputeProgramFromSource(Program& program, const std::string& programSource, const char* shaderName)
+{
+    char versionString[] = "#version 430\n";
+    char shaderNameDefine[128];
+    sprintf(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
+
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        computeShaderDefine,
+        programSource.c_str()
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint) strlen(versionString),
+        (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(computeShaderDefine),
+        (GLint) programSource.size()
+    };
+
+    program.cacheKey = HashShaderSources(computeShaderSource, computeShaderLengths, ARRAY_COUNT(computeShaderSource), HashDriver());
+    program.handle = LoadCachedProgram(program.cacheKey);
+    program.pending = program.handle == 0;
+    if (!program.pending)
+        return;
+
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+
+    program.handle = glCreateProgram();
+    glAttachShader(program.handle, cshader);
+    glProgramParameteri(program.handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program.handle);
+
+    program.pendingShaders[0] = cshader;
+    program.pendingShaderCount = 1;
+}
+
+bool IsCompileComplete(App* app, const Program& program)
+{
+    if (!program.pending)
+        return true;
+
+    // Without the extension there is no way to ask, and any query would block anyway
+    if (!app->oglInfo.parallelShaderCompile)
+        return true;
+
+    GLint complete = GL_FALSE;
+    glGetProgramiv(program.handle, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete == GL_TRUE;
+}
+
+// Blocks until the driver is done with the program, then logs its errors and caches the binary
+bool CompleteProgram(Program& program)
+{
+    if (!program.pending)
+        return true;
+
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
+
+    for (u32 i = 0; i < program.pendingShaderCount; ++i)
     {
-        glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        GLuint shader = program.pendingShaders[i];
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            GLint shaderType;
+            glGetShaderiv(shader, GL_SHADER_TYPE, &shaderType);
+            const char* stageName = shaderType == GL_VERTEX_SHADER ? "vertex" : shaderType == GL_FRAGMENT_SHADER ? "fragment" : "compute";
+            glGetShaderInfoLog(shader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n", stageName, program.programName.c_str(), infoLogBuffer);
+        }
     }
 
-    GLuint programHandle = glCreateProgram();
-    glAttachShader(programHandle, vshader);
-    glAttachShader(programHandle, fshader);
-    glLinkProgram(programHandle);
-    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
-    if (!success)
+    GLint linked;
+    glGetProgramiv(program.handle, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        glGetProgramInfoLog(program.handle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", program.programName.c_str(), infoLogBuffer);
+    }
+    else
     {
-        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        StoreCachedProgram(program.cacheKey, program.handle);
     }
 
-    glUseProgram(0);
+    for (u32 i = 0; i < program.pendingShaderCount; ++i)
+    {
+        glDetachShader(program.handle, program.pendingShaders[i]);
+        glDeleteShader(program.pendingShaders[i]);
+    }
+    program.pendingShaderCount = 0;
+    program.pending = false;
+    return linked == GL_TRUE;
+}
 
-    glDetachShader(programHandle, vshader);
-    glDetachShader(programHandle, fshader);
-    glDeleteShader(vshader);
-    glDeleteShader(fshader);
+bool IsProgramReady(App* app, u32 programIdx)
+{
+    return IsCompileComplete(app, app->programs[programIdx]);
+}
 
-    return programHandle;
+void FinishProgram(App* app, u32 programIdx)
+{
+    Program& program = app->programs[programIdx];
+    if (program.pending)
+        program.linkFailed = !CompleteProgram(program);
+}
+
+u32 GetLightCountTier(u32 lightCount)
+{
+    // Loop bounds of 16, 64 and 256 lights, the last tier covers the whole light buffer
+    u32 tier = 0;
+    while (tier + 1 < SHADER_LIGHT_TIER_COUNT && lightCount > (16u << (2 * tier)))
+        tier++;
+    return tier;
+}
+
+void BuildFeatureDefines(u32 featureKey, char* defines, u32 size)
+{
+    u32 tier = featureKey >> SHADER_LIGHT_TIER_SHIFT;
+    u32 lightCountMax = tier + 1 < SHADER_LIGHT_TIER_COUNT ? 16u << (2 * tier) : MAX_LIGHTS;
+
+    snprintf(defines, size, "%s%s#define LIGHT_COUNT_MAX %u\n",
+             (featureKey & ShaderFeature_NormalMap) ? "#define FEATURE_NORMAL_MAP\n" : "",
+             (featureKey & ShaderFeature_Relief) ? "#define FEATURE_RELIEF\n" : "",
+             lightCountMax);
 }
 
 u32 LoadProgram(App* app, const char* filepath, const char* programName)
 {
-    String programSource = ReadTextFile(filepath);
+    std::string programSource;
+    BuildShaderSource(app->shaderLibrary, filepath, programName, programSource);
+
+    char defines[256];
+    BuildFeatureDefines(0, defines, sizeof(defines));
+
+    Program program = {};
+    SubmitProgramFromSource(program, programSource, programName, defines);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.sourceHash = HashBytes(programSource.data(), programSource.size());
+    app->programs.push_back(program);
+
+    return app->programs.size() - 1;
+}
+
+u32 GetProgramPermutation(App* app, u32 programIdx, u32 featureKey)
+{
+    if (app->programs[programIdx].featureKey == featureKey)
+        return programIdx;
+    for (const ProgramPermutation& permutation : app->programs[programIdx].permutations)
+    {
+        if (permutation.featureKey != featureKey)
+            continue;
+
+        // Drawn with the base program until the driver is done with the variant, and for good if it failed
+        if (!IsProgramReady(app, permutation.programIdx))
+            return programIdx;
+        FinishProgram(app, permutation.programIdx);
+        return app->programs[permutation.programIdx].linkFailed ? programIdx : permutation.programIdx;
+    }
+
+    // Same source and vertex layout as the base, only the defines differ
+    const Program& base = app->programs[programIdx];
+    std::string programSource;
+    BuildShaderSource(app->shaderLibrary, base.filepath.c_str(), base.programName.c_str(), programSource);
+
+    char defines[256];
+    BuildFeatureDefines(featureKey, defines, sizeof(defines));
+
+    Program program = {};
+    SubmitProgramFromSource(program, programSource, base.programName.c_str(), defines);
+    program.filepath = base.filepath;
+    program.programName = base.programName;
+    program.lastWriteTimestamp = base.lastWriteTimestamp;
+    program.sourceHash = base.sourceHash;
+    program.vertexInputLayout = base.vertexInputLayout;
+    program.featureKey = featureKey;
+    app->programs.push_back(program);
+
+    const u32 permutationIdx = app->programs.size() - 1;
+    app->programs[programIdx].permutations.push_back({ featureKey, permutationIdx });
+    if (app->programs[permutationIdx].pending)
+        return programIdx;
+    FinishProgram(app, permutationIdx);
+    return app->programs[permutationIdx].linkFailed ? programIdx : permutationIdx;
+}
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+    std::string programSource;
+    BuildShaderSource(app->shaderLibrary, filepath, programName, programSource);
 
     Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
+    SubmitComputeProgramFromSource(program, programSource, programName);
     program.filepath = filepath;
     program.programName = programName;
     program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.sourceHash = HashBytes(programSource.data(), programSource.size());
+    program.isCompute = true;
     app->programs.push_back(program);
 
     return app->programs.size() - 1;
 }
 
+void SubmitProgramReload(App* app, u32 programIdx, const std::string& programSource)
+{
+    const Program& program = app->programs[programIdx];
+
+    // An older candidate that has not linked yet is superseded
+    for (u32 i = 0; i < app->programReloads.size(); ++i)
+    {
+        if (app->programReloads[i].programIdx != programIdx)
+            continue;
+        Program& stale = app->programReloads[i].candidate;
+        for (u32 s = 0; s < stale.pendingShaderCount; ++s)
+            glDeleteShader(stale.pendingShaders[s]);
+        glDeleteProgram(stale.handle);
+        app->programReloads.erase(app->programReloads.begin() + i);
+        break;
+    }
+
+    ProgramReload reload = {};
+    reload.programIdx = programIdx;
+    Program& candidate = reload.candidate;
+    candidate.filepath = program.filepath;
+    candidate.programName = program.programName;
+    candidate.isCompute = program.isCompute;
+    candidate.featureKey = program.featureKey;
+    if (program.isCompute)
+    {
+        SubmitComputeProgramFromSource(candidate, programSource, program.programName.c_str());
+    }
+    else
+    {
+        char defines[256];
+        BuildFeatureDefines(program.featureKey, defines, sizeof(defines));
+        SubmitProgramFromSource(candidate, programSource, program.programName.c_str(), defines);
+    }
+    app->programReloads.push_back(reload);
+}
+
+// VAOs are cached per program handle, a deleted handle can be given to the next program created
+static void ReleaseProgramVAOs(App* app, GLuint programHandle)
+{
+    for (Mesh& mesh : app->meshes)
+    {
+        for (Submesh& submesh : mesh.submeshes)
+        {
+            for (u32 i = 0; i < submesh.vaos.size(); )
+            {
+                if (submesh.vaos[i].programHandle != programHandle)
+                {
+                    ++i;
+                    continue;
+                }
+                glDeleteVertexArrays(1, &submesh.vaos[i].handle);
+                submesh.vaos.erase(submesh.vaos.begin() + i);
+            }
+        }
+    }
+}
+
+// A reloaded vertex shader may read other attributes, take them from what the linker kept
+static void ReadVertexInputLayout(Program& program)
+{
+    GLint attributeCount = 0;
+    glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+
+    program.vertexInputLayout.attributes.clear();
+    for (GLint i = 0; i < attributeCount; ++i)
+    {
+        char name[64];
+        GLint size;
+        GLenum type;
+        glGetActiveAttrib(program.handle, i, sizeof(name), nullptr, &size, &type, name);
+        const GLint location = glGetAttribLocation(program.handle, name);
+        if (location < 0)
+            continue; // Built-ins like gl_VertexID
+
+        u8 componentCount = 1;
+        switch (type)
+        {
+            case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: componentCount = 2; break;
+            case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: componentCount = 3; break;
+            case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: componentCount = 4; break;
+        }
+        program.vertexInputLayout.attributes.push_back({ (u8)location, componentCount });
+    }
+}
+
+// The watcher thread reports saved files, only programs whose expanded source changed recompile,
+// whether the edit was in their own section or in a file they include. Candidates compile in the
+// background and replace the old program between frames once linked.
+void HotReloadPrograms(App* app)
+{
+    std::vector<std::string> changedFiles;
+    bool libraryChanged = false;
+    if (ConsumeChangedFiles(changedFiles))
+        for (const std::string& changedFile : changedFiles)
+            libraryChanged |= ReloadShaderFile(app->shaderLibrary, changedFile.c_str());
+
+    if (libraryChanged)
+    {
+        std::string programSource;
+        for (u32 i = 0; i < app->programs.size(); ++i)
+        {
+            const Program& program = app->programs[i];
+            if (!BuildShaderSource(app->shaderLibrary, program.filepath.c_str(), program.programName.c_str(), programSource))
+                continue;
+
+            const u64 sourceHash = HashBytes(programSource.data(), programSource.size());
+            if (sourceHash == program.sourceHash)
+                continue;
+            app->programs[i].sourceHash = sourceHash;
+            app->programs[i].lastWriteTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+            SubmitProgramReload(app, i, programSource);
+        }
+    }
+
+    bool swapped = false;
+    for (u32 i = 0; i < app->programReloads.size(); )
+    {
+        ProgramReload& reload = app->programReloads[i];
+        if (!IsCompileComplete(app, reload.candidate))
+        {
+            ++i;
+            continue;
+        }
+
+        Program& program = app->programs[reload.programIdx];
+        if (CompleteProgram(reload.candidate))
+        {
+            ReleaseProgramVAOs(app, program.handle);
+            glDeleteProgram(program.handle);
+            program.handle = reload.candidate.handle;
+            program.linkFailed = false;
+            if (!program.isCompute)
+                ReadVertexInputLayout(program);
+            swapped = true;
+            ILOG("Reloaded program %s", program.programName.c_str());
+        }
+        else
+        {
+            // The error is already logged, keep drawing with the version that worked
+            glDeleteProgram(reload.candidate.handle);
+        }
+        app->programReloads.erase(app->programReloads.begin() + i);
+    }
+
+    if (swapped)
+        QueryUniformLocations(app);
+}
+
 Image LoadImage(const char* filename)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
+    stbi_set_flip_vertically_on_load_thread(true); // Texture loader threads call this too
     img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
     if (img.pixels)
     {
@@ -157,30 +609,191 @@ GLuint CreateTexture2DFromImage(Image image)
     return texHandle;
 }
 
-u32 LoadTexture2D(App* app, const char* filepath)
+// Made in code and referenced for good, so it is never evicted
+ResourceHandle CreateSolidTexture(App* app, u8 r, u8 g, u8 b, u8 a)
+{
+    const u8 texel[4] = { r, g, b, a };
+
+    Image image = {};
+    image.pixels = (void*)texel;
+    image.size = ivec2(1, 1);
+    image.nchannels = 4;
+    image.stride = 4;
+
+    ResourceHandle texture = CreateResource(app->textureRegistry, NO_RESOURCE_PATH);
+    AcquireResource(app->textureRegistry, texture);
+    SetResourceSize(app->textureRegistry, texture, sizeof(texel));
+
+    if (app->textures.size() < app->textureRegistry.slots.size())
+        app->textures.resize(app->textureRegistry.slots.size());
+    Texture& tex = app->textures[texture.index];
+    tex.handle = CreateTexture2DFromImage(image);
+    tex.usage = TextureUsage_Color;
+    tex.state = TextureState_Resident;
+    return texture;
+}
+
+// Bound while a texture is loading, and for good if it fails to
+GLuint GetPlaceholderTexture(App* app, TextureUsage usage, bool failed)
+{
+    switch (usage)
+    {
+        case TextureUsage_Normal: return app->textures[app->normalTexture.index].handle;
+        case TextureUsage_Mask:   return app->textures[app->blackTexture.index].handle;
+        case TextureUsage_Height: return app->textures[app->whiteTexture.index].handle; // Flat
+        default:                  return app->textures[(failed ? app->magentaTexture : app->whiteTexture).index].handle;
+    }
+}
+
+// A new slot for the path, the caller fills in the texture and acquires its reference
+static ResourceHandle CreateTextureSlot(App* app, u32 pathId)
+{
+    ResourceHandle texture = CreateResource(app->textureRegistry, pathId);
+    if (app->textures.size() < app->textureRegistry.slots.size())
+        app->textures.resize(app->textureRegistry.slots.size());
+    app->textures[texture.index] = Texture{};
+    return texture;
+}
+
+ResourceHandle LoadTexture2D(App* app, const char* filepath, TextureUsage usage)
+{
+    const u32 pathId = InternPath(app->resourcePaths, filepath);
+    ResourceHandle texture = FindResource(app->textureRegistry, pathId);
+    if (IsResourceAlive(app->textureRegistry, texture))
+    {
+        AcquireResource(app->textureRegistry, texture);
+        return texture;
+    }
+
+    // The handle is valid right away, the real texture replaces the placeholder once a worker loaded it
+    texture = CreateTextureSlot(app, pathId);
+    Texture& tex = app->textures[texture.index];
+    tex.handle = GetPlaceholderTexture(app, usage, false);
+    tex.usage = usage;
+    tex.state = TextureState_Loading;
+
+    // One reference for the caller and one the loader drops when the upload is done
+    AcquireResource(app->textureRegistry, texture);
+    AcquireResource(app->textureRegistry, texture);
+
+    TextureLoadRequest request = {};
+    request.texture = texture;
+    request.filepath = filepath;
+    request.usage = usage;
+    request.s3tcSupported = app->oglInfo.textureCompressionS3TC;
+    RequestTextureLoad(*app->textureLoader, request);
+    return texture;
+}
+
+void ReleaseTexture(App* app, ResourceHandle texture)
+{
+    ReleaseResource(app->textureRegistry, texture, app->frameIndex);
+}
+
+GLuint GetTextureHandle(App* app, ResourceHandle texture)
 {
-    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-        if (app->textures[texIdx].filepath == filepath)
-            return texIdx;
+    if (texture.generation == 0)
+        return app->textures[app->whiteTexture.index].handle;
+    if (!IsResourceAlive(app->textureRegistry, texture))
+        return app->textures[app->magentaTexture.index].handle;
+
+    TouchResource(app->textureRegistry, texture, app->frameIndex);
+    return app->textures[texture.index].handle;
+}
 
-    Image image = LoadImage(filepath);
+Mesh& GetMesh(App* app, ResourceHandle mesh)
+{
+    ASSERT(IsResourceAlive(app->meshRegistry, mesh), "Drawing a mesh that was evicted");
+    TouchResource(app->meshRegistry, mesh, app->frameIndex);
+    return app->meshes[mesh.index];
+}
 
-    if (image.pixels)
+u32 AllocateModel(App* app)
+{
+    if (!app->freeModels.empty())
     {
-        Texture tex = {};
-        tex.handle = CreateTexture2DFromImage(image);
-        tex.filepath = filepath;
+        const u32 modelIdx = app->freeModels.back();
+        app->freeModels.pop_back();
+        app->models[modelIdx] = Model{};
+        return modelIdx;
+    }
+    app->models.push_back(Model{});
+    return app->models.size() - 1;
+}
 
-        u32 texIdx = app->textures.size();
-        app->textures.push_back(tex);
+u32 AllocateMaterial(App* app)
+{
+    if (!app->freeMaterials.empty())
+    {
+        const u32 materialIdx = app->freeMaterials.back();
+        app->freeMaterials.pop_back();
+        app->materials[materialIdx] = Material{};
+        return materialIdx;
+    }
+    app->materials.push_back(Material{});
+    return app->materials.size() - 1;
+}
 
-        FreeImage(image);
-        return texIdx;
+void UnloadModel(App* app, u32 modelIdx)
+{
+    Model& model = app->models[modelIdx];
+    for (u32 materialIdx : model.materials)
+    {
+        const Material& material = app->materials[materialIdx];
+        ReleaseTexture(app, material.albedoTexture);
+        ReleaseTexture(app, material.emissiveTexture);
+        ReleaseTexture(app, material.specularTexture);
+        ReleaseTexture(app, material.normalsTexture);
+        ReleaseTexture(app, material.bumpTexture);
+        app->freeMaterials.push_back(materialIdx);
     }
-    else
+    ReleaseResource(app->meshRegistry, model.mesh, app->frameIndex);
+
+    model = Model{};
+    app->freeModels.push_back(modelIdx);
+}
+
+static void EvictTexture(App* app, u32 slotIndex)
+{
+    // Failed textures point at a placeholder that other textures still use
+    Texture& texture = app->textures[slotIndex];
+    if (texture.state != TextureState_Failed)
+        glDeleteTextures(1, &texture.handle);
+    UnmapFile(texture.cooked);
+    texture = Texture{};
+    DestroyResource(app->textureRegistry, slotIndex);
+}
+
+static void EvictMesh(App* app, u32 slotIndex)
+{
+    Mesh& mesh = app->meshes[slotIndex];
+    for (Submesh& submesh : mesh.submeshes)
+        for (const Vao& vao : submesh.vaos)
+            glDeleteVertexArrays(1, &vao.handle);
+    glDeleteBuffers(1, &mesh.vertexBufferHandle);
+    glDeleteBuffers(1, &mesh.indexBufferHandle);
+    mesh = Mesh{};
+    DestroyResource(app->meshRegistry, slotIndex);
+}
+
+bool EvictResources(App* app, u64 bytesNeeded)
+{
+    const u64 budget = (u64)app->vramBudgetMB * MB(1);
+    while (app->textureRegistry.residentBytes + app->meshRegistry.residentBytes + bytesNeeded > budget)
     {
-        return UINT32_MAX;
+        const u32 texture = FindEvictionCandidate(app->textureRegistry);
+        const u32 mesh = FindEvictionCandidate(app->meshRegistry);
+        if (texture == UINT32_MAX && mesh == UINT32_MAX)
+            return false; // Everything left is referenced
+
+        const bool evictTexture = mesh == UINT32_MAX ||
+            (texture != UINT32_MAX && app->textureRegistry.slots[texture].lastUsedFrame <= app->meshRegistry.slots[mesh].lastUsedFrame);
+        if (evictTexture)
+            EvictTexture(app, texture);
+        else
+            EvictMesh(app, mesh);
     }
+    return true;
 }
 
 GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
@@ -207,11 +820,15 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
             for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j) {
                 if (program.vertexInputLayout.attributes[i].location != submesh.vertexBufferLayout.attributes[j].location)
                     continue;
-                const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-                const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-                const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset;
+                const VertexBufferAttribute& attribute = submesh.vertexBufferLayout.attributes[j];
+                const u32 index = attribute.location;
+                const u32 ncomp = attribute.componentCount;
+                const u64 offset = attribute.offset + submesh.vertexOffset;
                 const u32 stride = submesh.vertexBufferLayout.stride;
-                glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+                if (attribute.integer)
+                    glVertexAttribIPointer(index, ncomp, attribute.type, stride, (void*)offset);
+                else
+                    glVertexAttribPointer(index, ncomp, attribute.type, attribute.normalized, stride, (void*)offset);
                 glEnableVertexAttribArray(index);
 
                 attributeWasLinked = true;
@@ -229,50 +846,816 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
     return vaoHandle;
 }
 
-void Init(App* app)
+void SetEntityLocalMatrix(App* app, u32 entityIdx, const glm::mat4& localMatrix)
 {
-	app->firstMouse = true;
-
-    InitGPUInfo(app);
-
-    InitModes(app);
-
-    InitTextureBuffers(app);
-
-    CreateAllObjects(app);
-
+    app->entities[entityIdx].localMatrix = localMatrix;
+    app->entities[entityIdx].dirty = true;
 }
 
-void Gui(App* app)
+void UpdateTransforms(App* app)
 {
-    ImGui::Begin("Info");
-    ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
+    // std140 LocalParms: world, world view projection and the normal matrix as three vec4 columns
+    const u32 stride = Align(2 * sizeof(glm::mat4) + 3 * sizeof(vec4), app->uniformBlockAlignmentOffset);
+    const u32 requiredSize = app->entities.size() * stride;
 
-    if (app->oglInfo.show)
+    bool uploadAll = app->cameraChanged;
+    if (app->entityParamsBuffer.size < requiredSize)
     {
-        ImGui::Separator();
-        ImGui::Begin("Info");
-        ImGui::Text("VERSION: %s", app->oglInfo.version);
-        ImGui::Text("RENDERER: %s", app->oglInfo.renderer);
-        ImGui::Text("VENDOR: %s", app->oglInfo.vendor);
-        ImGui::Text("SHADING LANGUAGE VERSION: %s", app->oglInfo.shadingLanguageVersion);
-        ImGui::Text("EXTENSIONS: %s", app->oglInfo.extensions);
-        ImGui::End();
+        glDeleteBuffers(1, &app->entityParamsBuffer.handle);
+        app->entityParamsBuffer = CreateBuffer(glm::max(requiredSize, app->entityParamsBuffer.size * 2), GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
+        uploadAll = true;
     }
-    ImGui::Separator();
-    ImGui::Text("Camera");
-	ImGui::InputFloat3("CameraUp", &app->camera.cameraUp.x, "%.3f");
-	ImGui::InputFloat3("CameraPos", &app->camera.cameraPos.x, "%.3f");
-	ImGui::InputFloat3("CameraRight", &app->camera.cameraRight.x, "%.3f");
-	ImGui::InputFloat("Yaw", &app->camera.yaw);
-	ImGui::InputFloat("Pitch", &app->camera.pitch);
-	ImGui::InputFloat("Sensitivity", &app->input.sensitivity);
 
-    ImGui::Separator();
-
-    static const char* controllers[] = {"Albedo", "Normals", "Depth", "Position"};
+    // Children follow their parents, so one pass in storage order sees every parent first
+    std::vector<u32> depths(app->entities.size());
+    std::vector<std::vector<u32>> changedByDepth;
+    std::vector<u32> changed;
+    u32 firstChanged = UINT32_MAX;
+    u32 lastChanged = 0;
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        Entity& entity = app->entities[i];
+        ASSERT(entity.parent < (i32)i, "Parents must be stored before their children");
+        const Entity* parent = entity.parent >= 0 ? &app->entities[entity.parent] : nullptr;
+
+        entity.localParamsOffset = i * stride;
+        entity.localParamsSize = stride;
+        entity.worldChanged = entity.dirty || (parent && parent->worldChanged);
+        entity.dirty = false;
+        depths[i] = parent ? depths[entity.parent] + 1 : 0;
+        if (!entity.worldChanged)
+            continue;
+
+        if (changedByDepth.size() <= depths[i])
+            changedByDepth.resize(depths[i] + 1);
+        changedByDepth[depths[i]].push_back(i);
+        changed.push_back(i);
+        if (entity.isStatic)
+            app->staticShadowsDirty = true;
+
+        firstChanged = glm::min(firstChanged, i);
+        lastChanged = i;
+    }
 
-	ImGui::Text("Lights");
+    // One batch per level of the hierarchy, every parent is final before its children
+    std::vector<glm::mat4> parents, locals, worlds;
+    for (u32 depth = 0; depth < changedByDepth.size(); ++depth)
+    {
+        const std::vector<u32>& level = changedByDepth[depth];
+        if (depth == 0)
+        {
+            for (u32 idx : level)
+                app->entities[idx].worldMatrix = app->entities[idx].localMatrix;
+            continue;
+        }
+
+        parents.resize(level.size());
+        locals.resize(level.size());
+        worlds.resize(level.size());
+        for (u32 j = 0; j < level.size(); ++j)
+        {
+            const Entity& entity = app->entities[level[j]];
+            parents[j] = app->entities[entity.parent].worldMatrix;
+            locals[j] = entity.localMatrix;
+        }
+        MultiplyMatrices(parents.data(), locals.data(), worlds.data(), level.size());
+        for (u32 j = 0; j < level.size(); ++j)
+            app->entities[level[j]].worldMatrix = worlds[j];
+    }
+
+    if (!changed.empty())
+    {
+        std::vector<glm::mat3> normalMatrices(changed.size());
+        worlds.resize(changed.size());
+        for (u32 j = 0; j < changed.size(); ++j)
+            worlds[j] = app->entities[changed[j]].worldMatrix;
+        ComputeNormalMatrices(worlds.data(), normalMatrices.data(), changed.size());
+        for (u32 j = 0; j < changed.size(); ++j)
+            app->entities[changed[j]].normalMatrix = normalMatrices[j];
+    }
+
+    if (uploadAll && !app->entities.empty())
+    {
+        firstChanged = 0;
+        lastChanged = app->entities.size() - 1;
+    }
+    if (firstChanged > lastChanged)
+        return;
+
+    // The rest of the buffer keeps the matrices of earlier frames
+    const u32 uploadCount = lastChanged - firstChanged + 1;
+    std::vector<glm::mat4> worldViewProjections(uploadCount);
+    worlds.resize(uploadCount);
+    for (u32 j = 0; j < uploadCount; ++j)
+    {
+        // Quantized positions are scaled back in the vertex shader by the same matrix
+        const Entity& entity = app->entities[firstChanged + j];
+        worlds[j] = entity.worldMatrix * GetMesh(app, app->models[entity.modelId].mesh).dequantize;
+    }
+    MultiplyMatrices(app->camera.GetViewMatrix(app->displaySize), worlds.data(), worldViewProjections.data(), uploadCount);
+
+    MapBufferRange(app->entityParamsBuffer, firstChanged * stride, uploadCount * stride, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    for (u32 j = 0; j < uploadCount; ++j)
+    {
+        const Entity& entity = app->entities[firstChanged + j];
+        app->entityParamsBuffer.head = j * stride;
+        PushMat4(app->entityParamsBuffer, worlds[j]);
+        PushMat4(app->entityParamsBuffer, worldViewProjections[j]);
+        PushVec3(app->entityParamsBuffer, entity.normalMatrix[0]);
+        PushVec3(app->entityParamsBuffer, entity.normalMatrix[1]);
+        PushVec3(app->entityParamsBuffer, entity.normalMatrix[2]);
+    }
+    UnmapBuffer(app->entityParamsBuffer);
+}
+
+void GetEntityWorldBounds(App* app, const Entity& entity, vec3& worldMin, vec3& worldMax)
+{
+    const Mesh& mesh = GetMesh(app, app->models[entity.modelId].mesh);
+    TransformBounds(&entity.worldMatrix, &mesh.aabbMin, &mesh.aabbMax, &worldMin, &worldMax, 1);
+}
+
+static void GrowBuffer(Buffer& buffer, u32 requiredSize, GLenum type)
+{
+    if (buffer.size >= requiredSize)
+        return;
+    glDeleteBuffers(1, &buffer.handle);
+    buffer = CreateBuffer(glm::max(requiredSize, buffer.size * 2), type, GL_STREAM_DRAW);
+}
+
+// Before the frame graph imports them, so the passes see the new handles
+void ReserveCullingBuffers(App* app)
+{
+    u32 commandCount = 0;
+    for (const Entity& entity : app->entities)
+        commandCount += GetMesh(app, app->models[entity.modelId].mesh).submeshes.size();
+
+    GrowBuffer(app->entityBoundsBuffer, app->entities.size() * 2 * sizeof(vec4), GL_SHADER_STORAGE_BUFFER);
+    GrowBuffer(app->drawCommandsBuffer, commandCount * sizeof(DrawElementsIndirectCommand), GL_DRAW_INDIRECT_BUFFER);
+}
+
+void CullOccludedEntities(App* app)
+{
+    // World space bounds of every entity, indexed by the commands' baseInstance
+    const u32 entityCount = app->entities.size();
+    std::vector<glm::mat4> worldMatrices(entityCount);
+    std::vector<vec3> localMin(entityCount), localMax(entityCount), worldMin(entityCount), worldMax(entityCount);
+    for (u32 i = 0; i < entityCount; ++i)
+    {
+        const Entity& entity = app->entities[i];
+        const Mesh& mesh = GetMesh(app, app->models[entity.modelId].mesh);
+        worldMatrices[i] = entity.worldMatrix;
+        localMin[i] = mesh.aabbMin;
+        localMax[i] = mesh.aabbMax;
+    }
+    TransformBounds(worldMatrices.data(), localMin.data(), localMax.data(), worldMin.data(), worldMax.data(), entityCount);
+
+    // Invalidated so the driver does not wait for last frame's cull dispatch
+    MapBufferRange(app->entityBoundsBuffer, 0, app->entityBoundsBuffer.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    for (u32 i = 0; i < entityCount; ++i)
+    {
+        PushVec4(app->entityBoundsBuffer, vec4(worldMin[i], 0.f));
+        PushVec4(app->entityBoundsBuffer, vec4(worldMax[i], 0.f));
+    }
+    UnmapBuffer(app->entityBoundsBuffer);
+
+    // One indirect command per submesh, in the same order the geometry pass draws them
+    u32 commandCount = 0;
+    MapBufferRange(app->drawCommandsBuffer, 0, app->drawCommandsBuffer.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        const Mesh& mesh = GetMesh(app, app->models[app->entities[i].modelId].mesh);
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            DrawElementsIndirectCommand command = {};
+            command.count = submesh.indexCount;
+            command.instanceCount = 1;
+            command.firstIndex = submesh.indexOffset / sizeof(u32);
+            command.baseVertex = 0;
+            command.baseInstance = i;
+            PushData(app->drawCommandsBuffer, &command, sizeof(command));
+            commandCount++;
+        }
+    }
+    UnmapBuffer(app->drawCommandsBuffer);
+
+    if (!app->occlusionCulling || !app->hizValid || commandCount == 0)
+        return;
+
+    // Test the bounds against last frame's pyramid, reprojected with last frame's camera
+    glUseProgram(app->programs[app->hizCullProgramIdx].handle);
+    glUniformMatrix4fv(app->hizCullProgramIdx_uPreviousViewProjection, 1, GL_FALSE, glm::value_ptr(app->previousViewProjection));
+    glUniform1i(app->hizCullProgramIdx_uCommandCount, commandCount);
+    glUniform1i(app->hizCullProgramIdx_uMaxLevel, app->hizLevelCount - 1);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->hizController);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(0), app->entityBoundsBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->drawCommandsBuffer.handle);
+
+    glDispatchCompute((commandCount + 63) / 64, 1, 1);
+    glUseProgram(0);
+}
+
+void RenderDepthPrePass(App* app)
+{
+    Program& depthPrePassProgram = app->programs[app->depthPrePassProgramIdx];
+    glUseProgram(depthPrePassProgram.handle);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->drawCommandsBuffer.handle);
+    u32 drawCommandIdx = 0;
+
+    for (int i = 0; i < app->entities.size(); ++i)
+    {
+        Mesh& mesh = GetMesh(app, app->models[app->entities[i].modelId].mesh);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->entityParamsBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
+
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        {
+            glBindVertexArray(FindVAO(mesh, j, depthPrePassProgram));
+            glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)(drawCommandIdx++ * sizeof(DrawElementsIndirectCommand)));
+        }
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glUseProgram(0);
+}
+
+void BuildDepthPyramid(App* app)
+{
+    glUseProgram(app->programs[app->hizBuildProgramIdx].handle);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->depthController);
+
+    // Level 0 copies the depth buffer, every other level reduces the previous one
+    for (u32 level = 0; level < app->hizLevelCount; ++level)
+    {
+        const ivec2 levelSize = ivec2(glm::max(app->renderSize.x >> level, 1), glm::max(app->renderSize.y >> level, 1));
+
+        glUniform1i(app->hizBuildProgramIdx_uFirstLevel, level == 0);
+        if (level > 0)
+            glBindImageTexture(0, app->hizController, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+        glBindImageTexture(1, app->hizController, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+
+        glDispatchCompute((levelSize.x + 7) / 8, (levelSize.y + 7) / 8, 1);
+        if (level + 1 < app->hizLevelCount)
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glUseProgram(0);
+
+    app->previousViewProjection = app->camera.GetViewMatrix(app->displaySize);
+    app->hizValid = true;
+}
+
+float GetLightRadius(const Light& light)
+{
+    // Distance at which intensity / distance drops below LIGHT_CUTOFF, every shader windows its
+    // attenuation to zero there, so culling at it never cuts a light off visibly
+    return light.intensity * glm::max(light.color.r, glm::max(light.color.g, light.color.b)) / LIGHT_CUTOFF;
+}
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    const glm::mat4 m = glm::transpose(viewProjection);
+
+    Frustum frustum = {};
+    frustum.planes[0] = m[3] + m[0]; // left
+    frustum.planes[1] = m[3] - m[0]; // right
+    frustum.planes[2] = m[3] + m[1]; // bottom
+    frustum.planes[3] = m[3] - m[1]; // top
+    frustum.planes[4] = m[3] + m[2]; // near
+    frustum.planes[5] = m[3] - m[2]; // far
+    for (vec4& plane : frustum.planes)
+        plane /= glm::length(vec3(plane));
+    return frustum;
+}
+
+bool SphereInFrustum(const Frustum& frustum, const vec3& center, float radius)
+{
+    for (const vec4& plane : frustum.planes)
+        if (glm::dot(vec3(plane), center) + plane.w < -radius)
+            return false;
+    return true;
+}
+
+void UpdateLightBuffer(App* app)
+{
+    if (app->lightsDirty)
+        for (Light& light : app->lights)
+            light.radius = GetLightRadius(light);
+
+    // Directional lights reach everything, point lights only if their sphere is in view
+    const Frustum frustum = ExtractFrustum(app->camera.GetViewMatrix(app->displaySize));
+
+    std::vector<u32> visibleLights;
+    for (u32 i = 0; i < app->lights.size() && visibleLights.size() < MAX_LIGHTS; ++i)
+    {
+        const Light& light = app->lights[i];
+        if (light.type == LightType_Directional || SphereInFrustum(frustum, light.position, light.radius))
+            visibleLights.push_back(i);
+    }
+
+    if (!app->lightsDirty && visibleLights == app->visibleLights)
+        return;
+
+    app->visibleLights.swap(visibleLights);
+    app->lightsDirty = false;
+
+    if (app->visibleLights.empty())
+        return;
+
+    // std430 layout of the Light struct in shaders.glsl
+    MapBufferRange(app->lightsBuffer, 0, app->visibleLights.size() * 4 * sizeof(vec4), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    for (u32 lightIdx : app->visibleLights)
+    {
+        const Light& light = app->lights[lightIdx];
+        PushVec3(app->lightsBuffer, light.color);
+        PushUInt(app->lightsBuffer, light.type);
+        PushVec3(app->lightsBuffer, light.direction);
+        PushFloat(app->lightsBuffer, light.intensity);
+        PushVec3(app->lightsBuffer, light.position);
+        PushFloat(app->lightsBuffer, light.radius);
+        PushUInt(app->lightsBuffer, light.shadowTile); // Read back as an int, -1 survives
+        AlignHead(app->lightsBuffer, sizeof(vec4));
+    }
+    UnmapBuffer(app->lightsBuffer);
+}
+
+glm::mat4 GetShadowViewProjection(App* app, const Light& light, u32 face)
+{
+    if (light.type == LightType_Directional)
+    {
+        // Fitted to the scene rather than the camera, so camera motion keeps the cached tile
+        const vec3 center = (app->sceneBoundsMin + app->sceneBoundsMax) * 0.5f;
+        const float radius = glm::max(glm::length(app->sceneBoundsMax - center), 1.f);
+        const vec3 direction = glm::normalize(light.direction);
+        const vec3 up = glm::abs(direction.y) > 0.99f ? vec3(0.f, 0.f, 1.f) : vec3(0.f, 1.f, 0.f);
+        return glm::ortho(-radius, radius, -radius, radius, 0.f, 2.f * radius) * glm::lookAt(center + direction * radius, center, up);
+    }
+
+    // Cube faces in the +X -X +Y -Y +Z -Z order the shaders pick them in
+    static const vec3 axes[] = { vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1) };
+    static const vec3 ups[] = { vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0) };
+    const glm::mat4 projection = glm::perspective(glm::radians(90.f), 1.f, SHADOW_NEAR_PLANE, GetLightRadius(light));
+    return projection * glm::lookAt(light.position, light.position + axes[face], ups[face]);
+}
+
+void UpdateShadowTiles(App* app)
+{
+    if (app->staticShadowsDirty)
+    {
+        app->staticBoundsMin = vec3(FLT_MAX);
+        app->staticBoundsMax = vec3(-FLT_MAX);
+        for (const Entity& entity : app->entities)
+        {
+            if (!entity.isStatic)
+                continue;
+            vec3 worldMin, worldMax;
+            GetEntityWorldBounds(app, entity, worldMin, worldMax);
+            app->staticBoundsMin = glm::min(app->staticBoundsMin, worldMin);
+            app->staticBoundsMax = glm::max(app->staticBoundsMax, worldMax);
+        }
+    }
+
+    // Dynamic casters move every frame, refitting to them exactly would invalidate the cached static
+    // tiles every frame too. The fit only grows, by a margin, when one leaves it.
+    vec3 dynamicMin = vec3(FLT_MAX);
+    vec3 dynamicMax = vec3(-FLT_MAX);
+    for (const Entity& entity : app->entities)
+    {
+        if (entity.isStatic)
+            continue;
+        vec3 worldMin, worldMax;
+        GetEntityWorldBounds(app, entity, worldMin, worldMax);
+        dynamicMin = glm::min(dynamicMin, worldMin);
+        dynamicMax = glm::max(dynamicMax, worldMax);
+    }
+
+    const bool hasDynamic = dynamicMin.x <= dynamicMax.x;
+    const bool dynamicInside = !hasDynamic ||
+        (glm::all(glm::greaterThanEqual(dynamicMin, app->sceneBoundsMin)) && glm::all(glm::lessThanEqual(dynamicMax, app->sceneBoundsMax)));
+    if (app->staticShadowsDirty || !dynamicInside)
+    {
+        app->sceneBoundsMin = app->staticBoundsMin;
+        app->sceneBoundsMax = app->staticBoundsMax;
+        if (hasDynamic)
+        {
+            app->sceneBoundsMin = glm::min(app->sceneBoundsMin, dynamicMin - vec3(SHADOW_FIT_MARGIN));
+            app->sceneBoundsMax = glm::max(app->sceneBoundsMax, dynamicMax + vec3(SHADOW_FIT_MARGIN));
+        }
+        if (app->sceneBoundsMin.x > app->sceneBoundsMax.x)
+            app->sceneBoundsMin = app->sceneBoundsMax = vec3(0.f);
+    }
+
+    // Tiles are handed out in light order, lights that do not fit cast no shadows
+    std::vector<ShadowTile> tiles;
+    for (Light& light : app->lights)
+    {
+        const u32 faceCount = light.type == LightType_Point ? 6 : 1;
+        i32 shadowTile = -1;
+        if (light.castShadows && tiles.size() + faceCount <= MAX_SHADOW_TILES)
+        {
+            shadowTile = tiles.size();
+            for (u32 face = 0; face < faceCount; ++face)
+            {
+                ShadowTile tile = {};
+                tile.viewProjection = GetShadowViewProjection(app, light, face);
+
+                // A tile keeps its cached casters for as long as it shows the same view
+                if (tiles.size() < app->shadowTiles.size())
+                {
+                    const ShadowTile& previous = app->shadowTiles[tiles.size()];
+                    tile.staticValid = previous.staticValid && !app->staticShadowsDirty && previous.viewProjection == tile.viewProjection;
+                    tile.liveIsStatic = previous.liveIsStatic && tile.staticValid;
+                }
+                tiles.push_back(tile);
+            }
+        }
+
+        if (light.shadowTile != shadowTile)
+        {
+            light.shadowTile = shadowTile;
+            app->lightsDirty = true;
+        }
+    }
+
+    bool matricesChanged = tiles.size() != app->shadowTiles.size();
+    for (const ShadowTile& tile : tiles)
+        matricesChanged |= !tile.staticValid;
+
+    app->shadowTiles.swap(tiles);
+    app->staticShadowsDirty = false;
+
+    app->hasDynamicCasters = false;
+    for (const Entity& entity : app->entities)
+        app->hasDynamicCasters |= !entity.isStatic;
+
+    if (matricesChanged && !app->shadowTiles.empty())
+    {
+        MapBufferRange(app->shadowMatricesBuffer, 0, app->shadowTiles.size() * sizeof(glm::mat4), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        for (const ShadowTile& tile : app->shadowTiles)
+            PushMat4(app->shadowMatricesBuffer, tile.viewProjection);
+        UnmapBuffer(app->shadowMatricesBuffer);
+    }
+}
+
+void DrawShadowCasters(App* app, u32 tileIdx, bool staticCasters)
+{
+    const ivec2 origin = ivec2(tileIdx % SHADOW_ATLAS_TILES, tileIdx / SHADOW_ATLAS_TILES) * SHADOW_TILE_SIZE;
+    glViewport(origin.x, origin.y, SHADOW_TILE_SIZE, SHADOW_TILE_SIZE);
+    glScissor(origin.x, origin.y, SHADOW_TILE_SIZE, SHADOW_TILE_SIZE);
+
+    Program& shadowCasterProgram = app->programs[app->shadowCasterProgramIdx];
+    glUniformMatrix4fv(app->shadowCasterProgramIdx_uViewProjection, 1, GL_FALSE, glm::value_ptr(app->shadowTiles[tileIdx].viewProjection));
+
+    for (const Entity& entity : app->entities)
+    {
+        if (entity.isStatic != staticCasters)
+            continue;
+
+        Mesh& mesh = GetMesh(app, app->models[entity.modelId].mesh);
+        const glm::mat4 world = entity.worldMatrix * mesh.dequantize;
+        glUniformMatrix4fv(app->shadowCasterProgramIdx_uWorld, 1, GL_FALSE, glm::value_ptr(world));
+
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        {
+            glBindVertexArray(FindVAO(mesh, j, shadowCasterProgram));
+            Submesh& submesh = mesh.submeshes[j];
+            glDrawElements(GL_TRIANGLES, submesh.indexCount, GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+        }
+    }
+    glBindVertexArray(0);
+}
+
+void RenderStaticShadows(App* app)
+{
+    glUseProgram(app->programs[app->shadowCasterProgramIdx].handle);
+    glEnable(GL_SCISSOR_TEST);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 4.f);
+
+    for (u32 i = 0; i < app->shadowTiles.size(); ++i)
+    {
+        ShadowTile& tile = app->shadowTiles[i];
+        if (tile.staticValid)
+            continue;
+
+        const ivec2 origin = ivec2(i % SHADOW_ATLAS_TILES, i / SHADOW_ATLAS_TILES) * SHADOW_TILE_SIZE;
+        glScissor(origin.x, origin.y, SHADOW_TILE_SIZE, SHADOW_TILE_SIZE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        DrawShadowCasters(app, i, true);
+        tile.staticValid = true;
+        tile.liveIsStatic = false;
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_SCISSOR_TEST);
+    glUseProgram(0);
+}
+
+void RenderShadows(App* app)
+{
+    // A tile only needs the copy when it holds something other than its static casters
+    for (u32 i = 0; i < app->shadowTiles.size(); ++i)
+    {
+        ShadowTile& tile = app->shadowTiles[i];
+        if (tile.liveIsStatic)
+            continue;
+
+        const ivec2 origin = ivec2(i % SHADOW_ATLAS_TILES, i / SHADOW_ATLAS_TILES) * SHADOW_TILE_SIZE;
+        glCopyImageSubData(app->staticShadowAtlas, GL_TEXTURE_2D, 0, origin.x, origin.y, 0,
+                           app->shadowAtlas, GL_TEXTURE_2D, 0, origin.x, origin.y, 0,
+                           SHADOW_TILE_SIZE, SHADOW_TILE_SIZE, 1);
+        tile.liveIsStatic = true;
+    }
+
+    if (!app->hasDynamicCasters)
+        return;
+
+    glUseProgram(app->programs[app->shadowCasterProgramIdx].handle);
+    glEnable(GL_SCISSOR_TEST);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 4.f);
+
+    for (u32 i = 0; i < app->shadowTiles.size(); ++i)
+    {
+        DrawShadowCasters(app, i, false);
+        app->shadowTiles[i].liveIsStatic = false;
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_SCISSOR_TEST);
+    glUseProgram(0);
+}
+
+void BindShadowAtlas(App* app)
+{
+    glActiveTexture(GL_TEXTURE0 + SHADOW_ATLAS_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, app->shadowAtlas);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(8), app->shadowMatricesBuffer.handle);
+}
+
+static void CreateLightIndexList(LightIndexList& list, u32 capacity)
+{
+    list.capacity = capacity;
+    list.indices = CreateBuffer(capacity * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+
+    const u32 zero = 0;
+    glGenBuffers(ARRAY_COUNT(list.readbacks), list.readbacks);
+    for (GLuint readback : list.readbacks)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(u32), &zero, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Grows the list to the total a cull asked for some frames ago, before the frame graph imports it
+static void ReserveLightIndexList(App* app, LightIndexList& list)
+{
+    if (!list.indices.handle)
+        return;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, list.readbacks[app->frameIndex % ARRAY_COUNT(list.readbacks)]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(u32), &list.requested);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    if (list.requested <= list.capacity)
+        return;
+    list.overflows++;
+    list.capacity = glm::max(list.requested, list.capacity * 2);
+    glDeleteBuffers(1, &list.indices.handle);
+    list.indices = CreateBuffer(list.capacity * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+}
+
+void ReserveLightIndexLists(App* app)
+{
+    ReserveLightIndexList(app, app->clusterLightIndices);
+    ReserveLightIndexList(app, app->tileLightIndices);
+}
+
+// The culls add to the total at the start of the grid, it starts every frame at zero
+static void ClearLightIndexTotal(const Buffer& grid)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, grid.handle);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+static void CopyLightIndexTotal(App* app, const Buffer& grid, LightIndexList& list)
+{
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, grid.handle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, list.readbacks[app->frameIndex % ARRAY_COUNT(list.readbacks)]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(u32));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void CullLightsInClusters(App* app)
+{
+    // The cluster grid only depends on the projection
+    const glm::mat4 projection = app->camera.GetProjectionMatrix(app->displaySize);
+    if (projection != app->clusterProjection)
+    {
+        glUseProgram(app->programs[app->clusterBuildProgramIdx].handle);
+        glUniformMatrix4fv(app->clusterBuildProgramIdx_uInverseProjection, 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+        glUniform1f(app->clusterBuildProgramIdx_uZNear, app->camera.zNear);
+        glUniform1f(app->clusterBuildProgramIdx_uZFar, app->camera.zFar);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), app->clusterBoundsBuffer.handle);
+        glDispatchCompute(1, 1, CLUSTER_GRID_Z);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        app->clusterProjection = projection;
+    }
+
+    glUseProgram(app->programs[app->clusterCullProgramIdx].handle);
+    glUniformMatrix4fv(app->clusterCullProgramIdx_uView, 1, GL_FALSE, glm::value_ptr(app->camera.GetLookAtMatrix()));
+    glUniform1i(app->clusterCullProgramIdx_uLightCount, app->visibleLights.size());
+    glUniform1ui(app->clusterCullProgramIdx_uLightIndexCapacity, app->clusterLightIndices.capacity);
+    ClearLightIndexTotal(app->clusterLightGridBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->lightsBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), app->clusterBoundsBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), app->clusterLightGridBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), app->clusterLightIndices.indices.handle);
+    glDispatchCompute((CLUSTER_COUNT + 127) / 128, 1, 1);
+    glUseProgram(0);
+
+    CopyLightIndexTotal(app, app->clusterLightGridBuffer, app->clusterLightIndices);
+}
+
+void RenderLightVolumes(App* app)
+{
+    Program& lightVolumesProgram = app->programs[app->lightVolumesProgramIdx];
+    glUseProgram(lightVolumesProgram.handle);
+    glUniformMatrix4fv(app->lightVolumesProgramIdx_uViewProjection, 1, GL_FALSE, glm::value_ptr(app->camera.GetViewMatrix(app->displaySize)));
+    glUniform2f(app->lightVolumesProgramIdx_uScreenSize, app->renderSize.x, app->renderSize.y);
+
+    // RenderSphere() facets dip below the unit sphere by at most this factor, from its segment counts
+    const float volumeScale = 1.f / (std::cos(PI / SPHERE_X_SEGMENTS) * std::cos(PI / SPHERE_Y_SEGMENTS));
+    glUniform1f(app->lightVolumesProgramIdx_uVolumeScale, volumeScale);
+
+    glUniformMatrix4fv(app->lightVolumesProgramIdx_uInverseViewProjection, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.GetViewMatrix(app->displaySize))));
+
+    glUniform1i(app->lightVolumesProgramIdx_uDepth, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->depthController);
+
+    glUniform1i(app->lightVolumesProgramIdx_uNormals, 1);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, app->normalsController);
+
+    glUniform1i(app->lightVolumesProgramIdx_uAlbedo, 2);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, app->albedoController);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->lightsBuffer.handle);
+    BindShadowAtlas(app);
+
+    // Ambient term, then one additive fullscreen pass per directional light
+    glUniform4f(app->lightVolumesProgramIdx_uLightVolume, 0.f, 0.f, 0.f, 0.f);
+    glUniform1i(app->lightVolumesProgramIdx_uLightIndex, -1);
+    renderQuad();
+
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    // Indices into the light buffer are compact, only visible lights are in it
+    for (u32 i = 0; i < app->visibleLights.size(); ++i)
+    {
+        if (app->lights[app->visibleLights[i]].type != LightType_Directional)
+            continue;
+        glUniform1i(app->lightVolumesProgramIdx_uLightIndex, i);
+        renderQuad();
+    }
+
+    // Point lights only shade the pixels whose surface lies inside their sphere
+    glEnable(GL_STENCIL_TEST);
+    glDepthMask(GL_FALSE);
+
+    for (u32 i = 0; i < app->visibleLights.size(); ++i)
+    {
+        const Light& light = app->lights[app->visibleLights[i]];
+        if (light.type != LightType_Point)
+            continue;
+
+        glUniform1i(app->lightVolumesProgramIdx_uLightIndex, i);
+        glUniform4f(app->lightVolumesProgramIdx_uLightVolume, light.position.x, light.position.y, light.position.z, light.radius);
+
+        // Back faces behind the surface increment, front faces behind it decrement
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+        RenderSphere();
+
+        // Shade the marked pixels through the back faces, which also works with the
+        // camera inside the volume, and reset the stencil for the next light
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_ZERO, GL_ZERO);
+        RenderSphere();
+    }
+    glBindVertexArray(0);
+
+    glCullFace(GL_BACK);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(0);
+}
+
+void SpawnPointLights(App* app, u32 count)
+{
+    for (u32 i = 0; i < count && app->lights.size() < MAX_LIGHTS; ++i)
+    {
+        vec3 color = vec3(rand(), rand(), rand()) / (float)RAND_MAX;
+        vec3 position = (vec3(rand(), rand(), rand()) / (float)RAND_MAX - 0.5f) * vec3(20.f, 4.f, 20.f);
+        float intensity = 0.05f + 0.15f * rand() / (float)RAND_MAX;
+        app->lights.push_back(Light(LightType::LightType_Point, color, vec3(0.0, -1.0, 0.0), position, intensity));
+    }
+    app->lightsDirty = true;
+}
+
+void Init(App* app)
+{
+	app->firstMouse = true;
+
+    InitGPUInfo(app);
+
+    InitSimdKernels();
+
+    app->textureLoader = new TextureLoader;
+    StartTextureLoader(*app->textureLoader);
+    app->whiteTexture = CreateSolidTexture(app, 255, 255, 255, 255);
+    app->blackTexture = CreateSolidTexture(app, 0, 0, 0, 255);
+    app->normalTexture = CreateSolidTexture(app, 128, 128, 255, 255);
+    app->magentaTexture = CreateSolidTexture(app, 255, 0, 255, 255);
+
+    InitModes(app);
+
+    // Shader sources are read relative to the working directory
+    StartFileWatcher(".");
+
+    InitTextureBuffers(app);
+
+    CreateAllObjects(app);
+
+}
+
+void Shutdown(App* app)
+{
+    StopFileWatcher();
+
+    StopTextureLoader(*app->textureLoader);
+    delete app->textureLoader;
+    app->textureLoader = nullptr;
+
+    for (Texture& texture : app->textures)
+        UnmapFile(texture.cooked);
+}
+
+void Gui(App* app)
+{
+    ImGui::Begin("Info");
+    ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
+
+    if (app->oglInfo.show)
+    {
+        ImGui::Separator();
+        ImGui::Begin("Info");
+        ImGui::Text("VERSION: %s", app->oglInfo.version);
+        ImGui::Text("RENDERER: %s", app->oglInfo.renderer);
+        ImGui::Text("VENDOR: %s", app->oglInfo.vendor);
+        ImGui::Text("SHADING LANGUAGE VERSION: %s", app->oglInfo.shadingLanguageVersion);
+        ImGui::Text("EXTENSIONS: %s", app->oglInfo.extensions);
+        ImGui::End();
+    }
+    ImGui::Separator();
+    ImGui::Text("Camera");
+	ImGui::InputFloat3("CameraUp", &app->camera.cameraUp.x, "%.3f");
+	ImGui::InputFloat3("CameraPos", &app->camera.cameraPos.x, "%.3f");
+	ImGui::InputFloat3("CameraRight", &app->camera.cameraRight.x, "%.3f");
+	ImGui::InputFloat("Yaw", &app->camera.yaw);
+	ImGui::InputFloat("Pitch", &app->camera.pitch);
+	ImGui::InputFloat("Sensitivity", &app->input.sensitivity);
+
+    ImGui::Separator();
+
+    static const char* controllers[] = {"Albedo", "Normals", "Depth"};
+
+	ImGui::Text("Lights");
 
 	ImGui::Checkbox("Show Light Gizmo", &app->showGizmo);
 
@@ -280,13 +1663,14 @@ void Gui(App* app)
         for (int i = 0; i < app->lights.size(); ++i) {
             ImGui::PushID(i);
             if (app->lights[i].type == 0) { //Directional
-                ImGui::DragFloat3("direction", glm::value_ptr(app->lights[i].direction), 0.01f);
+                app->lightsDirty |= ImGui::DragFloat3("direction", glm::value_ptr(app->lights[i].direction), 0.01f);
             }
             else {
-                ImGui::DragFloat3("position", glm::value_ptr(app->lights[i].position), 0.01f);
+                app->lightsDirty |= ImGui::DragFloat3("position", glm::value_ptr(app->lights[i].position), 0.01f);
             }
-            ImGui::DragFloat3("color", glm::value_ptr(app->lights[i].color), 0.01f);
-            ImGui::DragFloat("intensity", &app->lights[i].intensity, 0.01f);
+            app->lightsDirty |= ImGui::DragFloat3("color", glm::value_ptr(app->lights[i].color), 0.01f);
+            app->lightsDirty |= ImGui::DragFloat("intensity", &app->lights[i].intensity, 0.01f);
+            ImGui::Checkbox("cast shadows", &app->lights[i].castShadows);
             ImGui::PopID();
             ImGui::NewLine();
         }
@@ -294,12 +1678,12 @@ void Gui(App* app)
 
 	ImGui::Separator();
 
-    static const char* renderModes[] = { "Forward", "Deferred" };
+    static const char* renderModes[] = { "Forward", "Deferred", "Forward+" };
 
     static int select = 1;
     ImGui::Text("Shader Mode");
     if (ImGui::BeginCombo("Mode", renderModes[select])) {
-        for (int i = 0; i < 2; ++i)
+        for (int i = 0; i < ARRAY_COUNT(renderModes); ++i)
             if (ImGui::Selectable(renderModes[i])) select = i;
         ImGui::EndCombo();
     }
@@ -312,52 +1696,269 @@ void Gui(App* app)
     case 1:
         app->mode = Mode::Mode_Deferred;
         break;
+    case 2:
+        app->mode = Mode::Mode_ForwardPlus;
+        break;
     default:
         break;
     }
 
     ImGui::Separator();
 
+    static const char* lightingPaths[] = { "Fullscreen", "Clustered", "Light Volumes" };
+
+    ImGui::Text("Deferred Lighting");
+    if (ImGui::BeginCombo("Lighting", lightingPaths[app->lightingPath])) {
+        for (int i = 0; i < LightingPath_Count; ++i)
+            if (ImGui::Selectable(lightingPaths[i])) app->lightingPath = (LightingPath)i;
+        ImGui::EndCombo();
+    }
+    if (app->lightingPath == LightingPath_Fullscreen)
+    {
+        static const char* lightingResolutions[] = { "Full", "Half", "Quarter" };
+        int lightingResolution = app->lightingDownsample == 4 ? 2 : app->lightingDownsample == 2 ? 1 : 0;
+        if (ImGui::Combo("Lighting Resolution", &lightingResolution, lightingResolutions, ARRAY_COUNT(lightingResolutions)))
+            app->lightingDownsample = 1u << lightingResolution;
+    }
+    ImGui::Text("Lights: %u (%u visible)", (u32)app->lights.size(), (u32)app->visibleLights.size());
+    if (ImGui::Button("Spawn 1000 Point Lights"))
+        SpawnPointLights(app, 1000);
+    ImGui::Text("Shadow tiles: %u / %u", (u32)app->shadowTiles.size(), MAX_SHADOW_TILES);
+
+    ImGui::Separator();
+
     ImGui::Checkbox("Show Relief", &app->showRelief);
+    ImGui::SliderFloat("Relief Distance", &app->reliefMaxDistance, 1.f, 50.f);
+    ImGui::Checkbox("Occlusion Culling", &app->occlusionCulling);
+    ImGui::Checkbox("Depth Pre-Pass", &app->depthPrePass);
+
+    ImGui::Separator();
+
+    ImGui::Text("GPU: %.2f ms, resolution %dx%d (%.0f%%)", app->gpuFrameMs, app->renderSize.x, app->renderSize.y, app->renderScale * 100.f);
+    ImGui::Text("CPU kernels: %s", GetSimdKernelName());
+    const LightIndexList& lightIndices = app->mode == Mode_ForwardPlus ? app->tileLightIndices : app->clusterLightIndices;
+    ImGui::Text("Light indices: %u of %u", lightIndices.requested, lightIndices.capacity);
+    if (lightIndices.overflows > 0)
+        ImGui::TextColored(ImVec4(1.f, 0.6f, 0.f, 1.f), "Light lists were cut short %u times, grown to fit", lightIndices.overflows);
+    u32 loadingTextures = 0;
+    for (const Texture& texture : app->textures)
+        loadingTextures += texture.state == TextureState_Loading;
+    if (loadingTextures > 0)
+        ImGui::Text("Loading %u textures", loadingTextures);
+    ImGui::Text("Resident: %.1f MB textures, %.1f MB meshes",
+                app->textureRegistry.residentBytes / (float)MB(1), app->meshRegistry.residentBytes / (float)MB(1));
+    ImGui::SliderInt("VRAM Budget (MB)", &app->vramBudgetMB, 64, 4096);
+    ImGui::Checkbox("Dynamic Resolution", &app->dynamicResolution);
+    ImGui::SliderFloat("GPU Budget (ms)", &app->gpuBudgetMs, 4.f, 33.f);
 
     ImGui::Separator();
 
     static int sel = 0;
     ImGui::Text("Target render");
     if (ImGui::BeginCombo("Target", controllers[sel])) {
-        for (int i = 0; i < 4; ++i)
+        for (int i = 0; i < ARRAY_COUNT(controllers); ++i)
             if (ImGui::Selectable(controllers[i])) sel = i;
         ImGui::EndCombo();
     }
 
-    GLuint texture = 0;
-    switch (sel)
+    GLuint texture = 0;
+    switch (sel)
+    {
+    case 0:
+        texture = app->albedoController;
+        break;
+    case 1:
+        texture = app->normalsController;
+        break;
+    case 2:
+        texture = app->depthController;
+        break;
+    default:
+        break;
+    }
+
+	
+
+    ImGui::Image((ImTextureID)texture, ImVec2(ImGui::GetWindowWidth(), app->displaySize.y * ImGui::GetWindowWidth() / app->displaySize.x), ImVec2(0.f, 1.f), ImVec2(1.f, 0.f));
+
+    ImGui::End();
+}
+
+void CullLightsInTiles(App* app)
+{
+    // One work group per tile, bounded by the depth range the pre-pass left in it
+    glUseProgram(app->programs[app->tileCullProgramIdx].handle);
+    glUniformMatrix4fv(app->tileCullProgramIdx_uInverseProjection, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.GetProjectionMatrix(app->displaySize))));
+    glUniformMatrix4fv(app->tileCullProgramIdx_uView, 1, GL_FALSE, glm::value_ptr(app->camera.GetLookAtMatrix()));
+    glUniform1i(app->tileCullProgramIdx_uLightCount, app->visibleLights.size());
+    glUniform1ui(app->tileCullProgramIdx_uLightIndexCapacity, app->tileLightIndices.capacity);
+    ClearLightIndexTotal(app->tileLightGridBuffer);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->depthController);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->lightsBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), app->tileLightGridBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), app->tileLightIndices.indices.handle);
+
+    glDispatchCompute(app->tileCount.x, app->tileCount.y, 1);
+    glUseProgram(0);
+
+    CopyLightIndexTotal(app, app->tileLightGridBuffer, app->tileLightIndices);
+}
+
+void PushGlobalParams(App* app)
+{
+    // Pushed up front so no draw is issued while the buffer is mapped,
+    // per entity parameters live in entityParamsBuffer
+    MapBuffer(app->cBuffer, GL_WRITE_ONLY);
+    app->globalParamsOffset = app->cBuffer.head;
+
+    PushVec3(app->cBuffer, app->camera.cameraPos);
+    PushUInt(app->cBuffer, app->visibleLights.size());
+    app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
+
+    UnmapBuffer(app->cBuffer);
+}
+
+GLuint AcquireRenderTarget(App* app, GLenum internalFormat, ivec2 size, u32 levels)
+{
+    // Reuse an idle target of the same format and size before allocating a new one
+    for (RenderTarget& target : app->renderTargets)
+    {
+        if (!target.inUse && target.internalFormat == internalFormat && target.size == size && target.levels == levels)
+        {
+            target.inUse = true;
+            return target.handle;
+        }
+    }
+
+    RenderTarget target = {};
+    target.internalFormat = internalFormat;
+    target.size = size;
+    target.levels = levels;
+    target.inUse = true;
+
+    glGenTextures(1, &target.handle);
+    glBindTexture(GL_TEXTURE_2D, target.handle);
+    glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, size.x, size.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    app->renderTargets.push_back(target);
+    return target.handle;
+}
+
+void ReleaseRenderTarget(App* app, GLuint handle)
+{
+    for (RenderTarget& target : app->renderTargets)
+    {
+        if (target.handle == handle)
+        {
+            target.inUse = false;
+            target.releaseFrame = app->frameIndex;
+        }
+    }
+}
+
+void TrimRenderTargets(App* app)
+{
+    // Targets nobody asked for in a while are from sizes we are not coming back to
+    for (u32 i = 0; i < app->renderTargets.size();)
+    {
+        const RenderTarget& target = app->renderTargets[i];
+        if (!target.inUse && app->frameIndex - target.releaseFrame > RENDER_TARGET_IDLE_FRAMES)
+        {
+            RGFlushFramebuffers(app->renderGraph);
+            glDeleteTextures(1, &target.handle);
+            app->renderTargets.erase(app->renderTargets.begin() + i);
+        }
+        else
+            ++i;
+    }
+}
+
+void ResizeRenderTargets(App* app, ivec2 renderSize)
+{
+    RGFlushFramebuffers(app->renderGraph);
+
+    if (app->colorController)
+    {
+        ReleaseRenderTarget(app, app->colorController);
+        ReleaseRenderTarget(app, app->normalsController);
+        ReleaseRenderTarget(app, app->albedoController);
+        ReleaseRenderTarget(app, app->depthController);
+        ReleaseRenderTarget(app, app->hizController);
+        glDeleteBuffers(1, &app->tileLightGridBuffer.handle);
+    }
+    app->renderSize = renderSize;
+
+    app->colorController = AcquireRenderTarget(app, GL_RGBA8, renderSize, 1);
+    app->normalsController = AcquireRenderTarget(app, GL_RG16, renderSize, 1);
+    app->albedoController = AcquireRenderTarget(app, GL_RGBA8, renderSize, 1);
+    app->depthController = AcquireRenderTarget(app, GL_DEPTH24_STENCIL8, renderSize, 1);
+
+    // Min/max depth pyramid used by the occlusion culling
+    app->hizLevelCount = 1 + (u32)floor(log2((float)glm::max(renderSize.x, renderSize.y)));
+    app->hizController = AcquireRenderTarget(app, GL_RG32F, renderSize, app->hizLevelCount);
+    app->hizValid = false;
+
+    // Per-tile light lists of the Forward+ mode
+    app->tileCount = (renderSize + ivec2(TILE_SIZE - 1)) / TILE_SIZE;
+    const u32 tiles = app->tileCount.x * app->tileCount.y;
+    app->tileLightGridBuffer = CreateBuffer(2 * sizeof(u32) + tiles * 2 * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+    if (!app->tileLightIndices.indices.handle)
+        CreateLightIndexList(app->tileLightIndices, tiles * LIGHT_INDICES_PER_CELL);
+}
+
+void UpdateRenderResolution(App* app)
+{
+    // Read the timer of the oldest frame in flight, without waiting for it
+    const u32 queryIdx = app->frameIndex % ARRAY_COUNT(app->gpuTimerQueries);
+    if (app->frameIndex >= ARRAY_COUNT(app->gpuTimerQueries))
     {
-    case 0:
-        texture = app->albedoController;
-        break;
-    case 1:
-        texture = app->normalsController;
-        break;
-    case 2:
-        texture = app->depthController;
-        break;
-    case 3:
-        texture = app->positionController;
-        break;
-    default:
-        break;
+        GLint available = 0;
+        glGetQueryObjectiv(app->gpuTimerQueries[queryIdx], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(app->gpuTimerQueries[queryIdx], GL_QUERY_RESULT, &elapsed);
+            app->gpuFrameMs = elapsed / 1000000.f;
+        }
     }
 
-	
+    // Step the scale down as soon as we are over budget, and back up only with clear headroom
+    if (!app->dynamicResolution)
+        app->renderScale = 1.f;
+    else if (app->renderScaleCooldown > 0)
+        app->renderScaleCooldown--;
+    else if (app->gpuFrameMs > app->gpuBudgetMs || app->gpuFrameMs < app->gpuBudgetMs * 0.8f)
+    {
+        const float step = app->gpuFrameMs > app->gpuBudgetMs ? -RENDER_SCALE_STEP : RENDER_SCALE_STEP;
+        const float renderScale = glm::clamp(app->renderScale + step, MIN_RENDER_SCALE, 1.f);
+        if (renderScale != app->renderScale)
+        {
+            app->renderScale = renderScale;
+            app->renderScaleCooldown = RENDER_SCALE_COOLDOWN_FRAMES;
+        }
+    }
 
-    ImGui::Image((ImTextureID)texture, ImVec2(ImGui::GetWindowWidth(), app->displaySize.y * ImGui::GetWindowWidth() / app->displaySize.x), ImVec2(0.f, 1.f), ImVec2(1.f, 0.f));
+    const ivec2 renderSize = glm::max(ivec2(vec2(app->displaySize) * app->renderScale), ivec2(1));
+    if (renderSize != app->renderSize)
+        ResizeRenderTargets(app, renderSize);
 
-    ImGui::End();
+    TrimRenderTargets(app);
 }
 
 void Update(App* app)
 {
+    HotReloadPrograms(app);
+    UploadLoadedTextures(app);
+    StreamTextureMips(app);
+    EvictResources(app);
+
     // You can handle app->input keyboard/mouse here
     if (app->input.keys[K_0] == ButtonState::BUTTON_PRESS)
         app->oglInfo.show = !app->oglInfo.show;
@@ -398,266 +1999,626 @@ void Update(App* app)
         app->camera.rotating = false;
 }
 
-void Render(App* app)
+void RenderTexturedQuad(App* app)
 {
-    // - clear the framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferController);
-    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,  GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
-    glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
+    // - bind the texture into unit 0
+    glUniform1i(app->programUniformTexture, 0);
+    glActiveTexture(GL_TEXTURE0);
+    GLuint textureHandle = GetTextureHandle(app, app->diceTexture);
+    glBindTexture(GL_TEXTURE_2D, textureHandle);
 
-    glClearColor(0.2f, 0.2f, 0.2f, 1.f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // - bind the program
+    //   (...and make its texture sample from unit 0)
+    const Program& programTexturedGeometry = app->programs[app->texturedGeometryProgramIdx];
+    glUseProgram(programTexturedGeometry.handle);
 
-    // - set the viewport
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    // - bind the vao
+    glBindVertexArray(app->vao);
 
-    // - set the blending state
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // - glDrawElements() !!!
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-    glEnable(GL_DEPTH_TEST);
-    switch (app->mode)
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+void RenderForward(App* app)
+{
+    // The light loop is bounded by the smallest tier that holds every visible light
+    const u32 featureKey = GetLightCountTier(app->visibleLights.size()) << SHADER_LIGHT_TIER_SHIFT;
+    Program& texturedMeshProgram = app->programs[GetProgramPermutation(app, app->texturedMeshProgramIdx, featureKey)];
+    glUseProgram(texturedMeshProgram.handle);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->lightsBuffer.handle);
+
+    for (int i = 0; i < app->entities.size(); ++i)
     {
-        case Mode_TexturedQuad:
-            {
-            // - bind the texture into unit 0
-            glUniform1i(app->programUniformTexture, 0);
+        Model& model = app->models[app->entities[i].modelId];
+        Mesh& mesh = GetMesh(app, model.mesh);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->entityParamsBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
+            GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
+            glBindVertexArray(vao);
+
+            u32 submeshMaterialIdx = model.materialIdx[i];
+            Material& submeshmaterial = app->materials[submeshMaterialIdx];
+
             glActiveTexture(GL_TEXTURE0);
-            GLuint textureHandle = app->textures[app->diceTexIdx].handle;
-            glBindTexture(GL_TEXTURE_2D, textureHandle);
+            glBindTexture(GL_TEXTURE_2D, GetTextureHandle(app, submeshmaterial.albedoTexture));
 
-            // - bind the program
-            //   (...and make its texture sample from unit 0)
-            const Program& programTexturedGeometry = app->programs[app->texturedGeometryProgramIdx];
-            glUseProgram(programTexturedGeometry.handle);
+            Submesh& submesh = mesh.submeshes[i];
+            glDrawElements(GL_TRIANGLES, submesh.indexCount, GL_UNSIGNED_INT, (void*)submesh.indexOffset);
+        }
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
 
-            // - bind the vao
-            glBindVertexArray(app->vao);
+// Relief skips cells by their max-mip texels, an average chain or a placeholder would step over the surface
+static bool IsMaxMipHeightMap(App* app, ResourceHandle texture)
+{
+    if (!IsResourceAlive(app->textureRegistry, texture))
+        return false;
+    const Texture& tex = app->textures[texture.index];
+    return tex.usage == TextureUsage_Height && tex.state == TextureState_Resident;
+}
 
-            // - glDrawElements() !!!
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+u32 GetGeometryFeatureKey(App* app, const Material& material)
+{
+    u32 featureKey = 0;
+    if (material.normalsTexture.generation != 0)
+        featureKey |= ShaderFeature_NormalMap;
+    if (app->showRelief && IsMaxMipHeightMap(app, material.bumpTexture))
+        featureKey |= ShaderFeature_Relief;
+    return featureKey;
+}
 
-            glBindVertexArray(0);
-            glUseProgram(0);
-            }
-            break;
-        case Mode_Forward:
-        {
-            Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
-            glUseProgram(texturedMeshProgram.handle);
+void RenderGeometryPass(App* app)
+{
+    if (app->depthPrePass)
+    {
+        // Depth is final, so the G-buffer shader only runs for visible fragments
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
 
-            MapBuffer(app->cBuffer, GL_WRITE_ONLY);
-            app->globalParamsOffset = app->cBuffer.head;
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->drawCommandsBuffer.handle);
+    u32 drawCommandIdx = 0;
+    u32 boundProgramIdx = UINT32_MAX;
+    u32 boundMaterialIdx = UINT32_MAX;
 
-            PushVec3(app->cBuffer, app->camera.cameraPos);
-            PushUInt(app->cBuffer, app->lights.size());
+    for (int i = 0; i < app->entities.size(); ++i)
+    {
+        Model& model = app->models[app->entities[i].modelId];
+        Mesh& mesh = GetMesh(app, model.mesh);
 
-            for (auto& light : app->lights)
-            {
-                AlignHead(app->cBuffer, sizeof(glm::vec4));
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->entityParamsBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
 
-                PushUInt(app->cBuffer, light.type);
-                PushVec3(app->cBuffer, light.color);
-                PushVec3(app->cBuffer, light.direction);
-                PushVec3(app->cBuffer, light.position);
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
+            u32 submeshMaterialIdx = model.materialIdx[i];
+            Material& submeshmaterial = app->materials[submeshMaterialIdx];
 
-                app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
+            // Only switch programs when the material needs a different permutation
+            const u32 featureKey = GetGeometryFeatureKey(app, submeshmaterial);
+            const u32 programIdx = GetProgramPermutation(app, app->texturedMeshProgram2Idx, featureKey);
+            Program& texturedMeshProgram = app->programs[programIdx];
+            if (programIdx != boundProgramIdx)
+            {
+                glUseProgram(texturedMeshProgram.handle);
+                if (texturedMeshProgram.featureKey & ShaderFeature_Relief)
+                    glUniform1f(RELIEF_MAX_DISTANCE_LOCATION, app->reliefMaxDistance);
+                boundProgramIdx = programIdx;
             }
 
-            for (int i = 0; i < app->entities.size(); ++i)
+            // Samplers have fixed bindings in every permutation, the ones it does not declare are ignored
+            if (submeshMaterialIdx != boundMaterialIdx)
             {
-                Model& model = app->models[app->entities[i].modelId];
-                Mesh& mesh = app->meshes[model.meshIdx];
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, GetTextureHandle(app, submeshmaterial.albedoTexture));
+
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, GetTextureHandle(app, submeshmaterial.normalsTexture));
 
-                AlignHead(app->cBuffer, app->uniformBlockAlignmentOffset);
-                app->entities[i].localParamsOffset = app->cBuffer.head;
+                glActiveTexture(GL_TEXTURE2);
+                glBindTexture(GL_TEXTURE_2D, GetTextureHandle(app, submeshmaterial.bumpTexture));
+                boundMaterialIdx = submeshMaterialIdx;
+            }
 
-                float angle = 70;
-                PushMat4(app->cBuffer, glm::rotate(glm::scale(app->entities[i].matrix, glm::vec3(2, 2, 2)), glm::radians(angle), glm::vec3(1, 0, 0)));
-                PushMat4(app->cBuffer, app->camera.GetViewMatrix(app->displaySize));
-                app->entities[i].localParamsSize = app->cBuffer.head - app->entities[i].localParamsOffset;
+            GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
+            glBindVertexArray(vao);
 
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
+            glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)(drawCommandIdx++ * sizeof(DrawElementsIndirectCommand)));
+        }
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
 
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
-                    GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-                    glBindVertexArray(vao);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+}
 
-                    u32 submeshMaterialIdx = model.materialIdx[i];
-                    Material& submeshmaterial = app->materials[submeshMaterialIdx];
+void RenderFullscreenLighting(App* app, GLuint depthTexture, GLuint normalsTexture, bool lightingOnly)
+{
+    glUseProgram(app->programs[app->lightsProgramIdx].handle);
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submeshmaterial.albedoTextureIdx].handle);
-                    glUniform1i(app->texturedMeshProgram_uTextureForward, 0);
+    glUniformMatrix4fv(app->texturedMeshProgramIdx_uInverseViewProjection, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.GetViewMatrix(app->displaySize))));
+    glUniform1i(app->lightsProgramIdx_uLightingOnly, lightingOnly);
 
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)submesh.indexOffset);
-                }
-            }
-            UnmapBuffer(app->cBuffer);
-            glBindFramebuffer(GL_READ_FRAMEBUFFER, app->frameBufferController);
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-            glBlitFramebuffer(0, 0, app->displaySize.x, app->displaySize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
-            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-            break;
-        }
-        case Mode_Deferred:
-        {
-            Program& texturedMeshProgram = app->programs[app->texturedMeshProgram2Idx];
-            glUseProgram(texturedMeshProgram.handle);
+    glUniform1i(app->texturedMeshProgramIdx_uDepth, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
 
-            MapBuffer(app->cBuffer, GL_WRITE_ONLY);
-            app->globalParamsOffset = app->cBuffer.head;
+    glUniform1i(app->texturedMeshProgramIdx_uNormals, 1);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, normalsTexture);
 
-            PushVec3(app->cBuffer, app->camera.cameraPos);
-            PushUInt(app->cBuffer, app->lights.size());
-            app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
+    glUniform1i(app->texturedMeshProgramIdx_uAlbedo, 2);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, app->albedoController);
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, app->textures[app->toyDiffuseIdx].handle);
-            glUniform1i(app->texturedMeshProgram_uTextureDeferred, 0);
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->lightsBuffer.handle);
+    BindShadowAtlas(app);
+    renderQuad();
+}
 
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, app->textures[app->toyNormalIdx].handle);
-            glUniform1i(app->texturedMeshProgram_uTextureRelieveNormal, 1);
+void DownsampleGBuffer(App* app)
+{
+    // Raw depth goes to a float target, there is nothing to blend
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
 
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, app->textures[app->toyHeightIdx].handle);
-            glUniform1i(app->texturedMeshProgram_uTextureRelieveHeight, 2);
+    glUseProgram(app->programs[app->downsampleGBufferProgramIdx].handle);
+    glUniform1i(app->downsampleGBufferProgramIdx_uDownsample, app->lightingDownsample);
 
-            glUniform1i(glGetUniformLocation(texturedMeshProgram.handle, "uShowRelief"), app->showRelief);
+    glUniform1i(app->downsampleGBufferProgramIdx_uDepth, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->depthController);
 
-            for (int i = 0; i < app->entities.size(); ++i)
-            {
-                Model& model = app->models[app->entities[i].modelId];
-                Mesh& mesh = app->meshes[model.meshIdx];
-
-                AlignHead(app->cBuffer, app->uniformBlockAlignmentOffset);
-                app->entities[i].localParamsOffset = app->cBuffer.head;
-                float angle = 70;
-                
-                PushMat4(app->cBuffer, glm::rotate(glm::scale(app->entities[i].matrix, glm::vec3(2,2,2)), glm::radians(angle),glm::vec3(1,0,0)));
-                PushMat4(app->cBuffer, app->camera.GetViewMatrix(app->displaySize));
-                app->entities[i].localParamsSize = app->cBuffer.head - app->entities[i].localParamsOffset;
-
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
-
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
-                    GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-                    glBindVertexArray(vao);
-
-                    u32 submeshMaterialIdx = model.materialIdx[i];
-                    Material& submeshmaterial = app->materials[submeshMaterialIdx];
-
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[app->toyDiffuseIdx].handle);
-                    glUniform1i(app->texturedMeshProgram_uTextureDeferred, 0);
-
-                    glActiveTexture(GL_TEXTURE1);
-                    glUniform1i(glGetUniformLocation(texturedMeshProgram.handle, "uhasNormalMap"), 1);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[app->toyNormalIdx].handle);
-                    glUniform1i(app->texturedMeshProgram_uTextureRelieveNormal, 1);
-
-                    glActiveTexture(GL_TEXTURE2);
-                    glUniform1i(glGetUniformLocation(texturedMeshProgram.handle, "uhasBumpMap"), 1);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[app->toyHeightIdx].handle);
-                    glUniform1i(glGetUniformLocation(texturedMeshProgram.handle, "uBumpTexture"), 2);
-
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                }
-            }
+    glUniform1i(app->downsampleGBufferProgramIdx_uNormals, 1);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, app->normalsController);
+
+    renderQuad();
+    glUseProgram(0);
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+}
+
+void RenderLowResLighting(App* app)
+{
+    glDisable(GL_DEPTH_TEST);
+    RenderFullscreenLighting(app, RGGetHandle(app->renderGraph, app->lowDepthResource), RGGetHandle(app->renderGraph, app->lowNormalsResource), true);
+    glUseProgram(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void RenderBilateralUpsample(App* app)
+{
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(app->programs[app->bilateralUpsampleProgramIdx].handle);
+    glUniform1f(app->bilateralUpsampleProgramIdx_uZNear, app->camera.zNear);
+    glUniform1f(app->bilateralUpsampleProgramIdx_uZFar, app->camera.zFar);
+
+    const GLuint textures[] = {
+        app->depthController,
+        app->normalsController,
+        app->albedoController,
+        RGGetHandle(app->renderGraph, app->lowDepthResource),
+        RGGetHandle(app->renderGraph, app->lowNormalsResource),
+        RGGetHandle(app->renderGraph, app->lowLightingResource),
+    };
+    const GLuint locations[] = {
+        app->bilateralUpsampleProgramIdx_uDepth,
+        app->bilateralUpsampleProgramIdx_uNormals,
+        app->bilateralUpsampleProgramIdx_uAlbedo,
+        app->bilateralUpsampleProgramIdx_uLowDepth,
+        app->bilateralUpsampleProgramIdx_uLowNormals,
+        app->bilateralUpsampleProgramIdx_uLowLighting,
+    };
+    for (u32 i = 0; i < ARRAY_COUNT(textures); ++i)
+    {
+        glUniform1i(locations[i], i);
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+
+    renderQuad();
+    glUseProgram(0);
 
-            glBindFramebuffer(GL_FRAMEBUFFER, NULL);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+}
 
-            glUseProgram(app->programs[app->lightsProgramIdx].handle);
+void RenderDeferredLighting(App* app)
+{
+    // Fullscreen lighting passes must neither test nor overwrite the scene depth
+    glDisable(GL_DEPTH_TEST);
 
-            glUniform1i(app->texturedMeshProgramIdx_uPosition, 0);
+    switch (app->lightingPath)
+    {
+        case LightingPath_Fullscreen:
+        {
+            RenderFullscreenLighting(app, app->depthController, app->normalsController, false);
+            break;
+        }
+        case LightingPath_Clustered:
+        {
+            glUseProgram(app->programs[app->clusteredLightsProgramIdx].handle);
+            glUniformMatrix4fv(app->clusteredLightsProgramIdx_uView, 1, GL_FALSE, glm::value_ptr(app->camera.GetLookAtMatrix()));
+            glUniform2f(app->clusteredLightsProgramIdx_uScreenSize, app->renderSize.x, app->renderSize.y);
+            glUniform1f(app->clusteredLightsProgramIdx_uZNear, app->camera.zNear);
+            glUniform1f(app->clusteredLightsProgramIdx_uZFar, app->camera.zFar);
+            glUniformMatrix4fv(app->clusteredLightsProgramIdx_uInverseViewProjection, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.GetViewMatrix(app->displaySize))));
+
+            glUniform1i(app->clusteredLightsProgramIdx_uDepth, 0);
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, app->positionController);
+            glBindTexture(GL_TEXTURE_2D, app->depthController);
 
-            glUniform1i(app->texturedMeshProgramIdx_uNormals, 1);
+            glUniform1i(app->clusteredLightsProgramIdx_uNormals, 1);
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, app->normalsController);
 
-            glUniform1i(app->texturedMeshProgramIdx_uAlbedo, 2);
+            glUniform1i(app->clusteredLightsProgramIdx_uAlbedo, 2);
             glActiveTexture(GL_TEXTURE2);
             glBindTexture(GL_TEXTURE_2D, app->albedoController);
 
+            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->lightsBuffer.handle);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), app->clusterLightGridBuffer.handle);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), app->clusterLightIndices.indices.handle);
+            BindShadowAtlas(app);
+            renderQuad();
+            break;
+        }
+        case LightingPath_Volumes:
+        {
+            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+            RenderLightVolumes(app);
+            break;
+        }
+        default:;
+    }
+    glUseProgram(0);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+void RenderLightGizmos(App* app)
+{
+	glUseProgram(app->programs[app->drawLightsProgramIdx].handle);
+
+	glUniformMatrix4fv(app->drawLightsProgramIdx_uViewProjection, 1, GL_FALSE, glm::value_ptr(app->camera.GetViewMatrix(app->displaySize)));
+
+	// Gizmos are hidden by the scene like any mesh, the offset only settles ties where they touch a surface
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(-1.f, -1.f);
+	for (unsigned int i = 0; i < app->lights.size(); ++i) {
+
+		glm::mat4 mat = glm::mat4(1.f);
+		mat = glm::translate(mat, app->lights[i].position);
+		glUniformMatrix4fv(app->drawLightsProgramIdx_uModel, 1, GL_FALSE, glm::value_ptr(mat));
+		glUniform3fv(app->drawLightsProgramIdx_uLightColor, 1, glm::value_ptr(app->lights[i].color));
+		if (app->lights[i].type == 0)
+			RenderCube();
+		else
+		{
+			RenderSphere();
+		}
+
+	}
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glUseProgram(0);
+}
+
+void RenderForwardPlus(App* app)
+{
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+
+    Program& forwardPlusProgram = app->programs[app->forwardPlusProgramIdx];
+    glUseProgram(forwardPlusProgram.handle);
+    glUniform1i(app->forwardPlusProgramIdx_uTileCountX, app->tileCount.x);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->lightsBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), app->tileLightGridBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), app->tileLightIndices.indices.handle);
+    BindShadowAtlas(app);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->drawCommandsBuffer.handle);
+    u32 drawCommandIdx = 0;
+
+    for (int i = 0; i < app->entities.size(); ++i)
+    {
+        Model& model = app->models[app->entities[i].modelId];
+        Mesh& mesh = GetMesh(app, model.mesh);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->entityParamsBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
 
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        {
+            glBindVertexArray(FindVAO(mesh, j, forwardPlusProgram));
+
+            Material& submeshMaterial = app->materials[model.materialIdx[j]];
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, GetTextureHandle(app, submeshMaterial.albedoTexture));
+            glUniform1i(app->forwardPlusProgramIdx_uTexture, 0);
 
-            AlignHead(app->cBuffer, app->uniformBlockAlignmentOffset);
+            glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)(drawCommandIdx++ * sizeof(DrawElementsIndirectCommand)));
+        }
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
 
-            app->globalParamsOffset = app->cBuffer.head;
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+}
 
-            PushVec3(app->cBuffer, app->camera.cameraPos);
-            PushUInt(app->cBuffer, app->lights.size());
+void BuildFrameGraph(App* app, RenderGraph& graph)
+{
+    const RGTextureDesc colorDesc = { GL_RGBA8, app->renderSize, 1 };
+    const RGTextureDesc depthDesc = { GL_DEPTH24_STENCIL8, app->renderSize, 1 };
+
+    const RGResource backbuffer = RGImportBackbuffer(graph, app->displaySize);
+    const RGResource color = RGImportTexture(graph, "Color", app->colorController, colorDesc);
+    const RGResource normals = RGImportTexture(graph, "Normals", app->normalsController, { GL_RG16, app->renderSize, 1 });
+    const RGResource albedo = RGImportTexture(graph, "Albedo", app->albedoController, colorDesc);
+    const RGResource depth = RGImportTexture(graph, "Depth", app->depthController, depthDesc);
+    const RGResource hiz = RGImportTexture(graph, "Depth Pyramid", app->hizController, { GL_RG32F, app->renderSize, app->hizLevelCount });
+    const RGResource entityBounds = RGImportBuffer(graph, "Entity Bounds", app->entityBoundsBuffer.handle);
+    const RGResource drawCommands = RGImportBuffer(graph, "Draw Commands", app->drawCommandsBuffer.handle);
+    const RGResource lights = RGImportBuffer(graph, "Lights", app->lightsBuffer.handle);
+    const RGResource shadowAtlas = RGImportTexture(graph, "Shadow Atlas", app->shadowAtlas, { GL_DEPTH_COMPONENT32F, ivec2(SHADOW_ATLAS_SIZE), 1 });
+    const RGResource shadowMatrices = RGImportBuffer(graph, "Shadow Matrices", app->shadowMatricesBuffer.handle);
+
+    // Next frame culls against the pyramid
+    RGExport(graph, hiz);
 
-            for (int i = 0; i < app->lights.size(); ++i)
+    switch (app->mode)
+    {
+        case Mode_TexturedQuad:
+        {
+            RGPass& quad = RGAddPass(graph, "Textured Quad", RenderTexturedQuad);
+            RGWriteAttachment(quad, backbuffer);
+            quad.clearMask = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
+            return;
+        }
+        case Mode_Forward:
+        {
+            RGPass& forward = RGAddPass(graph, "Forward", RenderForward);
+            RGRead(forward, lights, RGAccess_Storage);
+            RGWriteAttachment(forward, color, 0);
+            RGWriteAttachment(forward, depth);
+            forward.clearMask = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
+            break;
+        }
+        case Mode_Deferred:
+        case Mode_ForwardPlus:
+        {
+            RGPass& cull = RGAddPass(graph, "Occlusion Culling", CullOccludedEntities);
+            RGRead(cull, hiz, RGAccess_Sampled);
+            RGWrite(cull, entityBounds, RGAccess_Upload);
+            RGWrite(cull, drawCommands, RGAccess_Storage);
+
+            // Both atlases keep their tiles across frames, so the passes read what they write
+            const RGResource staticShadowAtlas = RGImportTexture(graph, "Static Shadow Atlas", app->staticShadowAtlas, { GL_DEPTH_COMPONENT32F, ivec2(SHADOW_ATLAS_SIZE), 1 });
+            RGPass& staticShadows = RGAddPass(graph, "Static Shadows", RenderStaticShadows);
+            RGRead(staticShadows, staticShadowAtlas, RGAccess_Attachment);
+            RGWriteAttachment(staticShadows, staticShadowAtlas);
+
+            RGPass& shadows = RGAddPass(graph, "Shadows", RenderShadows);
+            RGRead(shadows, staticShadowAtlas, RGAccess_Copy);
+            RGRead(shadows, shadowAtlas, RGAccess_Attachment);
+            RGWriteAttachment(shadows, shadowAtlas);
+
+            // Forward+ needs the depth up front to bin the lights
+            const bool depthPrePass = app->depthPrePass || app->mode == Mode_ForwardPlus;
+            if (depthPrePass)
             {
-                AlignHead(app->cBuffer, sizeof(glm::vec4));
-                PushUInt(app->cBuffer, app->lights[i].type);
-                PushVec3(app->cBuffer, app->lights[i].color);
-                PushVec3(app->cBuffer, app->lights[i].direction);
-                PushVec3(app->cBuffer, app->lights[i].position);
-                PushFloat(app->cBuffer, app->lights[i].intensity);
+                RGPass& prePass = RGAddPass(graph, "Depth Pre-Pass", RenderDepthPrePass);
+                RGRead(prePass, drawCommands, RGAccess_Indirect);
+                RGWriteAttachment(prePass, depth);
+                prePass.clearMask = GL_DEPTH_BUFFER_BIT;
             }
-            app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
-            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-            UnmapBuffer(app->cBuffer);
-            renderQuad();
 
+            if (app->mode == Mode_Deferred)
+            {
+                RGPass& geometry = RGAddPass(graph, "G-Buffer", RenderGeometryPass);
+                RGRead(geometry, drawCommands, RGAccess_Indirect);
+                if (depthPrePass)
+                    RGRead(geometry, depth, RGAccess_Attachment);
+                RGWriteAttachment(geometry, normals, 1);
+                RGWriteAttachment(geometry, albedo, 2);
+                RGWriteAttachment(geometry, depth);
+                geometry.clearMask = GL_COLOR_BUFFER_BIT | (depthPrePass ? 0 : GL_DEPTH_BUFFER_BIT);
+            }
 
-			glBindFramebuffer(GL_READ_FRAMEBUFFER, app->frameBufferController);
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-			glBlitFramebuffer(0, 0, app->displaySize.x, app->displaySize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            RGPass& pyramid = RGAddPass(graph, "Depth Pyramid", BuildDepthPyramid);
+            RGRead(pyramid, depth, RGAccess_Sampled);
+            RGWrite(pyramid, hiz, RGAccess_Image);
 
-			if (app->showGizmo) {
+            if (app->mode == Mode_ForwardPlus)
+            {
+                const RGResource tileLightGrid = RGImportBuffer(graph, "Tile Light Grid", app->tileLightGridBuffer.handle);
+                const RGResource tileLightIndices = RGImportBuffer(graph, "Tile Light Indices", app->tileLightIndices.indices.handle);
+
+                RGPass& tileCull = RGAddPass(graph, "Tile Light Culling", CullLightsInTiles);
+                RGRead(tileCull, depth, RGAccess_Sampled);
+                RGRead(tileCull, lights, RGAccess_Storage);
+                RGWrite(tileCull, tileLightGrid, RGAccess_Storage);
+                RGWrite(tileCull, tileLightIndices, RGAccess_Storage);
+
+                // Only the color target is written, the G-buffer is never touched
+                RGPass& shading = RGAddPass(graph, "Forward+", RenderForwardPlus);
+                RGRead(shading, drawCommands, RGAccess_Indirect);
+                RGRead(shading, lights, RGAccess_Storage);
+                RGRead(shading, tileLightGrid, RGAccess_Storage);
+                RGRead(shading, tileLightIndices, RGAccess_Storage);
+                RGRead(shading, shadowAtlas, RGAccess_Sampled);
+                RGRead(shading, shadowMatrices, RGAccess_Upload);
+                RGRead(shading, depth, RGAccess_Attachment);
+                RGWriteAttachment(shading, color, 0);
+                RGWriteAttachment(shading, depth);
+                shading.clearMask = GL_COLOR_BUFFER_BIT;
+                break;
+            }
 
-				glUseProgram(app->programs[app->drawLightsProgramIdx].handle);
+            RGResource clusterLightGrid = RG_INVALID_RESOURCE;
+            RGResource clusterLightIndices = RG_INVALID_RESOURCE;
+            if (app->lightingPath == LightingPath_Clustered)
+            {
+                const RGResource clusterBounds = RGImportBuffer(graph, "Cluster Bounds", app->clusterBoundsBuffer.handle);
+                clusterLightGrid = RGImportBuffer(graph, "Cluster Light Grid", app->clusterLightGridBuffer.handle);
+                clusterLightIndices = RGImportBuffer(graph, "Cluster Light Indices", app->clusterLightIndices.indices.handle);
+
+                RGPass& clusterCull = RGAddPass(graph, "Cluster Light Culling", CullLightsInClusters);
+                RGRead(clusterCull, lights, RGAccess_Storage);
+                RGWrite(clusterCull, clusterBounds, RGAccess_Storage);
+                RGWrite(clusterCull, clusterLightGrid, RGAccess_Storage);
+                RGWrite(clusterCull, clusterLightIndices, RGAccess_Storage);
+            }
 
-				glUniformMatrix4fv(app->drawLightsProgramIdx_uViewProjection, 1, GL_FALSE, glm::value_ptr(app->camera.GetViewMatrix(app->displaySize)));
-				for (unsigned int i = 0; i < app->lights.size(); ++i) {
+            // Light volumes and gizmos test against a copy of the depth the lighting samples
+            const RGResource sceneDepth = RGCreateTexture(graph, "Scene Depth", depthDesc);
+            RGAddBlitPass(graph, "Copy Depth", depth, sceneDepth, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 
-					glm::mat4 mat = glm::mat4(1.f);
-					mat = glm::translate(mat, app->lights[i].position);
-					glUniformMatrix4fv(app->drawLightsProgramIdx_uModel, 1, GL_FALSE, glm::value_ptr(mat));
-					glUniform3fv(app->drawLightsProgramIdx_uLightColor, 1, glm::value_ptr(app->lights[i].color));
-					if (app->lights[i].type == 0)
-						RenderCube();
-					else
-					{
-						RenderSphere();
-					}
+            // Fullscreen lighting can run at a fraction of the resolution, diffuse light from
+            // soft point lights varies slowly, and be brought back up edge aware
+            const bool lowResLighting = app->lightingPath == LightingPath_Fullscreen && app->lightingDownsample > 1;
+            if (lowResLighting)
+            {
+                const ivec2 lowSize = (app->renderSize + ivec2(app->lightingDownsample - 1)) / (i32)app->lightingDownsample;
+                app->lowDepthResource = RGCreateTexture(graph, "Low Depth", { GL_R32F, lowSize, 1 });
+                app->lowNormalsResource = RGCreateTexture(graph, "Low Normals", { GL_RG16, lowSize, 1 });
+                app->lowLightingResource = RGCreateTexture(graph, "Low Lighting", { GL_RGBA16F, lowSize, 1 });
+
+                RGPass& downsample = RGAddPass(graph, "Downsample G-Buffer", DownsampleGBuffer);
+                RGRead(downsample, depth, RGAccess_Sampled);
+                RGRead(downsample, normals, RGAccess_Sampled);
+                RGWriteAttachment(downsample, app->lowDepthResource, 0);
+                RGWriteAttachment(downsample, app->lowNormalsResource, 1);
+
+                RGPass& lowLighting = RGAddPass(graph, "Low Resolution Lighting", RenderLowResLighting);
+                RGRead(lowLighting, app->lowDepthResource, RGAccess_Sampled);
+                RGRead(lowLighting, app->lowNormalsResource, RGAccess_Sampled);
+                RGRead(lowLighting, lights, RGAccess_Storage);
+                RGRead(lowLighting, shadowAtlas, RGAccess_Sampled);
+                RGRead(lowLighting, shadowMatrices, RGAccess_Upload);
+                RGWriteAttachment(lowLighting, app->lowLightingResource, 0);
+            }
 
-				}
-			}
+            RGPass& lighting = RGAddPass(graph, "Lighting", lowResLighting ? RenderBilateralUpsample : RenderDeferredLighting);
+            RGRead(lighting, depth, RGAccess_Sampled);
+            RGRead(lighting, normals, RGAccess_Sampled);
+            RGRead(lighting, albedo, RGAccess_Sampled);
+            if (lowResLighting)
+            {
+                RGRead(lighting, app->lowDepthResource, RGAccess_Sampled);
+                RGRead(lighting, app->lowNormalsResource, RGAccess_Sampled);
+                RGRead(lighting, app->lowLightingResource, RGAccess_Sampled);
+            }
+            else
+            {
+                RGRead(lighting, lights, RGAccess_Storage);
+                RGRead(lighting, shadowAtlas, RGAccess_Sampled);
+                RGRead(lighting, shadowMatrices, RGAccess_Upload);
+            }
+            if (app->lightingPath == LightingPath_Clustered)
+            {
+                RGRead(lighting, clusterLightGrid, RGAccess_Storage);
+                RGRead(lighting, clusterLightIndices, RGAccess_Storage);
+            }
+            RGRead(lighting, sceneDepth, RGAccess_Attachment);
+            RGWriteAttachment(lighting, color, 0);
+            RGWriteAttachment(lighting, sceneDepth);
+            lighting.clearMask = GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
 
+            if (app->showGizmo)
+            {
+                RGPass& gizmos = RGAddPass(graph, "Light Gizmos", RenderLightGizmos);
+                RGRead(gizmos, color, RGAccess_Attachment);
+                RGRead(gizmos, sceneDepth, RGAccess_Attachment);
+                RGWriteAttachment(gizmos, color, 0);
+                RGWriteAttachment(gizmos, sceneDepth);
+            }
             break;
         }
-
         default:;
     }
 
+    RGAddBlitPass(graph, "Upscale", color, backbuffer, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+}
+
+void Render(App* app)
+{
+    // Minimized
+    if (app->displaySize.x <= 0 || app->displaySize.y <= 0)
+        return;
+
+    UpdateRenderResolution(app);
+    glBeginQuery(GL_TIME_ELAPSED, app->gpuTimerQueries[app->frameIndex % ARRAY_COUNT(app->gpuTimerQueries)]);
+
+    // - set the blending state
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glEnable(GL_DEPTH_TEST);
 
+    app->cameraChanged = app->camera.UpdateMatrices(app->displaySize);
+    UpdateTransforms(app);
+    ReserveCullingBuffers(app);
+    ReserveLightIndexLists(app);
+    UpdateShadowTiles(app);
+    UpdateLightBuffer(app);
+    PushGlobalParams(app);
+
+    RGReset(app->renderGraph);
+    BuildFrameGraph(app, app->renderGraph);
+    RGCompile(app->renderGraph);
+    RGExecute(app->renderGraph, app);
+
+    glEndQuery(GL_TIME_ELAPSED);
+    app->frameIndex++;
 }
 
 void CreateAllObjects(App* app)
 {
     app->model = LoadModel(app, "Cube/Plane.obj");
-    app->entities.push_back(Entity(glm::mat4(1.f), app->model));
+    if (app->model != UINT32_MAX)
+    {
+        // Plane.mtl only names the diffuse map, the relief maps are attached here
+        for (u32 materialIdx : app->models[app->model].materials)
+        {
+            Material& material = app->materials[materialIdx];
+            if (material.normalsTexture.generation == 0 && material.bumpTexture.generation == 0)
+            {
+                material.normalsTexture = app->toyNormalTexture;
+                material.bumpTexture = app->toyHeightTexture;
+                AcquireResource(app->textureRegistry, material.normalsTexture);
+                AcquireResource(app->textureRegistry, material.bumpTexture);
+            }
+        }
+    }
+    // The model is authored lying down and at half size
+    app->entities.push_back(Entity(glm::rotate(glm::scale(glm::mat4(1.f), vec3(2.f)), glm::radians(70.f), vec3(1.f, 0.f, 0.f)), app->model));
  //   app->entities.push_back(Entity(glm::translate(glm::mat4(1.f), vec3(5.f, 0.f, -4.f)), app->model));
  //   app->entities.push_back(Entity(glm::translate(glm::mat4(1.f), vec3(-5.f, 0.f, -2.f)), app->model));
 	//app->entities.push_back(Entity(glm::translate(glm::mat4(1.f), vec3(-3.f, 0.f, -6.f)), app->model));
 	//app->entities.push_back(Entity(glm::translate(glm::mat4(1.f), vec3(3.f, 0.f, -6.f)), app->model));
 
     app->lights.push_back(Light(LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(0.0, -1.0, 1.0), vec3(0.f, 4.f, 0.f), 0.1)); //RED
+    app->lights.back().castShadows = true;
     //app->lights.push_back(Light(LightType::LightType_Directional, vec3(0.0, 1.0, 1.0), vec3(-1.0, -1.0, 0.0), vec3(4.f, 4.f, 0.f), 0.2)); //BLUE
     app->lights.push_back(Light(LightType::LightType_Point, vec3(0.0, 0.8, 0.9), vec3(0.0, -1.0, 1.0), vec3(2.f, -1.6f, 2.f), 0.7)); //LIGHT BLUE
+    app->lights.back().castShadows = true;
     //app->lights.push_back(Light(LightType::LightType_Point, vec3(0.6, 0.2, 0.1), vec3(0.0, -1.0, 1.0), vec3(-2.f, 1.f, 2.f), 0.8)); //BROWN   
     //app->lights.push_back(Light(LightType::LightType_Point, vec3(0.2, 0.8, 0.2), vec3(0.0, -1.0, 1.0), vec3(6.4f, -0.05f, -2.5f), 0.7)); //GREEN
     //app->lights.push_back(Light(LightType::LightType_Point, vec3(1.0, 0.9, 0.1), vec3(0.0, -1.0, 1.0), vec3(-4.9f, 3.0f, -0.3f), 0.9)); //YELLOW
@@ -679,26 +2640,125 @@ void InitGPUInfo(App* app)
     for (int i = 0; i < num_extensions; ++i)
     {
         app->oglInfo.extensions = glGetStringi(GL_EXTENSIONS, GLuint(i));
+        if (strcmp((const char*)app->oglInfo.extensions, "GL_KHR_parallel_shader_compile") == 0)
+            app->oglInfo.parallelShaderCompile = true;
+        if (strcmp((const char*)app->oglInfo.extensions, "GL_EXT_texture_compression_s3tc") == 0)
+            app->oglInfo.textureCompressionS3TC = true;
+    }
+
+    // Let the driver pick how many compiler threads to use, by default it may use none
+    if (app->oglInfo.parallelShaderCompile)
+    {
+        typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+        PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetGLProcAddress("glMaxShaderCompilerThreadsKHR");
+        if (maxShaderCompilerThreads)
+            maxShaderCompilerThreads(0xFFFFFFFF);
+        else
+            app->oglInfo.parallelShaderCompile = false;
     }
 }
 
+// Locations can move when a program is relinked, so this runs again after every hot reload
+void QueryUniformLocations(App* app)
+{
+    GLuint lightHandle = app->programs[app->lightsProgramIdx].handle;
+    app->texturedMeshProgramIdx_uDepth = glGetUniformLocation(lightHandle, "uDepthTexture");
+    app->texturedMeshProgramIdx_uInverseViewProjection = glGetUniformLocation(lightHandle, "uInverseViewProjection");
+    app->texturedMeshProgramIdx_uNormals = glGetUniformLocation(lightHandle, "uNormalsTexture");
+    app->texturedMeshProgramIdx_uAlbedo = glGetUniformLocation(lightHandle, "uAlbedoTexture");
+    app->lightsProgramIdx_uLightingOnly = glGetUniformLocation(lightHandle, "uLightingOnly");
+
+    GLuint texturedSphereLightHandle = app->programs[app->drawLightsProgramIdx].handle;
+    app->drawLightsProgramIdx_uLightColor = glGetUniformLocation(texturedSphereLightHandle, "lightColor");
+    app->drawLightsProgramIdx_uViewProjection = glGetUniformLocation(texturedSphereLightHandle, "projectionView");
+    app->drawLightsProgramIdx_uModel = glGetUniformLocation(texturedSphereLightHandle, "model");
+
+    app->hizBuildProgramIdx_uFirstLevel = glGetUniformLocation(app->programs[app->hizBuildProgramIdx].handle, "uFirstLevel");
+
+    GLuint hizCullHandle = app->programs[app->hizCullProgramIdx].handle;
+    app->hizCullProgramIdx_uPreviousViewProjection = glGetUniformLocation(hizCullHandle, "uPreviousViewProjection");
+    app->hizCullProgramIdx_uCommandCount = glGetUniformLocation(hizCullHandle, "uCommandCount");
+    app->hizCullProgramIdx_uMaxLevel = glGetUniformLocation(hizCullHandle, "uMaxLevel");
+
+    GLuint clusterBuildHandle = app->programs[app->clusterBuildProgramIdx].handle;
+    app->clusterBuildProgramIdx_uInverseProjection = glGetUniformLocation(clusterBuildHandle, "uInverseProjection");
+    app->clusterBuildProgramIdx_uZNear = glGetUniformLocation(clusterBuildHandle, "uZNear");
+    app->clusterBuildProgramIdx_uZFar = glGetUniformLocation(clusterBuildHandle, "uZFar");
+
+    GLuint clusterCullHandle = app->programs[app->clusterCullProgramIdx].handle;
+    app->clusterCullProgramIdx_uView = glGetUniformLocation(clusterCullHandle, "uView");
+    app->clusterCullProgramIdx_uLightCount = glGetUniformLocation(clusterCullHandle, "uLightCount");
+    app->clusterCullProgramIdx_uLightIndexCapacity = glGetUniformLocation(clusterCullHandle, "uLightIndexCapacity");
+
+    GLuint clusteredLightsHandle = app->programs[app->clusteredLightsProgramIdx].handle;
+    app->clusteredLightsProgramIdx_uView = glGetUniformLocation(clusteredLightsHandle, "uView");
+    app->clusteredLightsProgramIdx_uScreenSize = glGetUniformLocation(clusteredLightsHandle, "uScreenSize");
+    app->clusteredLightsProgramIdx_uZNear = glGetUniformLocation(clusteredLightsHandle, "uZNear");
+    app->clusteredLightsProgramIdx_uZFar = glGetUniformLocation(clusteredLightsHandle, "uZFar");
+    app->clusteredLightsProgramIdx_uDepth = glGetUniformLocation(clusteredLightsHandle, "uDepthTexture");
+    app->clusteredLightsProgramIdx_uInverseViewProjection = glGetUniformLocation(clusteredLightsHandle, "uInverseViewProjection");
+    app->clusteredLightsProgramIdx_uNormals = glGetUniformLocation(clusteredLightsHandle, "uNormalsTexture");
+    app->clusteredLightsProgramIdx_uAlbedo = glGetUniformLocation(clusteredLightsHandle, "uAlbedoTexture");
+
+    GLuint lightVolumesHandle = app->programs[app->lightVolumesProgramIdx].handle;
+    app->lightVolumesProgramIdx_uViewProjection = glGetUniformLocation(lightVolumesHandle, "uViewProjection");
+    app->lightVolumesProgramIdx_uScreenSize = glGetUniformLocation(lightVolumesHandle, "uScreenSize");
+    app->lightVolumesProgramIdx_uLightVolume = glGetUniformLocation(lightVolumesHandle, "uLightVolume");
+    app->lightVolumesProgramIdx_uLightIndex = glGetUniformLocation(lightVolumesHandle, "uLightIndex");
+    app->lightVolumesProgramIdx_uDepth = glGetUniformLocation(lightVolumesHandle, "uDepthTexture");
+    app->lightVolumesProgramIdx_uInverseViewProjection = glGetUniformLocation(lightVolumesHandle, "uInverseViewProjection");
+    app->lightVolumesProgramIdx_uNormals = glGetUniformLocation(lightVolumesHandle, "uNormalsTexture");
+    app->lightVolumesProgramIdx_uAlbedo = glGetUniformLocation(lightVolumesHandle, "uAlbedoTexture");
+    app->lightVolumesProgramIdx_uVolumeScale = glGetUniformLocation(lightVolumesHandle, "uVolumeScale");
+
+    GLuint tileCullHandle = app->programs[app->tileCullProgramIdx].handle;
+    app->tileCullProgramIdx_uInverseProjection = glGetUniformLocation(tileCullHandle, "uInverseProjection");
+    app->tileCullProgramIdx_uView = glGetUniformLocation(tileCullHandle, "uView");
+    app->tileCullProgramIdx_uLightCount = glGetUniformLocation(tileCullHandle, "uLightCount");
+    app->tileCullProgramIdx_uLightIndexCapacity = glGetUniformLocation(tileCullHandle, "uLightIndexCapacity");
+
+    GLuint forwardPlusHandle = app->programs[app->forwardPlusProgramIdx].handle;
+    app->forwardPlusProgramIdx_uTexture = glGetUniformLocation(forwardPlusHandle, "uTexture");
+    app->forwardPlusProgramIdx_uTileCountX = glGetUniformLocation(forwardPlusHandle, "uTileCountX");
+
+    GLuint downsampleGBufferHandle = app->programs[app->downsampleGBufferProgramIdx].handle;
+    app->downsampleGBufferProgramIdx_uDepth = glGetUniformLocation(downsampleGBufferHandle, "uDepthTexture");
+    app->downsampleGBufferProgramIdx_uNormals = glGetUniformLocation(downsampleGBufferHandle, "uNormalsTexture");
+    app->downsampleGBufferProgramIdx_uDownsample = glGetUniformLocation(downsampleGBufferHandle, "uDownsample");
+
+    GLuint bilateralUpsampleHandle = app->programs[app->bilateralUpsampleProgramIdx].handle;
+    app->bilateralUpsampleProgramIdx_uDepth = glGetUniformLocation(bilateralUpsampleHandle, "uDepthTexture");
+    app->bilateralUpsampleProgramIdx_uNormals = glGetUniformLocation(bilateralUpsampleHandle, "uNormalsTexture");
+    app->bilateralUpsampleProgramIdx_uAlbedo = glGetUniformLocation(bilateralUpsampleHandle, "uAlbedoTexture");
+    app->bilateralUpsampleProgramIdx_uLowDepth = glGetUniformLocation(bilateralUpsampleHandle, "uLowDepthTexture");
+    app->bilateralUpsampleProgramIdx_uLowNormals = glGetUniformLocation(bilateralUpsampleHandle, "uLowNormalsTexture");
+    app->bilateralUpsampleProgramIdx_uLowLighting = glGetUniformLocation(bilateralUpsampleHandle, "uLowLightingTexture");
+    app->bilateralUpsampleProgramIdx_uZNear = glGetUniformLocation(bilateralUpsampleHandle, "uZNear");
+    app->bilateralUpsampleProgramIdx_uZFar = glGetUniformLocation(bilateralUpsampleHandle, "uZFar");
+
+    GLuint shadowCasterHandle = app->programs[app->shadowCasterProgramIdx].handle;
+    app->shadowCasterProgramIdx_uWorld = glGetUniformLocation(shadowCasterHandle, "uWorld");
+    app->shadowCasterProgramIdx_uViewProjection = glGetUniformLocation(shadowCasterHandle, "uViewProjection");
+}
+
 void InitModes(App* app)
 {
     GLint maxBufferSize;
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignmentOffset);
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBufferSize);
     app->cBuffer = CreateBuffer(maxBufferSize, GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
+    app->entityParamsBuffer = CreateBuffer(KB(64), GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
 
-    app->toyNormalIdx = LoadTexture2D(app, "Cube/toy_box_normal.png");
-    app->toyHeightIdx = LoadTexture2D(app, "Cube/toy_box_disp.png");
-    app->toyDiffuseIdx = LoadTexture2D(app, "Cube/toy_box_diffuse.png");
+    app->toyNormalTexture = LoadTexture2D(app, "Cube/toy_box_normal.png", TextureUsage_Normal);
+    app->toyHeightTexture = LoadTexture2D(app, "Cube/toy_box_disp.png", TextureUsage_Height);
 
     // MODES INITIALIZATION
     app->mode = Mode::Mode_Deferred;
 
+        // Every program is submitted before the first status or uniform query, so the driver
+        // compiles them side by side instead of one at a time
         app->texturedMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH");
         Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
-        app->texturedMeshProgram_uTextureForward = glGetUniformLocation(texturedMeshProgram.handle, "uTexture");
         texturedMeshProgram.vertexInputLayout.attributes.push_back({ 0,3 });
         texturedMeshProgram.vertexInputLayout.attributes.push_back({ 1,3 });
         texturedMeshProgram.vertexInputLayout.attributes.push_back({ 2,2 });
@@ -706,9 +2766,6 @@ void InitModes(App* app)
         //MESH SHADER
         app->texturedMeshProgram2Idx = LoadProgram(app, "shaders.glsl", "SHOW_GEOMETRY");
         Program& texturedMeshProgram2 = app->programs[app->texturedMeshProgram2Idx];
-        app->texturedMeshProgram_uTextureDeferred = glGetUniformLocation(texturedMeshProgram2.handle, "uAlbedoTexture");
-        app->texturedMeshProgram_uTextureRelieveNormal = glGetUniformLocation(texturedMeshProgram2.handle, "uNormalTexture");
-        app->texturedMeshProgram_uTextureRelieveHeight = glGetUniformLocation(texturedMeshProgram.handle, "uBumpTexture");
         texturedMeshProgram2.vertexInputLayout.attributes.push_back({ 0,3 });
         texturedMeshProgram2.vertexInputLayout.attributes.push_back({ 1,3 });
         texturedMeshProgram2.vertexInputLayout.attributes.push_back({ 2,2 });
@@ -718,19 +2775,76 @@ void InitModes(App* app)
         // LIGHT SHADER
         app->lightsProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_LIGHT");
         Program& light = app->programs[app->lightsProgramIdx];
-        app->texturedMeshProgramIdx_uPosition = glGetUniformLocation(light.handle, "uPositionTexture");
-        app->texturedMeshProgramIdx_uNormals = glGetUniformLocation(light.handle, "uNormalsTexture");
-        app->texturedMeshProgramIdx_uAlbedo = glGetUniformLocation(light.handle, "uAlbedoTexture");
         light.vertexInputLayout.attributes.push_back({ 0, 3 });
         light.vertexInputLayout.attributes.push_back({ 1, 2 });
 
         //LIGHT GIZMO SHADER
         app->drawLightsProgramIdx = LoadProgram(app, "shaders.glsl", "DRAW_LIGHT");
-        Program& texturedSphereLightProgram = app->programs[app->drawLightsProgramIdx];
-        app->drawLightsProgramIdx_uLightColor = glGetUniformLocation(texturedSphereLightProgram.handle, "lightColor");
-        app->drawLightsProgramIdx_uViewProjection = glGetUniformLocation(texturedSphereLightProgram.handle, "projectionView");
-        app->drawLightsProgramIdx_uModel = glGetUniformLocation(texturedSphereLightProgram.handle, "model");
-        texturedSphereLightProgram.vertexInputLayout.attributes.push_back({ 0, 3 });
+        app->programs[app->drawLightsProgramIdx].vertexInputLayout.attributes.push_back({ 0, 3 });
+
+        // DEPTH PRE-PASS SHADER
+        app->depthPrePassProgramIdx = LoadProgram(app, "shaders.glsl", "DEPTH_PREPASS");
+        app->programs[app->depthPrePassProgramIdx].vertexInputLayout.attributes.push_back({ 0, 3 });
+
+        // OCCLUSION CULLING SHADERS
+        app->hizBuildProgramIdx = LoadComputeProgram(app, "shaders.glsl", "HIZ_BUILD");
+        app->hizCullProgramIdx = LoadComputeProgram(app, "shaders.glsl", "HIZ_CULL");
+
+        // CLUSTERED LIGHTING SHADERS
+        app->clusterBuildProgramIdx = LoadComputeProgram(app, "shaders.glsl", "CLUSTER_BUILD");
+        app->clusterCullProgramIdx = LoadComputeProgram(app, "shaders.glsl", "CLUSTER_CULL_LIGHTS");
+
+        app->clusteredLightsProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_LIGHT_CLUSTERED");
+        Program& clusteredLightsProgram = app->programs[app->clusteredLightsProgramIdx];
+        clusteredLightsProgram.vertexInputLayout.attributes.push_back({ 0, 3 });
+        clusteredLightsProgram.vertexInputLayout.attributes.push_back({ 1, 2 });
+
+        app->lightVolumesProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_LIGHT_VOLUME");
+        app->programs[app->lightVolumesProgramIdx].vertexInputLayout.attributes.push_back({ 0, 3 });
+
+        // FORWARD+ SHADERS
+        app->tileCullProgramIdx = LoadComputeProgram(app, "shaders.glsl", "TILE_CULL_LIGHTS");
+
+        app->forwardPlusProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_FORWARD_PLUS");
+        Program& forwardPlusProgram = app->programs[app->forwardPlusProgramIdx];
+        forwardPlusProgram.vertexInputLayout.attributes.push_back({ 0, 3 });
+        forwardPlusProgram.vertexInputLayout.attributes.push_back({ 1, 3 });
+        forwardPlusProgram.vertexInputLayout.attributes.push_back({ 2, 2 });
+
+        // REDUCED RATE LIGHTING SHADERS
+        app->downsampleGBufferProgramIdx = LoadProgram(app, "shaders.glsl", "DOWNSAMPLE_GBUFFER");
+        Program& downsampleGBufferProgram = app->programs[app->downsampleGBufferProgramIdx];
+        downsampleGBufferProgram.vertexInputLayout.attributes.push_back({ 0, 3 });
+        downsampleGBufferProgram.vertexInputLayout.attributes.push_back({ 1, 2 });
+
+        app->bilateralUpsampleProgramIdx = LoadProgram(app, "shaders.glsl", "BILATERAL_UPSAMPLE");
+        Program& bilateralUpsampleProgram = app->programs[app->bilateralUpsampleProgramIdx];
+        bilateralUpsampleProgram.vertexInputLayout.attributes.push_back({ 0, 3 });
+        bilateralUpsampleProgram.vertexInputLayout.attributes.push_back({ 1, 2 });
+
+        // SHADOW SHADERS
+        app->shadowCasterProgramIdx = LoadProgram(app, "shaders.glsl", "SHADOW_CASTER");
+        app->programs[app->shadowCasterProgramIdx].vertexInputLayout.attributes.push_back({ 0, 3 });
+
+        // The first frames need these, so wait for them here
+        for (u32 i = 0; i < app->programs.size(); ++i)
+            FinishProgram(app, i);
+
+        // Optional variants keep compiling while the base programs draw in their place
+        for (u32 tier = 1; tier < SHADER_LIGHT_TIER_COUNT; ++tier)
+            GetProgramPermutation(app, app->texturedMeshProgramIdx, tier << SHADER_LIGHT_TIER_SHIFT);
+        GetProgramPermutation(app, app->texturedMeshProgram2Idx, ShaderFeature_NormalMap | ShaderFeature_Relief);
+
+        QueryUniformLocations(app);
+
+        app->lightsBuffer = CreateBuffer(MAX_LIGHTS * 4 * sizeof(vec4), GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+        app->shadowMatricesBuffer = CreateBuffer(MAX_SHADOW_TILES * sizeof(glm::mat4), GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+        app->clusterBoundsBuffer = CreateBuffer(CLUSTER_COUNT * 2 * sizeof(vec4), GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+        app->clusterLightGridBuffer = CreateBuffer(2 * sizeof(u32) + CLUSTER_COUNT * 2 * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+        CreateLightIndexList(app->clusterLightIndices, CLUSTER_COUNT * LIGHT_INDICES_PER_CELL);
+
+        app->entityBoundsBuffer = CreateBuffer(KB(64), GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+        app->drawCommandsBuffer = CreateBuffer(KB(64), GL_DRAW_INDIRECT_BUFFER, GL_STREAM_DRAW);
 
 
 
@@ -738,82 +2852,25 @@ void InitModes(App* app)
 
 void InitTextureBuffers(App* app)
 {
-    glGenTextures(1, &app->colorController);
-    glBindTexture(GL_TEXTURE_2D, app->colorController);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glGenTextures(1, &app->normalsController);
-    glBindTexture(GL_TEXTURE_2D, app->normalsController);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenQueries(ARRAY_COUNT(app->gpuTimerQueries), app->gpuTimerQueries);
 
-    glGenTextures(1, &app->depthController);
-    glBindTexture(GL_TEXTURE_2D, app->depthController);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    ResizeRenderTargets(app, app->displaySize);
 
-    glGenTextures(1, &app->albedoController);
-    glBindTexture(GL_TEXTURE_2D, app->albedoController);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // The shadow atlases do not follow the render resolution, so they stay out of the pool
+    glGenTextures(1, &app->staticShadowAtlas);
+    glBindTexture(GL_TEXTURE_2D, app->staticShadowAtlas);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
 
-    glGenTextures(1, &app->positionController);
-    glBindTexture(GL_TEXTURE_2D, app->positionController);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glGenTextures(1, &app->shadowAtlas);
+    glBindTexture(GL_TEXTURE_2D, app->shadowAtlas);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
     glBindTexture(GL_TEXTURE_2D, 0);
-
-    glGenFramebuffers(1, &app->frameBufferController);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferController);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->colorController, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, app->normalsController, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, app->albedoController, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, app->positionController, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, app->depthController, 0);
-
-    GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE) {
-        switch (framebufferStatus)
-        {
-        case GL_FRAMEBUFFER_UNDEFINED:                      ELOG("GL_FRAMEBUFFER_UNDEFINED"); break;
-        case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:          ELOG("GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT"); break;
-        case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:  ELOG("GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT"); break;
-        case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:         ELOG("GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER"); break;
-        case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:         ELOG("GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER"); break;
-        case GL_FRAMEBUFFER_UNSUPPORTED:                    ELOG("GL_FRAMEBUFFER_UNSUPPORTED"); break;
-        case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE:         ELOG("GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE"); break;
-        case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS:       ELOG("GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS"); break;
-        default:                                            ELOG("Unknown franebuffer status error | %i", framebufferStatus);
-        }
-    }
-
-    glDrawBuffers(4, &app->colorController);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void RenderCube()
@@ -937,8 +2994,8 @@ void RenderSphere()
 		std::vector<glm::vec3> normals;
 		std::vector<unsigned int> indices;
 
-		const int H = 32;
-		const int V = 16;
+		const int H = SPHERE_X_SEGMENTS;
+		const int V = SPHERE_Y_SEGMENTS;
 		for (int h = 0; h <= H; ++h)
 		{
 			for (int v = 0; v < V + 1; ++v)
@@ -7,6 +7,9 @@
 #include "platform.h"
 #include <glad/glad.h>
 #include "assimp_model_loading.h"
+#include "render_graph.h"
+#include "shader_library.h"
+#include "resource_registry.h"
 #include <map>
 
 #include <glm/gtx/quaternion.hpp>
@@ -40,12 +43,38 @@ struct Image
     i32   stride;
 };
 
+// What a texture holds decides the compressed format it is cooked to, and its placeholder
+enum TextureUsage
+{
+    TextureUsage_Color,  // BC7
+    TextureUsage_Mask,   // BC1, or BC3 when it has alpha
+    TextureUsage_Normal, // BC5, the shader rebuilds z
+    TextureUsage_Height, // BC4 max-mip chain, a texel bounds the heights of its footprint, never streamed
+};
+
+enum TextureState
+{
+    TextureState_Resident,
+    TextureState_Loading, // The handle is a placeholder until UploadLoadedTextures swaps it
+    TextureState_Failed,
+};
+
+// Indexed by the slots of App::textureRegistry, which also holds its path
 struct Texture
 {
-    GLuint      handle;
-    std::string filepath;
+    GLuint       handle;
+    TextureUsage usage;
+    TextureState state;
+
+    // Cooked textures stay mapped while they have finer levels to stream, see texture_streaming.h
+    MappedFile   cooked;
+    u32          residentLevel;   // Finest level of the cooked chain that is in handle
+    u32          wantedLevel;     // Finest level any entity needed this frame
+    u64          fineLevelsFrame; // Last frame the resident levels were all needed
 };
 
+struct TextureLoader;
+
 struct VertexShaderAttribute
 {
     u8 location;
@@ -59,9 +88,13 @@ struct VertexShaderLayout
 
 struct VertexBufferAttribute
 {
-    u8 location;
-    u8 componentCount;
-    u8 offset;
+    u8  location;
+    u8  componentCount;
+    u8  offset;
+    u8  normalized; // Fixed point read as floats in [-1, 1] or [0, 1]
+    u16 type;       // GL_FLOAT, GL_HALF_FLOAT, GL_SHORT, GL_INT_2_10_10_10_REV...
+    u8  integer;    // Read as integers by the shader, through glVertexAttribIPointer
+    u8  padding;
 };
 
 struct VertexBufferLayout
@@ -76,13 +109,51 @@ struct Vao
     GLuint programHandle;
 };
 
+// Compile time features of a program, each one becomes a #define in its source
+enum ShaderFeature
+{
+    ShaderFeature_NormalMap = 1 << 0,
+    ShaderFeature_Relief    = 1 << 1,
+};
+
+// Bits above the features select the light loop bound, see GetLightCountTier
+#define SHADER_LIGHT_TIER_SHIFT 8
+#define SHADER_LIGHT_TIER_COUNT 4
+
+// Permutations do not share uniform locations unless the shader fixes them
+#define RELIEF_MAX_DISTANCE_LOCATION 0
+
+struct ProgramPermutation
+{
+    u32 featureKey;
+    u32 programIdx;
+};
+
 struct Program
 {
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp; // What is this for?
+    u64                lastWriteTimestamp; // When the source was last read, refreshed by hot reloads
+    u64                sourceHash;         // Of its section with the includes expanded, to skip reloads of untouched programs
+    bool               isCompute;
     VertexShaderLayout vertexInputLayout;
+    u32                featureKey;
+    std::vector<ProgramPermutation> permutations; // Compiled variants, only filled on the base program
+
+    // Submitted to the driver but not checked yet, see FinishProgram
+    bool               pending;
+    GLuint             pendingShaders[2];
+    u32                pendingShaderCount;
+    u64                cacheKey;
+    bool               linkFailed; // Permutations that failed are drawn with the base until a hot reload links them
+};
+
+// A new version of a program compiling in the background, swapped in once it links
+struct ProgramReload
+{
+    u32     programIdx;
+    Program candidate;
 };
 
 enum Mode
@@ -90,6 +161,7 @@ enum Mode
     Mode_TexturedQuad,
     Mode_Forward,
     Mode_Deferred,
+    Mode_ForwardPlus,
     Mode_Count
 };
 
@@ -101,6 +173,8 @@ struct OpenGLInfo
     const GLubyte* vendor = nullptr;
     const GLubyte* shadingLanguageVersion = nullptr;
     const const unsigned char* extensions = nullptr;
+    bool parallelShaderCompile = false; // GL_KHR_parallel_shader_compile, programs link in the background
+    bool textureCompressionS3TC = false; // GL_EXT_texture_compression_s3tc, needed for BC1 and BC3
     OpenGLInfo()
     {
 
@@ -109,25 +183,41 @@ struct OpenGLInfo
 
 struct Model
 {
-    u32 meshIdx;
-    std::vector<u32> materialIdx;
+    ResourceHandle   mesh;        // Referenced until UnloadModel
+    std::vector<u32> materialIdx; // One per submesh
+    std::vector<u32> materials;   // Owned, freed by UnloadModel
 };
 
 struct Submesh
 {
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
-    std::vector<u32> indices;
     u32              vertexOffset;
     u32              indexOffset;
+    u32              indexCount;
+    f32              worldPerUV; // Texel density for mip streaming, 0 without UVs
     std::vector<Vao> vaos;
 };
 
+// Indexed by the slots of App::meshRegistry
 struct Mesh
 {
     std::vector<Submesh> submeshes;
     GLuint               vertexBufferHandle;
     GLuint               indexBufferHandle;
+    vec3                 aabbMin;
+    vec3                 aabbMax;
+    glm::mat4            dequantize; // Stored positions to object space, folded into the world matrix
+};
+
+// Layout matches the GL indirect draw command so the culling shader can
+// patch instanceCount directly. baseInstance holds the entity index.
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    u32 baseVertex;
+    u32 baseInstance;
 };
 
 struct Material
@@ -136,11 +226,11 @@ struct Material
     vec3        albedo;
     vec3        emissive;
     f32         smoothness;
-    u32         albedoTextureIdx;
-    u32         emissiveTextureIdx;
-    u32         specularTextureIdx;
-    u32         normalsTextureIdx;
-    u32         bumpTextureIdx;
+    ResourceHandle albedoTexture; // Each one referenced while the material lives
+    ResourceHandle emissiveTexture;
+    ResourceHandle specularTexture;
+    ResourceHandle normalsTexture;
+    ResourceHandle bumpTexture;
 };
 
 struct Camera {
@@ -158,26 +248,80 @@ struct Camera {
 	glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
 
 	float fov = 60.f;
+	float zNear = 0.1f;
+	float zFar = 100.f;
+
+    // Derived matrices and the inputs they were built from
+    glm::mat4 lookAtMatrix;
+    glm::mat4 projectionMatrix;
+    glm::mat4 viewProjectionMatrix;
+    glm::vec3 builtPos = glm::vec3(NAN);
+    glm::vec3 builtFront;
+    glm::vec3 builtUp;
+    glm::vec4 builtLens; // fov, zNear, zFar, aspect ratio
+
+    // Rebuilds the matrices only if an input changed, returns whether it did
+    bool UpdateMatrices(const vec2& size) {
+        const glm::vec4 lens = glm::vec4(fov, zNear, zFar, size.x / size.y);
+        if (cameraPos == builtPos && cameraFront == builtFront && cameraUp == builtUp && lens == builtLens)
+            return false;
+
+        builtPos = cameraPos;
+        builtFront = cameraFront;
+        builtUp = cameraUp;
+        builtLens = lens;
+        lookAtMatrix = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        projectionMatrix = glm::perspective(glm::radians(fov), lens.w, zNear, zFar);
+        viewProjectionMatrix = projectionMatrix * lookAtMatrix;
+        return true;
+    }
 
-    glm::mat4 GetViewMatrix(const vec2& size) {
-        // Make sure that: 0 < phi < 3.14
-		float Phi = glm::radians(pitch);
-		float Theta = glm::radians(yaw);
+    glm::mat4 GetLookAtMatrix() {
+        return lookAtMatrix;
+    }
 
-		glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    glm::mat4 GetProjectionMatrix(const vec2& size) {
+        UpdateMatrices(size);
+        return projectionMatrix;
+    }
 
-        return glm::perspective(glm::radians(fov), size.x / size.y, 0.1f, 100.f) * view;
+    glm::mat4 GetViewMatrix(const vec2& size) {
+        UpdateMatrices(size);
+        return viewProjectionMatrix;
     }
 };
 
+struct RenderTarget
+{
+    GLuint handle;
+    GLenum internalFormat;
+    ivec2  size;
+    u32    levels;
+    bool   inUse;
+    u32    releaseFrame;
+};
+
+struct Frustum
+{
+    vec4 planes[6]; // xyz: normal pointing inwards, w: distance
+};
+
 struct Entity
 {
-    glm::mat4 matrix = glm::mat4(0.f);
+    glm::mat4 localMatrix = glm::mat4(1.f); // Relative to the parent, see SetEntityLocalMatrix
+    i32 parent = -1; // Parents are stored before their children
     u32 modelId;
     u32 localParamsOffset;
     u32 localParamsSize;
+    bool isStatic = true; // Static entities are cached in the shadow maps
+    bool dirty = true;
 
-    Entity(const glm::mat4& mat, u32 mdlId) : matrix(mat), modelId(mdlId) {};
+    // Derived by UpdateTransforms
+    glm::mat4 worldMatrix = glm::mat4(1.f);
+    glm::mat3 normalMatrix = glm::mat3(1.f);
+    bool worldChanged = false;
+
+    Entity(const glm::mat4& mat, u32 mdlId, i32 parentIdx = -1) : localMatrix(mat), parent(parentIdx), modelId(mdlId) {};
 };
 
 enum LightType
@@ -193,10 +337,76 @@ struct Light
     vec3 direction;
     vec3 position;
     float intensity;
+    float radius = 0.f; // Influence range, derived from color and intensity
+    bool castShadows = false;
+    i32 shadowTile = -1; // First shadow atlas tile, six consecutive ones for point lights
 
     Light(const LightType t, const vec3 c, vec3 dir, vec3 pos, float intensity) : type(t), color(c), direction(dir), position(pos), intensity(intensity) {}
 };
 
+// Deferred lighting strategies for the point lights
+enum LightingPath
+{
+    LightingPath_Fullscreen,
+    LightingPath_Clustered,
+    LightingPath_Volumes,
+    LightingPath_Count
+};
+
+// Point light contribution below which a pixel is out of its range
+#define LIGHT_CUTOFF 0.02f
+
+// Shadow atlas, a tile per directional light and per point light cube face
+#define SHADOW_ATLAS_SIZE 2048
+#define SHADOW_TILE_SIZE 512
+#define SHADOW_ATLAS_TILES (SHADOW_ATLAS_SIZE / SHADOW_TILE_SIZE)
+#define MAX_SHADOW_TILES (SHADOW_ATLAS_TILES * SHADOW_ATLAS_TILES)
+#define SHADOW_ATLAS_TEXTURE_UNIT 7
+#define SHADOW_NEAR_PLANE 0.05f
+#define SHADOW_FIT_MARGIN 2.f // World units dynamic casters can move before the directional fit grows again
+
+struct ShadowTile
+{
+    glm::mat4 viewProjection;
+    bool staticValid;  // The static atlas holds this view's static casters
+    bool liveIsStatic; // The live atlas holds a plain copy of the static tile
+};
+
+// Light storage buffer capacity for the compute based lighting
+#define MAX_LIGHTS 4096
+
+// Keep in sync with the CLUSTER_* defines in shaders.glsl
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+// Initial light index capacity per cluster or tile, the shared lists grow when a cull asks for more
+#define LIGHT_INDICES_PER_CELL 32
+
+// Pooled render targets idle for longer than this are freed
+#define RENDER_TARGET_IDLE_FRAMES 300
+
+// Dynamic resolution
+#define MIN_RENDER_SCALE 0.5f
+#define RENDER_SCALE_STEP 0.05f
+#define RENDER_SCALE_COOLDOWN_FRAMES 15
+
+// Keep in sync with the TILE_* defines in shaders.glsl
+#define TILE_SIZE 16
+
+// The light indices of every cluster or tile in one compacted list, each takes its range with an atomic
+// add on the total at the start of its grid buffer. The total is copied out and read back a few frames
+// later, like the GPU timers, and the list grows when it was more than the capacity.
+struct LightIndexList
+{
+    Buffer indices;
+    u32    capacity;
+    u32    requested; // Indices the last read back cull asked for
+    u32    overflows; // Culls that were cut short before the list grew
+    GLuint readbacks[3];
+};
+
 struct App
 {
     // Loop
@@ -213,10 +423,21 @@ struct App
     ivec2 displaySize;
 
     std::vector<Texture>  textures;
+    TextureLoader*        textureLoader;
     std::vector<Material>  materials;
     std::vector<Mesh>  meshes;
     std::vector<Model>  models;
+    std::vector<u32>   freeMaterials; // Released by UnloadModel, reused by the next load
+    std::vector<u32>   freeModels;
+
+    // Textures and meshes nobody references stay cached until the total is over budget
+    PathTable          resourcePaths;
+    ResourceRegistry   textureRegistry;
+    ResourceRegistry   meshRegistry;
+    i32                vramBudgetMB = 1024;
     std::vector<Program>  programs;
+    std::vector<ProgramReload> programReloads;
+    ShaderLibrary shaderLibrary;
     std::vector<Entity> entities;
     std::vector<Light> lights;
     // program indices
@@ -226,15 +447,26 @@ struct App
     u32 meshProgramIdx;
     u32 lightsProgramIdx;
 	u32 drawLightsProgramIdx;
-    // texture indices
-    u32 diceTexIdx;
-    u32 whiteTexIdx;
-    u32 blackTexIdx;
-    u32 normalTexIdx;
-    u32 magentaTexIdx;
-    u32 toyNormalIdx;
-    u32 toyHeightIdx;
-    u32 toyDiffuseIdx;
+    u32 depthPrePassProgramIdx;
+    u32 hizBuildProgramIdx;
+    u32 hizCullProgramIdx;
+    u32 clusterBuildProgramIdx;
+    u32 clusterCullProgramIdx;
+    u32 clusteredLightsProgramIdx;
+    u32 lightVolumesProgramIdx;
+    u32 tileCullProgramIdx;
+    u32 forwardPlusProgramIdx;
+    u32 downsampleGBufferProgramIdx;
+    u32 bilateralUpsampleProgramIdx;
+    u32 shadowCasterProgramIdx;
+    // textures
+    ResourceHandle diceTexture;
+    ResourceHandle whiteTexture;
+    ResourceHandle blackTexture;
+    ResourceHandle normalTexture;
+    ResourceHandle magentaTexture;
+    ResourceHandle toyNormalTexture;
+    ResourceHandle toyHeightTexture;
 
     u32 model;
     // Mode
@@ -247,43 +479,185 @@ struct App
 
     // Location of the texture uniform in the textured quad shader
     GLuint programUniformTexture;
-    GLuint texturedMeshProgram_uTextureForward;
-    GLuint texturedMeshProgram_uTextureDeferred;
-    GLuint texturedMeshProgram_uTextureRelieveNormal;
-    GLuint texturedMeshProgram_uTextureRelieveHeight;
 
     GLuint texturedMeshProgramIdx_uAlbedo;
-    GLuint texturedMeshProgramIdx_uPosition;
     GLuint texturedMeshProgramIdx_uNormals;
     GLuint texturedMeshProgramIdx_uDepth;
+    GLuint texturedMeshProgramIdx_uInverseViewProjection;
     // VAO object to link our screen filling quad with our textured quad shader
     GLuint vao;
-    GLuint frameBufferController;
     GLuint depthController;
     GLuint colorController;
-    GLuint normalsController;
+    GLuint normalsController; // Octahedral encoded, world position comes from depthController
     GLuint albedoController;
-    GLuint positionController;
+
+    // Render targets are pooled and sized to the internal resolution
+    std::vector<RenderTarget> renderTargets;
+    ivec2  renderSize;
+    float  renderScale = 1.f;
+    u32    renderScaleCooldown = 0;
+    bool   dynamicResolution = false;
+    float  gpuBudgetMs = 16.f;
+    float  gpuFrameMs = 0.f;
+    GLuint gpuTimerQueries[3];
+    u32    frameIndex = 0;
+
+    RenderGraph renderGraph;
 
 	// Draw Sphere light
 	GLuint drawLightsProgramIdx_uLightColor;
 	GLuint drawLightsProgramIdx_uViewProjection;
 	GLuint drawLightsProgramIdx_uModel;
+
+    // Hierarchical-Z occlusion culling
+    GLuint hizController;
+    u32    hizLevelCount;
+    Buffer entityBoundsBuffer;
+    Buffer drawCommandsBuffer;
+    GLuint hizBuildProgramIdx_uFirstLevel;
+    GLuint hizCullProgramIdx_uPreviousViewProjection;
+    GLuint hizCullProgramIdx_uCommandCount;
+    GLuint hizCullProgramIdx_uMaxLevel;
+    glm::mat4 previousViewProjection;
+    bool hizValid = false;
+    bool occlusionCulling = true;
+
+    // Clustered deferred lighting
+    LightingPath lightingPath = LightingPath_Clustered;
+    std::vector<u32> visibleLights;
+    bool lightsDirty = true;
+    Buffer lightsBuffer;
+    Buffer clusterBoundsBuffer;
+    Buffer clusterLightGridBuffer;
+    LightIndexList clusterLightIndices;
+    glm::mat4 clusterProjection;
+    GLuint clusterBuildProgramIdx_uInverseProjection;
+    GLuint clusterBuildProgramIdx_uZNear;
+    GLuint clusterBuildProgramIdx_uZFar;
+    GLuint clusterCullProgramIdx_uView;
+    GLuint clusterCullProgramIdx_uLightCount;
+    GLuint clusterCullProgramIdx_uLightIndexCapacity;
+    GLuint clusteredLightsProgramIdx_uView;
+    GLuint clusteredLightsProgramIdx_uScreenSize;
+    GLuint clusteredLightsProgramIdx_uZNear;
+    GLuint clusteredLightsProgramIdx_uZFar;
+    GLuint clusteredLightsProgramIdx_uDepth;
+    GLuint clusteredLightsProgramIdx_uInverseViewProjection;
+    GLuint clusteredLightsProgramIdx_uNormals;
+    GLuint clusteredLightsProgramIdx_uAlbedo;
+
+    // Stencil bounded light volumes
+    GLuint lightVolumesProgramIdx_uViewProjection;
+    GLuint lightVolumesProgramIdx_uScreenSize;
+    GLuint lightVolumesProgramIdx_uLightVolume;
+    GLuint lightVolumesProgramIdx_uLightIndex;
+    GLuint lightVolumesProgramIdx_uDepth;
+    GLuint lightVolumesProgramIdx_uInverseViewProjection;
+    GLuint lightVolumesProgramIdx_uNormals;
+    GLuint lightVolumesProgramIdx_uAlbedo;
+    GLuint lightVolumesProgramIdx_uVolumeScale;
+
+    // Forward+ tiled lighting
+    ivec2  tileCount;
+    Buffer tileLightGridBuffer;
+    LightIndexList tileLightIndices;
+    GLuint tileCullProgramIdx_uInverseProjection;
+    GLuint tileCullProgramIdx_uView;
+    GLuint tileCullProgramIdx_uLightCount;
+    GLuint tileCullProgramIdx_uLightIndexCapacity;
+    GLuint forwardPlusProgramIdx_uTexture;
+    GLuint forwardPlusProgramIdx_uTileCountX;
+
+    // Reduced rate fullscreen lighting, upsampled against the full resolution G-buffer
+    u32 lightingDownsample = 1; // 1 full, 2 half, 4 quarter resolution
+    RGResource lowDepthResource;
+    RGResource lowNormalsResource;
+    RGResource lowLightingResource;
+    GLuint lightsProgramIdx_uLightingOnly;
+    GLuint downsampleGBufferProgramIdx_uDepth;
+    GLuint downsampleGBufferProgramIdx_uNormals;
+    GLuint downsampleGBufferProgramIdx_uDownsample;
+    GLuint bilateralUpsampleProgramIdx_uDepth;
+    GLuint bilateralUpsampleProgramIdx_uNormals;
+    GLuint bilateralUpsampleProgramIdx_uAlbedo;
+    GLuint bilateralUpsampleProgramIdx_uLowDepth;
+    GLuint bilateralUpsampleProgramIdx_uLowNormals;
+    GLuint bilateralUpsampleProgramIdx_uLowLighting;
+    GLuint bilateralUpsampleProgramIdx_uZNear;
+    GLuint bilateralUpsampleProgramIdx_uZFar;
+
+    // Cached shadow maps, static casters are only rerendered when their tile is invalidated
+    GLuint staticShadowAtlas;
+    GLuint shadowAtlas; // Static tiles with this frame's dynamic casters on top
+    std::vector<ShadowTile> shadowTiles;
+    Buffer shadowMatricesBuffer;
+    vec3   staticBoundsMin;
+    vec3   staticBoundsMax;
+    vec3   sceneBoundsMin; // Directional shadow fit, the static bounds grown to hold the dynamic casters
+    vec3   sceneBoundsMax;
+    bool   staticShadowsDirty = true;
+    bool   hasDynamicCasters = false;
+    GLuint shadowCasterProgramIdx_uWorld;
+    GLuint shadowCasterProgramIdx_uViewProjection;
     // GPU Info
     OpenGLInfo oglInfo;
 
     Camera camera;
 	bool firstMouse = true;
     Buffer cBuffer;
+    Buffer entityParamsBuffer; // One LocalParms block per entity, rewritten only when it changes
+    bool cameraChanged = true;
     GLuint globalParamsOffset;
     GLuint globalParamsSize;
     int uniformBlockAlignmentOffset;
 	bool showGizmo = true;
     bool showRelief = true;
+    float reliefMaxDistance = 15.f; // Relief mapping falls back to normal mapping beyond it
+    bool depthPrePass = true;
 
 };
 
-u32 LoadTexture2D(App* app, const char* filepath);
+Image LoadImage(const char* filename);
+
+void FreeImage(Image image);
+
+GLuint CreateTexture2DFromImage(Image image);
+
+GLuint GetPlaceholderTexture(App* app, TextureUsage usage, bool failed);
+
+// Returns at once with a reference the caller owns, the texture shows a placeholder until a loader
+// thread finished it
+ResourceHandle LoadTexture2D(App* app, const char* filepath, TextureUsage usage = TextureUsage_Color);
+
+void ReleaseTexture(App* app, ResourceHandle texture);
+
+// GL texture to bind, white for the zero handle and magenta for one that was evicted
+GLuint GetTextureHandle(App* app, ResourceHandle texture);
+
+Mesh& GetMesh(App* app, ResourceHandle mesh);
+
+u32 AllocateModel(App* app);
+
+u32 AllocateMaterial(App* app);
+
+// Releases the model's mesh and textures, entities must not use the model index afterwards
+void UnloadModel(App* app, u32 modelIdx);
+
+// Deletes unreferenced textures and meshes, oldest first, until the total plus bytesNeeded fits
+// vramBudgetMB. False if the referenced ones alone are over it.
+bool EvictResources(App* app, u64 bytesNeeded = 0);
+
+void GetEntityWorldBounds(App* app, const Entity& entity, vec3& worldMin, vec3& worldMax);
+
+u32 GetProgramPermutation(App* app, u32 programIdx, u32 featureKey);
+
+bool IsProgramReady(App* app, u32 programIdx);
+
+void FinishProgram(App* app, u32 programIdx);
+
+void HotReloadPrograms(App* app);
+
+u32 GetLightCountTier(u32 lightCount);
 
 void Init(App* app);
 
@@ -291,17 +665,32 @@ void InitGPUInfo(App* app);
 
 void InitTextureBuffers(App* app);
 
+GLuint AcquireRenderTarget(App* app, GLenum internalFormat, ivec2 size, u32 levels);
+
+void ReleaseRenderTarget(App* app, GLuint handle);
+
 void InitModes(App* app);
 
+void QueryUniformLocations(App* app);
+
 void CreateAllObjects(App* app);
 
+// Stops the threads Init started, before the GL context goes away
+void Shutdown(App* app);
+
 void Gui(App* app);
 
 void Update(App* app);
 
 void Render(App* app);
 
+void SetEntityLocalMatrix(App* app, u32 entityIdx, const glm::mat4& localMatrix);
+
 void renderQuad();
+
+// Tessellation of RenderSphere(), around the equator and from pole to pole
+#define SPHERE_X_SEGMENTS 32
+#define SPHERE_Y_SEGMENTS 16
 void RenderSphere();
 void RenderCube();
 
@@ -12,16 +12,27 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
 #include "engine.h"
+#include "simd_math.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <string.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 
 #define WINDOW_TITLE  "Advanced Graphics Programming"
 #define WINDOW_WIDTH  800
@@ -133,8 +144,41 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+// Engine.exe --cook [--float-vertices] <model>... imports the models and writes their cooked meshes and
+// textures, no window is opened. Vertices are quantized unless --float-vertices is given.
+int CookModels(int modelCount, char** models)
 {
+    InitSimdKernels();
+
+    bool quantizeVertices = true;
+    if (modelCount > 0 && strcmp(models[0], "--float-vertices") == 0)
+    {
+        quantizeVertices = false;
+        modelCount--;
+        models++;
+    }
+
+    int failures = 0;
+    for (int i = 0; i < modelCount; ++i)
+    {
+        if (!CookModel(models[i], quantizeVertices))
+            failures++;
+        GlobalFrameArenaHead = 0;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
+
+    if (argc > 1 && strcmp(argv[1], "--cook") == 0)
+    {
+        int result = CookModels(argc - 2, argv + 2);
+        free(GlobalFrameArenaMemory);
+        return result;
+    }
+
 	ShowWindow(GetConsoleWindow(), SW_HIDE); // Hide console
 
     App app         = {};
@@ -218,8 +262,6 @@ int main()
 
     f64 lastFrameTime = glfwGetTime();
 
-    GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
-
     Init(&app);
 
     while (app.isRunning)
@@ -283,6 +325,8 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    Shutdown(&app);
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -370,6 +414,16 @@ String GetDirectoryPart(String path)
     return str;
 }
 
+std::string ReplaceExtension(const char* filepath, const char* extension)
+{
+    std::string path = filepath;
+    size_t dot = path.find_last_of('.');
+    size_t separator = path.find_last_of("/\\");
+    if (dot != std::string::npos && (separator == std::string::npos || dot > separator))
+        path.resize(dot);
+    return path + extension;
+}
+
 String ReadTextFile(const char* filepath)
 {
     String fileText = {};
@@ -420,6 +474,272 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+// Filled by the watcher thread, drained by the engine on its own thread
+std::mutex               ChangedFilesMutex;
+std::vector<std::string> ChangedFiles;
+std::atomic<bool>        HasChangedFiles(false);
+
+// Owned by StartFileWatcher/StopFileWatcher so shutdown can wake and join the watcher thread
+std::thread              FileWatcherThread;
+std::atomic<bool>        FileWatcherStopping(false);
+#ifdef _WIN32
+HANDLE                   FileWatcherDir = INVALID_HANDLE_VALUE;
+HANDLE                   FileWatcherStopEvent = NULL;
+#else
+int                      FileWatcherFd = -1;
+int                      FileWatcherWakePipe[2] = { -1, -1 };
+#endif
+
+static u64 QueryFileSize(const char* filepath)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    if (GetFileAttributesExA(filepath, GetFileExInfoStandard, &Data))
+        return ((u64)Data.nFileSizeHigh << 32) | Data.nFileSizeLow;
+#else
+    struct stat attrib;
+    if (stat(filepath, &attrib) == 0)
+        return (u64)attrib.st_size;
+#endif
+    return 0;
+}
+
+// The first event can arrive while the writer is still flushing, so wait until the size
+// stops changing to avoid reloading a half written file
+static void WaitForStableFile(const std::string& filepath)
+{
+    u64 size = QueryFileSize(filepath.c_str());
+    for (u32 tries = 0; tries < 20 && !FileWatcherStopping; ++tries)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        u64 newSize = QueryFileSize(filepath.c_str());
+        if (newSize == size)
+            return;
+        size = newSize;
+    }
+}
+
+void PushChangedFile(const std::string& directory, const char* filename)
+{
+    WaitForStableFile(directory + "/" + filename);
+
+    std::lock_guard<std::mutex> lock(ChangedFilesMutex);
+    for (const std::string& changed : ChangedFiles)
+        if (changed == filename)
+            return;
+    ChangedFiles.push_back(filename);
+    HasChangedFiles = true;
+}
+
+void WatchDirectory(std::string directory)
+{
+#ifdef _WIN32
+    HANDLE dir = FileWatcherDir;
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    HANDLE events[2] = { overlapped.hEvent, FileWatcherStopEvent };
+
+    DWORD buffer[4096];
+    DWORD bytesReturned;
+    while (ReadDirectoryChangesW(dir, buffer, sizeof(buffer), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, NULL, &overlapped, NULL))
+    {
+        if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0)
+        {
+            // Stopping: the buffer must outlive the pending read, so cancel it and wait
+            CancelIoEx(dir, &overlapped);
+            GetOverlappedResult(dir, &overlapped, &bytesReturned, TRUE);
+            break;
+        }
+        if (!GetOverlappedResult(dir, &overlapped, &bytesReturned, FALSE))
+            break;
+
+        const u8* cursor = (const u8*)buffer;
+        while (bytesReturned > 0)
+        {
+            const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)cursor;
+            char filename[MAX_PATH] = {};
+            WideCharToMultiByte(CP_UTF8, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), filename, sizeof(filename) - 1, NULL, NULL);
+            for (char* c = filename; *c; ++c)
+                if (*c == '\\')
+                    *c = '/';
+            PushChangedFile(directory, filename);
+
+            if (info->NextEntryOffset == 0)
+                break;
+            cursor += info->NextEntryOffset;
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+#else
+    // Editors either rewrite the file in place or move a new one over it
+    pollfd fds[2] = { { FileWatcherFd, POLLIN, 0 }, { FileWatcherWakePipe[0], POLLIN, 0 } };
+    alignas(inotify_event) char buffer[4096];
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+
+        ssize_t length = read(FileWatcherFd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+        for (char* cursor = buffer; cursor < buffer + length; )
+        {
+            const inotify_event* event = (const inotify_event*)cursor;
+            if (event->len > 0)
+                PushChangedFile(directory, event->name);
+            cursor += sizeof(inotify_event) + event->len;
+        }
+    }
+#endif
+}
+
+void StartFileWatcher(const char* directory)
+{
+#ifdef _WIN32
+    FileWatcherDir = CreateFileA(directory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (FileWatcherDir == INVALID_HANDLE_VALUE)
+    {
+        ELOG("Could not watch directory %s", directory);
+        return;
+    }
+    FileWatcherStopEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+#else
+    FileWatcherFd = inotify_init();
+    if (FileWatcherFd < 0 || inotify_add_watch(FileWatcherFd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0 || pipe(FileWatcherWakePipe) < 0)
+    {
+        ELOG("Could not watch directory %s", directory);
+        if (FileWatcherFd >= 0)
+            close(FileWatcherFd);
+        FileWatcherFd = -1;
+        return;
+    }
+#endif
+
+    // Blocks in the OS until something changes or StopFileWatcher wakes it, so it costs nothing while idle
+    FileWatcherStopping = false;
+    FileWatcherThread = std::thread(WatchDirectory, std::string(directory));
+}
+
+void StopFileWatcher()
+{
+    if (!FileWatcherThread.joinable())
+        return;
+
+    FileWatcherStopping = true;
+#ifdef _WIN32
+    SetEvent(FileWatcherStopEvent);
+#else
+    char wake = 0;
+    ssize_t written = write(FileWatcherWakePipe[1], &wake, 1);
+    (void)written;
+#endif
+    FileWatcherThread.join();
+
+#ifdef _WIN32
+    CloseHandle(FileWatcherStopEvent);
+    CloseHandle(FileWatcherDir);
+    FileWatcherStopEvent = NULL;
+    FileWatcherDir = INVALID_HANDLE_VALUE;
+#else
+    close(FileWatcherWakePipe[0]);
+    close(FileWatcherWakePipe[1]);
+    close(FileWatcherFd);
+    FileWatcherWakePipe[0] = FileWatcherWakePipe[1] = -1;
+    FileWatcherFd = -1;
+#endif
+}
+
+bool ConsumeChangedFiles(std::vector<std::string>& files)
+{
+    if (!HasChangedFiles)
+        return false;
+
+    std::lock_guard<std::mutex> lock(ChangedFilesMutex);
+    files.swap(ChangedFiles);
+    ChangedFiles.clear();
+    HasChangedFiles = false;
+    return !files.empty();
+}
+
+void* GetGLProcAddress(const char* name)
+{
+    return (void*)glfwGetProcAddress(name);
+}
+
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile mappedFile = {};
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return mappedFile;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file); // The mapping keeps the file open
+
+    if (!mapping)
+        return mappedFile;
+
+    mappedFile.data = (const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mappedFile.data)
+    {
+        CloseHandle(mapping);
+        return mappedFile;
+    }
+    mappedFile.size = (u64)size.QuadPart;
+    mappedFile.mapping = mapping;
+#else
+    int file = open(filepath, O_RDONLY);
+    if (file < 0)
+        return mappedFile;
+
+    struct stat attrib;
+    if (fstat(file, &attrib) == 0 && attrib.st_size > 0)
+    {
+        void* data = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data != MAP_FAILED)
+        {
+            mappedFile.data = (const u8*)data;
+            mappedFile.size = (u64)attrib.st_size;
+        }
+    }
+    close(file); // The mapping keeps the file open
+#endif
+    return mappedFile;
+}
+
+void UnmapFile(MappedFile& file)
+{
+    if (!file.data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mapping);
+#else
+    munmap((void*)file.data, file.size);
+#endif
+    file = {};
+}
+
+void CreateDirectoryIfMissing(const char* path)
+{
+#ifdef _WIN32
+    CreateDirectoryA(path, NULL);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
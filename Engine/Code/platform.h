@@ -70,6 +70,11 @@ String MakePath(String dir, String filename);
 
 String GetDirectoryPart(String path);
 
+/**
+ * Returns the path with its extension replaced, e.g. "Cube/Plane.obj" and ".mesh" give "Cube/Plane.mesh".
+ */
+std::string ReplaceExtension(const char *filepath, const char *extension);
+
 /**
  * Reads a whole file and returns a string with its contents. The returned string
  * is temporary and should be copied if it needs to persist for several frames.
@@ -82,6 +87,49 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Starts a background thread that waits for the OS to report writes to files in the directory.
+ * It does not look into subdirectories.
+ */
+void StartFileWatcher(const char *directory);
+
+/**
+ * Wakes the watcher thread, waits for it to exit and releases the OS handles it was using.
+ */
+void StopFileWatcher();
+
+/**
+ * Moves the names of the files changed since the last call into the vector, relative to the
+ * watched directory. Returns false without locking anything when nothing changed.
+ */
+bool ConsumeChangedFiles(std::vector<std::string>& files);
+
+/**
+ * Returns the address of an OpenGL function the loader did not cover, e.g. one from an extension.
+ * Null if the driver does not provide it.
+ */
+void* GetGLProcAddress(const char *name);
+
+struct MappedFile
+{
+    const u8* data;
+    u64       size;
+    void*     mapping; // OS handle of the mapping, only used on Windows
+};
+
+/**
+ * Maps a whole file read only into memory, data is null if it could not be opened.
+ * The pages are read on first access, nothing is copied up front.
+ */
+MappedFile MapFile(const char *filepath);
+
+void UnmapFile(MappedFile& file);
+
+/**
+ * Creates the directory if it does not exist yet. Parent directories must exist.
+ */
+void CreateDirectoryIfMissing(const char *path);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,433 @@
+#include "render_graph.h"
+#include "engine.h"
+#include <string.h>
+
+static bool IsDepthFormat(GLenum internalFormat)
+{
+    return internalFormat == GL_DEPTH24_STENCIL8 || internalFormat == GL_DEPTH32F_STENCIL8 ||
+           internalFormat == GL_DEPTH_COMPONENT16 || internalFormat == GL_DEPTH_COMPONENT24 || internalFormat == GL_DEPTH_COMPONENT32F;
+}
+
+static GLbitfield BarrierForAccess(RGAccess access)
+{
+    switch (access)
+    {
+    case RGAccess_Sampled:    return GL_TEXTURE_FETCH_BARRIER_BIT;
+    case RGAccess_Image:      return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    case RGAccess_Storage:    return GL_SHADER_STORAGE_BARRIER_BIT;
+    case RGAccess_Indirect:   return GL_COMMAND_BARRIER_BIT;
+    case RGAccess_Attachment: return GL_FRAMEBUFFER_BARRIER_BIT;
+    case RGAccess_Copy:       return GL_FRAMEBUFFER_BARRIER_BIT;
+    default:                  return 0;
+    }
+}
+
+static bool IsIncoherentWrite(RGAccess access)
+{
+    return access == RGAccess_Image || access == RGAccess_Storage;
+}
+
+// The barriers the passes from orderIdx on need to see a write, up to and including the next pass writing it
+static GLbitfield GetConsumerBarriers(const RenderGraph& graph, RGResource resource, u32 orderIdx)
+{
+    GLbitfield barriers = 0;
+    for (u32 i = orderIdx; i < graph.order.size(); ++i)
+    {
+        const RGPass& pass = graph.passes[graph.order[i]];
+        for (const RGUse& read : pass.reads)
+            if (read.resource == resource)
+                barriers |= BarrierForAccess(read.access);
+
+        bool written = false;
+        for (const RGUse& write : pass.writes)
+        {
+            if (write.resource != resource)
+                continue;
+            barriers |= BarrierForAccess(write.access);
+            written = true;
+        }
+        if (written)
+            break;
+    }
+    return barriers;
+}
+
+static RGResource AddResource(RenderGraph& graph, const char* name, bool isTexture, bool imported, GLuint handle, RGTextureDesc desc)
+{
+    RGResourceNode node = {};
+    node.name = name;
+    node.isTexture = isTexture;
+    node.imported = imported;
+    node.handle = handle;
+    node.desc = desc;
+    graph.resources.push_back(node);
+    return graph.resources.size() - 1;
+}
+
+void RGReset(RenderGraph& graph)
+{
+    graph.resources.clear();
+    graph.passes.clear();
+    graph.order.clear();
+}
+
+RGResource RGImportTexture(RenderGraph& graph, const char* name, GLuint handle, RGTextureDesc desc)
+{
+    return AddResource(graph, name, true, true, handle, desc);
+}
+
+RGResource RGImportBuffer(RenderGraph& graph, const char* name, GLuint handle)
+{
+    return AddResource(graph, name, false, true, handle, {});
+}
+
+RGResource RGImportBackbuffer(RenderGraph& graph, glm::ivec2 size)
+{
+    RGResource resource = AddResource(graph, "Backbuffer", true, true, 0, { GL_RGBA8, size, 1 });
+    graph.resources[resource].backbuffer = true;
+    graph.resources[resource].exported = true;
+    return resource;
+}
+
+RGResource RGCreateTexture(RenderGraph& graph, const char* name, RGTextureDesc desc)
+{
+    return AddResource(graph, name, true, false, 0, desc);
+}
+
+void RGExport(RenderGraph& graph, RGResource resource)
+{
+    assert(graph.resources[resource].imported && "Transient resources do not outlive the frame");
+    graph.resources[resource].exported = true;
+}
+
+RGPass& RGAddPass(RenderGraph& graph, const char* name, RGExecuteFn execute)
+{
+    RGPass pass = {};
+    pass.name = name;
+    pass.execute = execute;
+    pass.clearColor = glm::vec4(0.2f, 0.2f, 0.2f, 1.f);
+    pass.blitSource = RG_INVALID_RESOURCE;
+    pass.blitDestination = RG_INVALID_RESOURCE;
+    graph.passes.push_back(pass);
+    return graph.passes.back();
+}
+
+RGPass& RGAddBlitPass(RenderGraph& graph, const char* name, RGResource source, RGResource destination, GLbitfield mask, GLenum filter)
+{
+    RGPass& pass = RGAddPass(graph, name, nullptr);
+    pass.blitSource = source;
+    pass.blitDestination = destination;
+    pass.blitMask = mask;
+    pass.blitFilter = filter;
+    RGRead(pass, source, RGAccess_Copy);
+    RGWrite(pass, destination, RGAccess_Copy);
+    return pass;
+}
+
+void RGRead(RGPass& pass, RGResource resource, RGAccess access)
+{
+    pass.reads.push_back({ resource, access, 0, 0 });
+}
+
+void RGWrite(RGPass& pass, RGResource resource, RGAccess access)
+{
+    pass.writes.push_back({ resource, access, 0, 0 });
+}
+
+void RGWriteAttachment(RGPass& pass, RGResource resource, u32 attachment)
+{
+    assert(attachment < RG_MAX_COLOR_ATTACHMENTS);
+    pass.writes.push_back({ resource, RGAccess_Attachment, attachment, 0 });
+}
+
+GLuint RGGetHandle(const RenderGraph& graph, RGResource resource)
+{
+    return graph.resources[resource].handle;
+}
+
+void RGCompile(RenderGraph& graph)
+{
+    const u32 passCount = graph.passes.size();
+
+    // Passes are declared producers first, so walking them backwards sees every
+    // consumer before its producers. A pass lives if it feeds something that lives.
+    std::vector<bool> needed(graph.resources.size(), false);
+    for (i32 p = passCount - 1; p >= 0; --p)
+    {
+        RGPass& pass = graph.passes[p];
+        bool alive = pass.sideEffects;
+        for (const RGUse& write : pass.writes)
+            alive |= graph.resources[write.resource].exported || needed[write.resource];
+
+        pass.culled = !alive;
+        if (pass.culled)
+            continue;
+
+        for (const RGUse& read : pass.reads)
+            needed[read.resource] = true;
+    }
+
+    // Dependencies: read after write, write after write and write after read
+    std::vector<std::vector<u32>> successors(passCount);
+    std::vector<u32> predecessorCount(passCount, 0);
+    std::vector<i32> lastWriter(graph.resources.size(), -1);
+    std::vector<std::vector<u32>> readersSinceWrite(graph.resources.size());
+
+    auto addEdge = [&](i32 from, u32 to) {
+        if (from < 0 || from == (i32)to)
+            return;
+        successors[from].push_back(to);
+        predecessorCount[to]++;
+    };
+
+    for (u32 p = 0; p < passCount; ++p)
+    {
+        const RGPass& pass = graph.passes[p];
+        if (pass.culled)
+            continue;
+
+        for (const RGUse& read : pass.reads)
+        {
+            addEdge(lastWriter[read.resource], p);
+            readersSinceWrite[read.resource].push_back(p);
+        }
+        for (const RGUse& write : pass.writes)
+        {
+            addEdge(lastWriter[write.resource], p);
+            for (u32 reader : readersSinceWrite[write.resource])
+                addEdge(reader, p);
+            readersSinceWrite[write.resource].clear();
+            lastWriter[write.resource] = p;
+        }
+    }
+
+    // Kahn's algorithm, always taking the earliest declared pass that is ready
+    graph.order.clear();
+    std::vector<bool> scheduled(passCount, false);
+    for (;;)
+    {
+        i32 next = -1;
+        for (u32 p = 0; p < passCount && next < 0; ++p)
+            if (!graph.passes[p].culled && !scheduled[p] && predecessorCount[p] == 0)
+                next = p;
+        if (next < 0)
+            break;
+
+        scheduled[next] = true;
+        graph.order.push_back(next);
+        for (u32 successor : successors[next])
+            predecessorCount[successor]--;
+    }
+
+    // Lifetimes, so transient targets can share memory when they do not overlap
+    for (RGResourceNode& node : graph.resources)
+    {
+        node.firstUse = -1;
+        node.lastUse = -1;
+        node.pendingBarriers = 0;
+        node.unconsumed = false;
+    }
+    for (u32 i = 0; i < graph.order.size(); ++i)
+    {
+        const RGPass& pass = graph.passes[graph.order[i]];
+        for (const std::vector<RGUse>* uses : { &pass.reads, &pass.writes })
+        {
+            for (const RGUse& use : *uses)
+            {
+                RGResourceNode& node = graph.resources[use.resource];
+                if (node.firstUse < 0)
+                    node.firstUse = i;
+                node.lastUse = i;
+            }
+        }
+    }
+
+    // Incoherent writes only leave pending the barriers of the accesses that follow them
+    for (u32 i = 0; i < graph.order.size(); ++i)
+        for (RGUse& write : graph.passes[graph.order[i]].writes)
+            if (IsIncoherentWrite(write.access))
+                write.consumerBarriers = GetConsumerBarriers(graph, write.resource, i + 1);
+
+    // A write carried over from the last frame is pending from the start, and carried again if nothing reads it
+    for (RGResource r = 0; r < graph.resources.size(); ++r)
+    {
+        RGResourceNode& node = graph.resources[r];
+        for (const RGCarriedWrite& carried : graph.carriedWrites)
+        {
+            if (!node.imported || carried.handle != node.handle || carried.isTexture != node.isTexture)
+                continue;
+            node.pendingBarriers = GetConsumerBarriers(graph, r, 0);
+            node.unconsumed = node.pendingBarriers == 0;
+        }
+    }
+}
+
+static GLuint GetFramebuffer(RenderGraph& graph, const GLuint colors[RG_MAX_COLOR_ATTACHMENTS], GLuint depth)
+{
+    for (const RGFramebuffer& framebuffer : graph.framebuffers)
+        if (framebuffer.depth == depth && memcmp(framebuffer.colors, colors, sizeof(framebuffer.colors)) == 0)
+            return framebuffer.handle;
+
+    RGFramebuffer framebuffer = {};
+    memcpy(framebuffer.colors, colors, sizeof(framebuffer.colors));
+    framebuffer.depth = depth;
+
+    glGenFramebuffers(1, &framebuffer.handle);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.handle);
+    for (u32 i = 0; i < RG_MAX_COLOR_ATTACHMENTS; ++i)
+        if (colors[i])
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, colors[i], 0);
+    if (depth)
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, depth, 0);
+
+    GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+        ELOG("Render graph framebuffer incomplete | %i", framebufferStatus);
+
+    graph.framebuffers.push_back(framebuffer);
+    return framebuffer.handle;
+}
+
+static GLuint GetFramebufferFor(RenderGraph& graph, const RGResourceNode& node)
+{
+    if (node.backbuffer)
+        return 0;
+
+    GLuint colors[RG_MAX_COLOR_ATTACHMENTS] = {};
+    GLuint depth = 0;
+    if (IsDepthFormat(node.desc.internalFormat))
+        depth = node.handle;
+    else
+        colors[0] = node.handle;
+    return GetFramebuffer(graph, colors, depth);
+}
+
+static void BindAttachments(RenderGraph& graph, const RGPass& pass)
+{
+    GLuint colors[RG_MAX_COLOR_ATTACHMENTS] = {};
+    GLuint depth = 0;
+    bool backbuffer = false;
+    bool hasAttachments = false;
+    glm::ivec2 size = glm::ivec2(0);
+
+    for (const RGUse& write : pass.writes)
+    {
+        if (write.access != RGAccess_Attachment)
+            continue;
+
+        const RGResourceNode& node = graph.resources[write.resource];
+        if (node.backbuffer)
+            backbuffer = true;
+        else if (IsDepthFormat(node.desc.internalFormat))
+            depth = node.handle;
+        else
+            colors[write.attachment] = node.handle;
+        size = node.desc.size;
+        hasAttachments = true;
+    }
+
+    if (!hasAttachments)
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, backbuffer ? 0 : GetFramebuffer(graph, colors, depth));
+    glViewport(0, 0, size.x, size.y);
+
+    if (!backbuffer)
+    {
+        GLenum drawBuffers[RG_MAX_COLOR_ATTACHMENTS];
+        u32 drawBufferCount = 0;
+        for (u32 i = 0; i < RG_MAX_COLOR_ATTACHMENTS; ++i)
+        {
+            drawBuffers[i] = colors[i] ? GL_COLOR_ATTACHMENT0 + i : GL_NONE;
+            if (colors[i])
+                drawBufferCount = i + 1;
+        }
+        glDrawBuffers(drawBufferCount, drawBuffers);
+    }
+
+    if (pass.clearMask)
+    {
+        glClearColor(pass.clearColor.r, pass.clearColor.g, pass.clearColor.b, pass.clearColor.a);
+        glDepthMask(GL_TRUE);
+        glStencilMask(0xFF);
+        glClear(pass.clearMask);
+    }
+}
+
+void RGExecute(RenderGraph& graph, App* app)
+{
+    for (u32 i = 0; i < graph.order.size(); ++i)
+    {
+        const RGPass& pass = graph.passes[graph.order[i]];
+
+        // Transient targets come from the pool when first used...
+        for (RGResourceNode& node : graph.resources)
+            if (!node.imported && node.isTexture && node.firstUse == (i32)i)
+                node.handle = AcquireRenderTarget(app, node.desc.internalFormat, node.desc.size, node.desc.levels);
+
+        // Image and storage writes are incoherent, make them visible to how they are used next
+        GLbitfield barriers = 0;
+        for (const std::vector<RGUse>* uses : { &pass.reads, &pass.writes })
+            for (const RGUse& use : *uses)
+                barriers |= graph.resources[use.resource].pendingBarriers & BarrierForAccess(use.access);
+        if (barriers)
+        {
+            glMemoryBarrier(barriers);
+            for (RGResourceNode& node : graph.resources)
+                node.pendingBarriers &= ~barriers;
+        }
+
+        if (pass.execute)
+        {
+            BindAttachments(graph, pass);
+            pass.execute(app);
+        }
+        else
+        {
+            const RGResourceNode& source = graph.resources[pass.blitSource];
+            const RGResourceNode& destination = graph.resources[pass.blitDestination];
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, GetFramebufferFor(graph, source));
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GetFramebufferFor(graph, destination));
+            glBlitFramebuffer(0, 0, source.desc.size.x, source.desc.size.y,
+                              0, 0, destination.desc.size.x, destination.desc.size.y,
+                              pass.blitMask, pass.blitFilter);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (const RGUse& write : pass.writes)
+        {
+            if (!IsIncoherentWrite(write.access))
+                continue;
+            graph.resources[write.resource].pendingBarriers = write.consumerBarriers;
+            graph.resources[write.resource].unconsumed = write.consumerBarriers == 0;
+        }
+
+        // ...and go back to it after their last use, free for the next transient of the same shape
+        for (RGResourceNode& node : graph.resources)
+            if (!node.imported && node.isTexture && node.lastUse == (i32)i)
+                ReleaseRenderTarget(app, node.handle);
+    }
+
+    // Imported resources are read again next frame, their writes nothing read yet go to the next graph.
+    // Carried writes of resources this graph did not import stay until one does.
+    std::vector<RGCarriedWrite> carriedWrites;
+    for (const RGCarriedWrite& carried : graph.carriedWrites)
+    {
+        bool imported = false;
+        for (const RGResourceNode& node : graph.resources)
+            imported |= node.imported && node.handle == carried.handle && node.isTexture == carried.isTexture;
+        if (!imported)
+            carriedWrites.push_back(carried);
+    }
+    for (const RGResourceNode& node : graph.resources)
+        if (node.imported && node.unconsumed)
+            carriedWrites.push_back({ node.handle, node.isTexture });
+    graph.carriedWrites.swap(carriedWrites);
+}
+
+void RGFlushFramebuffers(RenderGraph& graph)
+{
+    for (const RGFramebuffer& framebuffer : graph.framebuffers)
+        glDeleteFramebuffers(1, &framebuffer.handle);
+    graph.framebuffers.clear();
+}
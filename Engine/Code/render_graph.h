@@ -0,0 +1,134 @@
+//
+// render_graph.h: Frame graph on top of the render target pool. Passes declare what they
+// read and write, the graph culls what does not contribute to an output, orders the rest,
+// inserts the memory barriers and framebuffer setup, and aliases transient targets.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+struct App;
+
+typedef u32 RGResource;
+
+#define RG_INVALID_RESOURCE 0xFFFFFFFFu
+#define RG_MAX_COLOR_ATTACHMENTS 4
+
+enum RGAccess
+{
+    RGAccess_Sampled,    // texture() / texelFetch()
+    RGAccess_Image,      // imageLoad() / imageStore()
+    RGAccess_Storage,    // shader storage buffer
+    RGAccess_Indirect,   // indirect draw commands
+    RGAccess_Attachment, // framebuffer attachment
+    RGAccess_Copy,       // blit source or destination
+    RGAccess_Upload,     // written by the CPU before the frame
+};
+
+struct RGTextureDesc
+{
+    GLenum     internalFormat;
+    glm::ivec2 size;
+    u32        levels;
+};
+
+struct RGResourceNode
+{
+    const char*   name;
+    bool          isTexture;
+    bool          imported;    // Owned outside the graph, so it outlives the frame
+    bool          exported;    // Read after the frame, passes writing it are never culled
+    bool          backbuffer;
+    RGTextureDesc desc;
+    GLuint        handle;      // Transient ones get theirs while the graph executes
+
+    // Filled by RGCompile
+    i32           firstUse;
+    i32           lastUse;
+    GLbitfield    pendingBarriers; // Left by an incoherent write, cleared as they are issued
+    bool          unconsumed;      // Its last incoherent write has no consumer in this frame
+};
+
+struct RGUse
+{
+    RGResource resource;
+    RGAccess   access;
+    u32        attachment; // Color attachment slot, ignored for depth formats
+
+    // Filled by RGCompile for image and storage writes, the barriers the passes reading the result need
+    GLbitfield consumerBarriers;
+};
+
+// An imported resource written at the end of one frame and first read in the next
+struct RGCarriedWrite
+{
+    GLuint handle;
+    bool   isTexture;
+};
+
+typedef void (*RGExecuteFn)(App* app);
+
+struct RGPass
+{
+    const char*        name;
+    RGExecuteFn        execute;
+    std::vector<RGUse> reads;
+    std::vector<RGUse> writes;
+    bool               sideEffects; // Never culled, e.g. CPU readbacks
+    GLbitfield         clearMask;
+    glm::vec4          clearColor;
+
+    // Blit passes have no execute function
+    RGResource         blitSource;
+    RGResource         blitDestination;
+    GLbitfield         blitMask;
+    GLenum             blitFilter;
+
+    // Filled by RGCompile
+    bool               culled;
+};
+
+struct RGFramebuffer
+{
+    GLuint handle;
+    GLuint colors[RG_MAX_COLOR_ATTACHMENTS];
+    GLuint depth;
+};
+
+struct RenderGraph
+{
+    std::vector<RGResourceNode> resources;
+    std::vector<RGPass>         passes;
+    std::vector<u32>            order;
+
+    // Framebuffers are cached across frames by their attachments
+    std::vector<RGFramebuffer>  framebuffers;
+
+    // Their barriers are issued by the next frame's graph, once it knows how they are read
+    std::vector<RGCarriedWrite> carriedWrites;
+};
+
+void RGReset(RenderGraph& graph);
+
+RGResource RGImportTexture(RenderGraph& graph, const char* name, GLuint handle, RGTextureDesc desc);
+RGResource RGImportBuffer(RenderGraph& graph, const char* name, GLuint handle);
+RGResource RGImportBackbuffer(RenderGraph& graph, glm::ivec2 size);
+RGResource RGCreateTexture(RenderGraph& graph, const char* name, RGTextureDesc desc);
+void RGExport(RenderGraph& graph, RGResource resource);
+
+RGPass& RGAddPass(RenderGraph& graph, const char* name, RGExecuteFn execute);
+RGPass& RGAddBlitPass(RenderGraph& graph, const char* name, RGResource source, RGResource destination, GLbitfield mask, GLenum filter);
+
+void RGRead(RGPass& pass, RGResource resource, RGAccess access);
+void RGWrite(RGPass& pass, RGResource resource, RGAccess access);
+void RGWriteAttachment(RGPass& pass, RGResource resource, u32 attachment = 0);
+
+GLuint RGGetHandle(const RenderGraph& graph, RGResource resource);
+
+void RGCompile(RenderGraph& graph);
+void RGExecute(RenderGraph& graph, App* app);
+
+// Must be called before any texture a cached framebuffer points to is deleted
+void RGFlushFramebuffers(RenderGraph& graph);
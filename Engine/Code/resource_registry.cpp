@@ -0,0 +1,129 @@
+#include "resource_registry.h"
+
+u32 InternPath(PathTable& table, const char* path)
+{
+    auto it = table.ids.find(path);
+    if (it != table.ids.end())
+        return it->second;
+
+    const u32 pathId = table.paths.size();
+    table.paths.push_back(path);
+    table.ids.emplace(path, pathId);
+    return pathId;
+}
+
+const char* GetInternedPath(const PathTable& table, u32 pathId)
+{
+    return pathId < table.paths.size() ? table.paths[pathId].c_str() : "";
+}
+
+ResourceHandle FindResource(const ResourceRegistry& registry, u32 pathId)
+{
+    auto it = registry.slotByPath.find(pathId);
+    if (it == registry.slotByPath.end())
+        return ResourceHandle{};
+    return ResourceHandle{ it->second, registry.slots[it->second].generation };
+}
+
+ResourceHandle CreateResource(ResourceRegistry& registry, u32 pathId)
+{
+    u32 slotIndex;
+    if (!registry.freeSlots.empty())
+    {
+        slotIndex = registry.freeSlots.back();
+        registry.freeSlots.pop_back();
+    }
+    else
+    {
+        slotIndex = registry.slots.size();
+        registry.slots.push_back(ResourceSlot{});
+    }
+
+    ResourceSlot& slot = registry.slots[slotIndex];
+    slot.generation++;
+    slot.refCount = 0;
+    slot.pathId = pathId;
+    slot.alive = true;
+    slot.lastUsedFrame = 0;
+    slot.vramBytes = 0;
+
+    if (pathId != NO_RESOURCE_PATH)
+        registry.slotByPath[pathId] = slotIndex;
+    return ResourceHandle{ slotIndex, slot.generation };
+}
+
+bool IsResourceAlive(const ResourceRegistry& registry, ResourceHandle handle)
+{
+    return handle.index < registry.slots.size() &&
+           registry.slots[handle.index].alive &&
+           registry.slots[handle.index].generation == handle.generation;
+}
+
+static ResourceSlot* GetLiveSlot(ResourceRegistry& registry, ResourceHandle handle)
+{
+    return IsResourceAlive(registry, handle) ? &registry.slots[handle.index] : nullptr;
+}
+
+void AcquireResource(ResourceRegistry& registry, ResourceHandle handle)
+{
+    ResourceSlot* slot = GetLiveSlot(registry, handle);
+    ASSERT(slot, "Acquiring a resource that was destroyed");
+    if (slot)
+        slot->refCount++;
+}
+
+void ReleaseResource(ResourceRegistry& registry, ResourceHandle handle, u64 frame)
+{
+    ResourceSlot* slot = GetLiveSlot(registry, handle);
+    if (!slot)
+        return;
+    ASSERT(slot->refCount > 0, "Releasing a resource more times than it was acquired");
+    slot->refCount--;
+    slot->lastUsedFrame = frame;
+}
+
+void TouchResource(ResourceRegistry& registry, ResourceHandle handle, u64 frame)
+{
+    if (ResourceSlot* slot = GetLiveSlot(registry, handle))
+        slot->lastUsedFrame = frame;
+}
+
+void SetResourceSize(ResourceRegistry& registry, ResourceHandle handle, u64 vramBytes)
+{
+    ResourceSlot* slot = GetLiveSlot(registry, handle);
+    if (!slot)
+        return;
+    registry.residentBytes = registry.residentBytes - slot->vramBytes + vramBytes;
+    slot->vramBytes = vramBytes;
+}
+
+u32 FindEvictionCandidate(const ResourceRegistry& registry)
+{
+    u32 candidate = UINT32_MAX;
+    for (u32 i = 0; i < registry.slots.size(); ++i)
+    {
+        const ResourceSlot& slot = registry.slots[i];
+        if (!slot.alive || slot.refCount > 0)
+            continue;
+        if (candidate == UINT32_MAX || slot.lastUsedFrame < registry.slots[candidate].lastUsedFrame)
+            candidate = i;
+    }
+    return candidate;
+}
+
+void DestroyResource(ResourceRegistry& registry, u32 slotIndex)
+{
+    ResourceSlot& slot = registry.slots[slotIndex];
+    if (!slot.alive)
+        return;
+
+    if (slot.pathId != NO_RESOURCE_PATH)
+        registry.slotByPath.erase(slot.pathId);
+    registry.residentBytes -= slot.vramBytes;
+
+    slot.alive = false;
+    slot.refCount = 0;
+    slot.vramBytes = 0;
+    slot.generation++; // Outstanding handles stop resolving
+    registry.freeSlots.push_back(slotIndex);
+}
@@ -0,0 +1,75 @@
+//
+// resource_registry.h: Slots for GPU resources of one kind, addressed by generational handles and
+// found by interned path. A slot nobody references stays loaded as a cache entry until the
+// engine evicts it, least recently used first, to stay within its VRAM budget.
+//
+// The registry only does the bookkeeping, the resources themselves live in an array the caller
+// keeps indexed by the same slot index.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <unordered_map>
+
+#define NO_RESOURCE_PATH UINT32_MAX // For resources made in code, they can not be looked up
+
+// A destroyed slot bumps its generation, so a handle to it stops resolving instead of aliasing
+// whatever takes the slot next. The zero handle is never valid.
+struct ResourceHandle
+{
+    u32 index;
+    u32 generation;
+};
+
+struct ResourceSlot
+{
+    u32  generation;
+    u32  refCount;
+    u32  pathId;
+    bool alive;
+    u64  lastUsedFrame;
+    u64  vramBytes;
+};
+
+struct ResourceRegistry
+{
+    std::vector<ResourceSlot>    slots;
+    std::vector<u32>             freeSlots;
+    std::unordered_map<u32, u32> slotByPath;
+    u64                          residentBytes;
+};
+
+// Every path is stored once and compared as an integer from then on
+struct PathTable
+{
+    std::unordered_map<std::string, u32> ids;
+    std::vector<std::string>             paths;
+};
+
+u32 InternPath(PathTable& table, const char* path);
+
+const char* GetInternedPath(const PathTable& table, u32 pathId);
+
+// The zero handle if no live resource was made from the path
+ResourceHandle FindResource(const ResourceRegistry& registry, u32 pathId);
+
+// New live slot without references, the caller acquires the ones it keeps
+ResourceHandle CreateResource(ResourceRegistry& registry, u32 pathId);
+
+bool IsResourceAlive(const ResourceRegistry& registry, ResourceHandle handle);
+
+void AcquireResource(ResourceRegistry& registry, ResourceHandle handle);
+
+// When the last reference goes the resource becomes an eviction candidate, aged from this frame
+void ReleaseResource(ResourceRegistry& registry, ResourceHandle handle, u64 frame);
+
+void TouchResource(ResourceRegistry& registry, ResourceHandle handle, u64 frame);
+
+void SetResourceSize(ResourceRegistry& registry, ResourceHandle handle, u64 vramBytes);
+
+// Least recently used live slot without references, UINT32_MAX if there is none
+u32 FindEvictionCandidate(const ResourceRegistry& registry);
+
+// Frees the slot, the caller has already deleted what was in it
+void DestroyResource(ResourceRegistry& registry, u32 slotIndex);
@@ -0,0 +1,239 @@
+#include "shader_library.h"
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+#define MAX_INCLUDE_DEPTH 16
+
+static u32 SkipSpaces(const std::string& text, u32 i, u32 end)
+{
+    while (i < end && (text[i] == ' ' || text[i] == '\t'))
+        i++;
+    return i;
+}
+
+static bool StartsWith(const std::string& text, u32 i, u32 end, const char* prefix)
+{
+    const u32 length = strlen(prefix);
+    return i + length <= end && text.compare(i, length, prefix) == 0;
+}
+
+static u32 LineEnd(const std::string& text, u32 lineBegin)
+{
+    size_t newline = text.find('\n', lineBegin);
+    return newline == std::string::npos ? text.size() : (u32)newline + 1;
+}
+
+static void ParseSections(ShaderFile& file)
+{
+    const std::string& text = file.text;
+    file.sections.clear();
+
+    // Only #ifdef blocks at the top level are sections, the #if blocks inside them just nest
+    ShaderSection current = {};
+    u32 depth = 0;
+    for (u32 lineBegin = 0; lineBegin < text.size(); )
+    {
+        const u32 lineEnd = LineEnd(text, lineBegin);
+        const u32 directive = SkipSpaces(text, lineBegin, lineEnd);
+
+        if (StartsWith(text, directive, lineEnd, "#if"))
+        {
+            if (depth == 0 && StartsWith(text, directive, lineEnd, "#ifdef "))
+            {
+                u32 nameBegin = SkipSpaces(text, directive + strlen("#ifdef "), lineEnd);
+                u32 nameEnd = nameBegin;
+                while (nameEnd < lineEnd && (isalnum((u8)text[nameEnd]) || text[nameEnd] == '_'))
+                    nameEnd++;
+                current.name = text.substr(nameBegin, nameEnd - nameBegin);
+                current.begin = lineEnd;
+            }
+            depth++;
+        }
+        else if (StartsWith(text, directive, lineEnd, "#endif") && depth > 0)
+        {
+            depth--;
+            if (depth == 0 && !current.name.empty())
+            {
+                current.end = lineBegin;
+                file.sections.push_back(current);
+                current = {};
+            }
+        }
+
+        lineBegin = lineEnd;
+    }
+}
+
+static bool ReadShaderFile(ShaderFile& file)
+{
+    String text = ReadTextFile(file.filepath.c_str());
+    if (!text.str)
+        return false;
+
+    file.text.assign(text.str, text.len);
+    ParseSections(file);
+    return true;
+}
+
+static i32 FindShaderFile(const ShaderLibrary& library, const char* filepath)
+{
+    for (u32 i = 0; i < library.files.size(); ++i)
+        if (library.files[i].filepath == filepath)
+            return (i32)i;
+    return -1;
+}
+
+static i32 LoadShaderFileIndex(ShaderLibrary& library, const char* filepath)
+{
+    i32 fileIdx = FindShaderFile(library, filepath);
+    if (fileIdx >= 0)
+        return fileIdx;
+
+    ShaderFile file = {};
+    file.filepath = filepath;
+    const char* separator = strrchr(filepath, '/');
+    const char* backslash = strrchr(filepath, '\\');
+    if (backslash > separator)
+        separator = backslash;
+    if (separator)
+        file.directory.assign(filepath, separator - filepath + 1);
+
+    if (!ReadShaderFile(file))
+        return -1;
+
+    library.files.push_back(file);
+    return library.files.size() - 1;
+}
+
+const ShaderFile* LoadShaderFile(ShaderLibrary& library, const char* filepath)
+{
+    i32 fileIdx = LoadShaderFileIndex(library, filepath);
+    return fileIdx >= 0 ? &library.files[fileIdx] : nullptr;
+}
+
+bool ReloadShaderFile(ShaderLibrary& library, const char* filepath)
+{
+    i32 fileIdx = FindShaderFile(library, filepath);
+    if (fileIdx < 0)
+        return false;
+
+    // A file caught halfway through a save keeps its last good contents
+    ShaderFile file = library.files[fileIdx];
+    if (!ReadShaderFile(file))
+        return false;
+
+    library.files[fileIdx] = file;
+    return true;
+}
+
+// Open #if blocks at the current line, each branch of a block gets its own id
+struct IncludeScope
+{
+    std::vector<u32> scopes;
+    u32              nextScope;
+    std::vector<std::pair<i32, std::vector<u32>>> included; // File and the scopes it was expanded in
+};
+
+static void TrackConditional(const std::string& text, u32 directive, u32 lineEnd, IncludeScope& state)
+{
+    if (StartsWith(text, directive, lineEnd, "#if"))
+    {
+        state.scopes.push_back(state.nextScope++);
+    }
+    else if (StartsWith(text, directive, lineEnd, "#el") && !state.scopes.empty())
+    {
+        state.scopes.back() = state.nextScope++;
+    }
+    else if (StartsWith(text, directive, lineEnd, "#endif") && !state.scopes.empty())
+    {
+        state.scopes.pop_back();
+    }
+}
+
+// An earlier copy is visible here if every block it sat in is still open, i.e. not in a sibling branch
+static bool AlreadyIncluded(const IncludeScope& state, i32 fileIdx)
+{
+    for (const auto& include : state.included)
+    {
+        if (include.first != fileIdx || include.second.size() > state.scopes.size())
+            continue;
+        if (std::equal(include.second.begin(), include.second.end(), state.scopes.begin()))
+            return true;
+    }
+    return false;
+}
+
+// Files are referred to by index, loading an include may move the others around
+static bool AppendShaderText(ShaderLibrary& library, u32 fileIdx, u32 begin, u32 end, std::string& source, IncludeScope& state, u32 includeDepth)
+{
+    if (includeDepth > MAX_INCLUDE_DEPTH)
+    {
+        ELOG("Shader includes nested too deep in %s, is there a cycle?", library.files[fileIdx].filepath.c_str());
+        return false;
+    }
+
+    for (u32 lineBegin = begin; lineBegin < end; )
+    {
+        const std::string& text = library.files[fileIdx].text;
+        const u32 lineEnd = glm::min(LineEnd(text, lineBegin), end);
+        const u32 directive = SkipSpaces(text, lineBegin, lineEnd);
+
+        if (!StartsWith(text, directive, lineEnd, "#include"))
+        {
+            TrackConditional(text, directive, lineEnd, state);
+            source.append(text, lineBegin, lineEnd - lineBegin);
+            lineBegin = lineEnd;
+            continue;
+        }
+
+        size_t nameBegin = text.find('"', directive);
+        size_t nameEnd = nameBegin == std::string::npos ? nameBegin : text.find('"', nameBegin + 1);
+        if (nameEnd == std::string::npos || nameEnd >= lineEnd)
+        {
+            ELOG("Malformed #include in %s", library.files[fileIdx].filepath.c_str());
+            return false;
+        }
+
+        std::string includePath = library.files[fileIdx].directory + text.substr(nameBegin + 1, nameEnd - nameBegin - 1);
+        i32 includeIdx = LoadShaderFileIndex(library, includePath.c_str());
+        if (includeIdx < 0)
+            return false;
+
+        if (!AlreadyIncluded(state, includeIdx))
+        {
+            state.included.push_back({ includeIdx, state.scopes });
+            if (!AppendShaderText(library, includeIdx, 0, library.files[includeIdx].text.size(), source, state, includeDepth + 1))
+                return false;
+            source += "\n";
+        }
+
+        lineBegin = lineEnd;
+    }
+    return true;
+}
+
+bool BuildShaderSource(ShaderLibrary& library, const char* filepath, const char* sectionName, std::string& source)
+{
+    source.clear();
+
+    i32 fileIdx = LoadShaderFileIndex(library, filepath);
+    if (fileIdx < 0)
+        return false;
+
+    const ShaderFile& file = library.files[fileIdx];
+    u32 begin = 0;
+    u32 end = file.text.size();
+    for (const ShaderSection& section : file.sections)
+    {
+        if (section.name == sectionName)
+        {
+            begin = section.begin;
+            end = section.end;
+            break;
+        }
+    }
+
+    IncludeScope state = {};
+    return AppendShaderText(library, fileIdx, begin, end, source, state, 0);
+}
@@ -0,0 +1,38 @@
+//
+// shader_library.h: Shader files are read and split into their "#ifdef NAME" sections once.
+// A program's source is only its own section, with every #include expanded in place.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct ShaderSection
+{
+    std::string name;
+    u32         begin; // Text between the #ifdef line and its matching #endif
+    u32         end;
+};
+
+struct ShaderFile
+{
+    std::string                filepath;
+    std::string                directory; // Includes are relative to it
+    std::string                text;
+    std::vector<ShaderSection> sections;
+};
+
+struct ShaderLibrary
+{
+    std::vector<ShaderFile> files;
+};
+
+// Reads the file the first time it is asked for, later calls return the parsed copy
+const ShaderFile* LoadShaderFile(ShaderLibrary& library, const char* filepath);
+
+// Reads the file again after it changed on disk, false if the library never loaded it
+bool ReloadShaderFile(ShaderLibrary& library, const char* filepath);
+
+// Source for one section, the whole file when it has no section with that name. A file included
+// again where an earlier copy is still in scope is skipped, one per stage branch is kept.
+bool BuildShaderSource(ShaderLibrary& library, const char* filepath, const char* sectionName, std::string& source);
@@ -0,0 +1,362 @@
+//
+// simd_math.cpp: Scalar, SSE and AVX versions of the batch kernels, and the CPU feature
+// detection that picks between them. glm stores matrices column major, so every column is
+// one 128 bit register and the kernels work on them directly.
+//
+
+#include "simd_math.h"
+#include <string.h>
+#include <float.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SIMD_TARGET_AVX
+#else
+#include <cpuid.h>
+#define SIMD_TARGET_AVX __attribute__((target("avx,fma")))
+#endif
+#endif
+
+// aStride is 1 for one left matrix per entry and 0 to apply the same one to all of them
+typedef void (*MultiplyMatricesFn)(const glm::mat4* a, u32 aStride, const glm::mat4* b, glm::mat4* out, u32 count);
+typedef void (*TransformBoundsFn)(const glm::mat4* matrices, const glm::vec3* localMin, const glm::vec3* localMax, glm::vec3* worldMin, glm::vec3* worldMax, u32 count);
+typedef void (*ComputeNormalMatricesFn)(const glm::mat4* matrices, glm::mat3* normalMatrices, u32 count);
+typedef f32 (*FindNearestColorsFn)(const f32* pixels, u32 count, const glm::vec4* palette, u32 paletteSize, u8* indices);
+
+struct SimdKernels
+{
+    const char*             name;
+    MultiplyMatricesFn      multiplyMatrices;
+    TransformBoundsFn       transformBounds;
+    ComputeNormalMatricesFn computeNormalMatrices;
+    FindNearestColorsFn     findNearestColors;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalar
+
+static void MultiplyMatricesScalar(const glm::mat4* a, u32 aStride, const glm::mat4* b, glm::mat4* out, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+        out[i] = a[i * aStride] * b[i];
+}
+
+static void TransformBoundsScalar(const glm::mat4* matrices, const glm::vec3* localMin, const glm::vec3* localMax, glm::vec3* worldMin, glm::vec3* worldMax, u32 count)
+{
+    // Center and half extents, the extents go through the absolute value of the matrix
+    for (u32 i = 0; i < count; ++i)
+    {
+        const glm::mat4& m = matrices[i];
+        glm::vec3 center = (localMin[i] + localMax[i]) * 0.5f;
+        glm::vec3 extent = (localMax[i] - localMin[i]) * 0.5f;
+        glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.f));
+        glm::vec3 worldExtent = glm::abs(glm::vec3(m[0])) * extent.x +
+                                glm::abs(glm::vec3(m[1])) * extent.y +
+                                glm::abs(glm::vec3(m[2])) * extent.z;
+        worldMin[i] = worldCenter - worldExtent;
+        worldMax[i] = worldCenter + worldExtent;
+    }
+}
+
+static void ComputeNormalMatricesScalar(const glm::mat4* matrices, glm::mat3* normalMatrices, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+        normalMatrices[i] = glm::transpose(glm::inverse(glm::mat3(matrices[i])));
+}
+
+static f32 FindNearestColorsScalar(const f32* pixels, u32 count, const glm::vec4* palette, u32 paletteSize, u8* indices)
+{
+    f32 totalError = 0.f;
+    for (u32 i = 0; i < count; ++i)
+    {
+        const glm::vec4 pixel(pixels[i], pixels[count + i], pixels[2 * count + i], pixels[3 * count + i]);
+        f32 bestError = FLT_MAX;
+        for (u32 j = 0; j < paletteSize; ++j)
+        {
+            const glm::vec4 d = pixel - palette[j];
+            const f32 error = glm::dot(d, d);
+            if (error < bestError)
+            {
+                bestError = error;
+                indices[i] = (u8)j;
+            }
+        }
+        totalError += bestError;
+    }
+    return totalError;
+}
+
+static const SimdKernels scalarKernels = { "Scalar", MultiplyMatricesScalar, TransformBoundsScalar, ComputeNormalMatricesScalar, FindNearestColorsScalar };
+
+#ifdef SIMD_X86
+
+////////////////////////////////////////////////////////////////////////////////
+// SSE
+
+#define SPLAT(v, i) _mm_shuffle_ps(v, v, _MM_SHUFFLE(i, i, i, i))
+
+static inline __m128 Cross(__m128 a, __m128 b)
+{
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static inline void StoreVec3(float* dst, __m128 v)
+{
+    float tmp[4];
+    _mm_storeu_ps(tmp, v);
+    memcpy(dst, tmp, 3 * sizeof(float));
+}
+
+static inline __m128 LoadVec3(const glm::vec3& v)
+{
+    return _mm_setr_ps(v.x, v.y, v.z, 0.f);
+}
+
+static void MultiplyMatricesSSE(const glm::mat4* a, u32 aStride, const glm::mat4* b, glm::mat4* out, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        const float* pa = &a[i * aStride][0][0];
+        const float* pb = &b[i][0][0];
+        __m128 a0 = _mm_loadu_ps(pa + 0);
+        __m128 a1 = _mm_loadu_ps(pa + 4);
+        __m128 a2 = _mm_loadu_ps(pa + 8);
+        __m128 a3 = _mm_loadu_ps(pa + 12);
+
+        // Everything is loaded before the first store, so out may alias a or b
+        __m128 b0 = _mm_loadu_ps(pb + 0);
+        __m128 b1 = _mm_loadu_ps(pb + 4);
+        __m128 b2 = _mm_loadu_ps(pb + 8);
+        __m128 b3 = _mm_loadu_ps(pb + 12);
+
+        __m128 columns[4];
+        const __m128 bColumns[4] = { b0, b1, b2, b3 };
+        for (u32 c = 0; c < 4; ++c)
+        {
+            __m128 bc = bColumns[c];
+            __m128 r = _mm_mul_ps(a0, SPLAT(bc, 0));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, SPLAT(bc, 1)));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, SPLAT(bc, 2)));
+            r = _mm_add_ps(r, _mm_mul_ps(a3, SPLAT(bc, 3)));
+            columns[c] = r;
+        }
+
+        float* po = &out[i][0][0];
+        _mm_storeu_ps(po + 0, columns[0]);
+        _mm_storeu_ps(po + 4, columns[1]);
+        _mm_storeu_ps(po + 8, columns[2]);
+        _mm_storeu_ps(po + 12, columns[3]);
+    }
+}
+
+static void TransformBoundsSSE(const glm::mat4* matrices, const glm::vec3* localMin, const glm::vec3* localMax, glm::vec3* worldMin, glm::vec3* worldMax, u32 count)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    for (u32 i = 0; i < count; ++i)
+    {
+        const float* pm = &matrices[i][0][0];
+        __m128 m0 = _mm_loadu_ps(pm + 0);
+        __m128 m1 = _mm_loadu_ps(pm + 4);
+        __m128 m2 = _mm_loadu_ps(pm + 8);
+        __m128 m3 = _mm_loadu_ps(pm + 12);
+
+        __m128 bmin = LoadVec3(localMin[i]);
+        __m128 bmax = LoadVec3(localMax[i]);
+        __m128 center = _mm_mul_ps(_mm_add_ps(bmin, bmax), half);
+        __m128 extent = _mm_mul_ps(_mm_sub_ps(bmax, bmin), half);
+
+        __m128 worldCenter = _mm_add_ps(m3, _mm_mul_ps(m0, SPLAT(center, 0)));
+        worldCenter = _mm_add_ps(worldCenter, _mm_mul_ps(m1, SPLAT(center, 1)));
+        worldCenter = _mm_add_ps(worldCenter, _mm_mul_ps(m2, SPLAT(center, 2)));
+
+        __m128 worldExtent = _mm_mul_ps(_mm_and_ps(m0, absMask), SPLAT(extent, 0));
+        worldExtent = _mm_add_ps(worldExtent, _mm_mul_ps(_mm_and_ps(m1, absMask), SPLAT(extent, 1)));
+        worldExtent = _mm_add_ps(worldExtent, _mm_mul_ps(_mm_and_ps(m2, absMask), SPLAT(extent, 2)));
+
+        StoreVec3(&worldMin[i].x, _mm_sub_ps(worldCenter, worldExtent));
+        StoreVec3(&worldMax[i].x, _mm_add_ps(worldCenter, worldExtent));
+    }
+}
+
+static void ComputeNormalMatricesSSE(const glm::mat4* matrices, glm::mat3* normalMatrices, u32 count)
+{
+    // The inverse transpose of [c0 c1 c2] is [c1 x c2, c2 x c0, c0 x c1] / det
+    for (u32 i = 0; i < count; ++i)
+    {
+        const float* pm = &matrices[i][0][0];
+        __m128 c0 = _mm_loadu_ps(pm + 0);
+        __m128 c1 = _mm_loadu_ps(pm + 4);
+        __m128 c2 = _mm_loadu_ps(pm + 8);
+
+        __m128 r0 = Cross(c1, c2);
+        __m128 r1 = Cross(c2, c0);
+        __m128 r2 = Cross(c0, c1);
+
+        // det = dot(c0, c1 x c2), the w lane of the cross products is zero
+        __m128 d = _mm_mul_ps(c0, r0);
+        d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+        d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), d);
+
+        float* po = &normalMatrices[i][0][0];
+        StoreVec3(po + 0, _mm_mul_ps(r0, invDet));
+        StoreVec3(po + 3, _mm_mul_ps(r1, invDet));
+        StoreVec3(po + 6, _mm_mul_ps(r2, invDet));
+    }
+}
+
+static f32 FindNearestColorsSSE(const f32* pixels, u32 count, const glm::vec4* palette, u32 paletteSize, u8* indices)
+{
+    // Four pixels per register against one palette color at a time, ties keep the lower index
+    __m128 totalError = _mm_setzero_ps();
+    for (u32 i = 0; i < count; i += 4)
+    {
+        __m128 r = _mm_loadu_ps(pixels + i);
+        __m128 g = _mm_loadu_ps(pixels + count + i);
+        __m128 b = _mm_loadu_ps(pixels + 2 * count + i);
+        __m128 a = _mm_loadu_ps(pixels + 3 * count + i);
+        __m128 bestError = _mm_set1_ps(FLT_MAX);
+        __m128 bestIndex = _mm_setzero_ps();
+
+        for (u32 j = 0; j < paletteSize; ++j)
+        {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[j].r));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[j].g));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[j].b));
+            __m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[j].a));
+            __m128 error = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+                                      _mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da)));
+            __m128 closer = _mm_cmplt_ps(error, bestError);
+            bestError = _mm_min_ps(error, bestError);
+            bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((f32)j)), _mm_andnot_ps(closer, bestIndex));
+        }
+
+        totalError = _mm_add_ps(totalError, bestError);
+        alignas(16) i32 lanes[4];
+        _mm_store_si128((__m128i*)lanes, _mm_cvttps_epi32(bestIndex));
+        for (u32 k = 0; k < 4; ++k)
+            indices[i + k] = (u8)lanes[k];
+    }
+
+    alignas(16) f32 sums[4];
+    _mm_store_ps(sums, totalError);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+static const SimdKernels sseKernels = { "SSE2", MultiplyMatricesSSE, TransformBoundsSSE, ComputeNormalMatricesSSE, FindNearestColorsSSE };
+
+////////////////////////////////////////////////////////////////////////////////
+// AVX + FMA
+
+SIMD_TARGET_AVX static void MultiplyMatricesAVX(const glm::mat4* a, u32 aStride, const glm::mat4* b, glm::mat4* out, u32 count)
+{
+    // Two columns of the result per register, each lane pair scales the same four columns of a
+    for (u32 i = 0; i < count; ++i)
+    {
+        const float* pa = &a[i * aStride][0][0];
+        const float* pb = &b[i][0][0];
+        __m256 a0 = _mm256_broadcast_ps((const __m128*)(pa + 0));
+        __m256 a1 = _mm256_broadcast_ps((const __m128*)(pa + 4));
+        __m256 a2 = _mm256_broadcast_ps((const __m128*)(pa + 8));
+        __m256 a3 = _mm256_broadcast_ps((const __m128*)(pa + 12));
+        __m256 b01 = _mm256_loadu_ps(pb + 0);
+        __m256 b23 = _mm256_loadu_ps(pb + 8);
+
+        __m256 r01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+        r01 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b01, 0x55), r01);
+        r01 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b01, 0xAA), r01);
+        r01 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b01, 0xFF), r01);
+
+        __m256 r23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+        r23 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b23, 0x55), r23);
+        r23 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b23, 0xAA), r23);
+        r23 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b23, 0xFF), r23);
+
+        float* po = &out[i][0][0];
+        _mm256_storeu_ps(po + 0, r01);
+        _mm256_storeu_ps(po + 8, r23);
+    }
+}
+
+// Bounds and normal matrices are one column per register already, wider registers do not help
+static const SimdKernels avxKernels = { "AVX FMA", MultiplyMatricesAVX, TransformBoundsSSE, ComputeNormalMatricesSSE, FindNearestColorsSSE };
+
+static bool CpuSupportsAVX()
+{
+    u32 ecx = 0;
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    ecx = (u32)info[2];
+#else
+    u32 eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+#endif
+
+    const bool osxsave = (ecx & (1u << 27)) != 0;
+    const bool avx = (ecx & (1u << 28)) != 0;
+    const bool fma = (ecx & (1u << 12)) != 0;
+    if (!osxsave || !avx || !fma)
+        return false;
+
+    // The OS has to save the YMM registers on context switches
+#if defined(_MSC_VER)
+    u64 xcr0 = _xgetbv(0);
+#else
+    u32 xcr0Lo, xcr0Hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+    u64 xcr0 = ((u64)xcr0Hi << 32) | xcr0Lo;
+#endif
+    return (xcr0 & 6) == 6;
+}
+
+#endif // SIMD_X86
+
+static const SimdKernels* kernels = &scalarKernels;
+
+void InitSimdKernels()
+{
+#ifdef SIMD_X86
+    kernels = CpuSupportsAVX() ? &avxKernels : &sseKernels;
+#else
+    kernels = &scalarKernels;
+#endif
+}
+
+const char* GetSimdKernelName()
+{
+    return kernels->name;
+}
+
+void MultiplyMatrices(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, u32 count)
+{
+    kernels->multiplyMatrices(a, 1, b, out, count);
+}
+
+void MultiplyMatrices(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, u32 count)
+{
+    kernels->multiplyMatrices(&a, 0, b, out, count);
+}
+
+void TransformBounds(const glm::mat4* matrices, const glm::vec3* localMin, const glm::vec3* localMax, glm::vec3* worldMin, glm::vec3* worldMax, u32 count)
+{
+    kernels->transformBounds(matrices, localMin, localMax, worldMin, worldMax, count);
+}
+
+void ComputeNormalMatrices(const glm::mat4* matrices, glm::mat3* normalMatrices, u32 count)
+{
+    kernels->computeNormalMatrices(matrices, normalMatrices, count);
+}
+
+f32 FindNearestColors(const f32* pixels, u32 count, const glm::vec4* palette, u32 paletteSize, u8* indices)
+{
+    return kernels->findNearestColors(pixels, count, palette, paletteSize, indices);
+}
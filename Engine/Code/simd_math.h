@@ -0,0 +1,29 @@
+//
+// simd_math.h: Batch kernels over contiguous arrays of matrices and bounds. InitSimdKernels()
+// picks the widest instruction set the host CPU supports, the results match the glm
+// equivalents up to rounding.
+//
+
+#pragma once
+
+#include "platform.h"
+
+void InitSimdKernels();
+
+const char* GetSimdKernelName();
+
+// out[i] = a[i] * b[i]
+void MultiplyMatrices(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, u32 count);
+
+// out[i] = a * b[i]
+void MultiplyMatrices(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, u32 count);
+
+// World space bounds of each local box under its matrix
+void TransformBounds(const glm::mat4* matrices, const glm::vec3* localMin, const glm::vec3* localMax, glm::vec3* worldMin, glm::vec3* worldMax, u32 count);
+
+// Inverse transpose of the upper 3x3 of each matrix
+void ComputeNormalMatrices(const glm::mat4* matrices, glm::mat3* normalMatrices, u32 count);
+
+// Index of the closest palette color for each pixel and the summed squared distance. The pixels
+// are planar, all reds then all greens, blues and alphas, and count is a multiple of 4.
+f32 FindNearestColors(const f32* pixels, u32 count, const glm::vec4* palette, u32 paletteSize, u8* indices);
@@ -0,0 +1,129 @@
+#include "texture_loader.h"
+#include "cooked_texture.h"
+#include "texture_streaming.h"
+
+static TextureLoadResult LoadTexture(const TextureLoadRequest& request)
+{
+    TextureLoadResult result = {};
+    result.texture = request.texture;
+
+    // Block compressed when it can be cooked, decoded to plain pixels otherwise. Height maps need the
+    // max-mip chain only the cook builds, they fail instead.
+    if (!MapCookedTexture(request.filepath.c_str(), request.usage, request.s3tcSupported, result.cooked) &&
+        request.usage != TextureUsage_Height)
+        result.image = LoadImage(request.filepath.c_str());
+    return result;
+}
+
+static void RunTextureWorker(TextureLoader* loader)
+{
+    for (;;)
+    {
+        TextureLoadRequest request;
+        {
+            std::unique_lock<std::mutex> lock(loader->mutex);
+            loader->wakeWorkers.wait(lock, [loader] { return loader->stopping || !loader->requests.empty(); });
+            if (loader->stopping)
+                return;
+            request = loader->requests.front();
+            loader->requests.pop_front();
+        }
+
+        TextureLoadResult result = LoadTexture(request);
+
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->results.push_back(result);
+    }
+}
+
+void StartTextureLoader(TextureLoader& loader)
+{
+    // One core stays with the main thread
+    const u32 workerCount = glm::max(std::thread::hardware_concurrency(), 2u) - 1;
+    for (u32 i = 0; i < workerCount; ++i)
+        loader.workers.emplace_back(RunTextureWorker, &loader);
+}
+
+static void ReleaseResult(TextureLoadResult& result)
+{
+    UnmapFile(result.cooked);
+    if (result.image.pixels)
+        FreeImage(result.image);
+}
+
+void StopTextureLoader(TextureLoader& loader)
+{
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.stopping = true;
+        loader.requests.clear();
+    }
+    loader.wakeWorkers.notify_all();
+    for (std::thread& worker : loader.workers)
+        worker.join();
+    loader.workers.clear();
+
+    for (TextureLoadResult& result : loader.results)
+        ReleaseResult(result);
+    loader.results.clear();
+}
+
+void RequestTextureLoad(TextureLoader& loader, const TextureLoadRequest& request)
+{
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.requests.push_back(request);
+    }
+    loader.wakeWorkers.notify_one();
+}
+
+void UploadLoadedTextures(App* app)
+{
+    TextureLoader& loader = *app->textureLoader;
+
+    u32 uploadedBytes = 0;
+    while (uploadedBytes < TEXTURE_UPLOAD_BUDGET)
+    {
+        TextureLoadResult result;
+        {
+            std::lock_guard<std::mutex> lock(loader.mutex);
+            if (loader.results.empty())
+                break;
+            result = loader.results.front();
+            loader.results.pop_front();
+        }
+
+        Texture& texture = app->textures[result.texture.index];
+        u64 vramBytes = 0;
+        if (result.cooked.data)
+        {
+            // Only the coarse levels go up now, the finer ones stream in once something is near enough.
+            // Relief walks the whole max-mip chain of a height map, so those are complete from the start.
+            const u32 levelCount = GetCookedLevelCount(result.cooked);
+            texture.residentLevel = texture.usage == TextureUsage_Height ? 0 : GetInitialStreamingLevel(result.cooked);
+            texture.wantedLevel = texture.residentLevel;
+            texture.fineLevelsFrame = app->frameIndex;
+            texture.handle = CreateTextureFromCooked(result.cooked, texture.residentLevel);
+            texture.state = TextureState_Resident;
+            vramBytes = GetCookedLevelBytes(result.cooked, texture.residentLevel, levelCount);
+            if (texture.residentLevel > 0)
+                std::swap(texture.cooked, result.cooked);
+        }
+        else if (result.image.pixels)
+        {
+            texture.handle = CreateTexture2DFromImage(result.image);
+            texture.state = TextureState_Resident;
+            vramBytes = result.image.size.y * result.image.stride * 4 / 3; // Mips add a third
+        }
+        else
+        {
+            texture.handle = GetPlaceholderTexture(app, texture.usage, true);
+            texture.state = TextureState_Failed;
+        }
+        uploadedBytes += vramBytes;
+
+        SetResourceSize(app->textureRegistry, result.texture, vramBytes);
+        ReleaseResource(app->textureRegistry, result.texture, app->frameIndex);
+        ReleaseResult(result);
+    }
+}
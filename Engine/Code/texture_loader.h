@@ -0,0 +1,53 @@
+//
+// texture_loader.h: Textures are cooked, mapped or decoded on a pool of worker threads. The main
+// thread only creates the GL textures, a few per frame within an upload budget, and until then
+// the texture keeps the placeholder LoadTexture2D gave it.
+//
+
+#pragma once
+
+#include "engine.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// Bytes handed to the driver per frame, at least one texture goes up even if it is larger
+#define TEXTURE_UPLOAD_BUDGET MB(16)
+
+// The request holds a reference on the texture, so it can not be evicted while in flight
+struct TextureLoadRequest
+{
+    ResourceHandle texture;
+    std::string  filepath;
+    TextureUsage usage;
+    bool         s3tcSupported; // Otherwise BC1/BC3 textures are decoded uncompressed
+};
+
+// One of the two is filled, neither when the image could not be read
+struct TextureLoadResult
+{
+    ResourceHandle texture;
+    MappedFile cooked;
+    Image      image;
+};
+
+struct TextureLoader
+{
+    std::vector<std::thread>       workers;
+    std::mutex                     mutex;
+    std::condition_variable        wakeWorkers;
+    std::deque<TextureLoadRequest> requests;
+    std::deque<TextureLoadResult>  results;
+    bool                           stopping = false;
+};
+
+void StartTextureLoader(TextureLoader& loader);
+
+// Waits for the jobs being worked on, drops the queued ones
+void StopTextureLoader(TextureLoader& loader);
+
+void RequestTextureLoad(TextureLoader& loader, const TextureLoadRequest& request);
+
+// Creates the GL textures of finished loads and swaps them in for their placeholders
+void UploadLoadedTextures(App* app);
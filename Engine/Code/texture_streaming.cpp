@@ -0,0 +1,163 @@
+#include "texture_streaming.h"
+#include "cooked_texture.h"
+#include <algorithm>
+
+u32 GetInitialStreamingLevel(const MappedFile& cooked)
+{
+    const CookedTextureLevel* levels = GetCookedLevels(cooked);
+    const u32 levelCount = GetCookedLevelCount(cooked);
+    u32 level = 0;
+    while (level + 1 < levelCount && glm::max(levels[level].width, levels[level].height) > MIP_STREAMING_INITIAL_SIZE)
+        level++;
+    return level;
+}
+
+static bool IsStreaming(App* app, u32 slotIndex)
+{
+    const Texture& texture = app->textures[slotIndex];
+    return app->textureRegistry.slots[slotIndex].alive && texture.cooked.data && texture.state == TextureState_Resident;
+}
+
+// uvPerPixel is how many UV units one pixel covers where the texture is sampled
+static void RequestTextureLevel(App* app, ResourceHandle handle, f32 uvPerPixel)
+{
+    if (!IsResourceAlive(app->textureRegistry, handle) || !IsStreaming(app, handle.index))
+        return;
+
+    Texture& texture = app->textures[handle.index];
+    const CookedTextureLevel& top = GetCookedLevels(texture.cooked)[0];
+    const f32 texelsPerPixel = uvPerPixel * glm::max(top.width, top.height);
+    const u32 level = texelsPerPixel > 1.f ? (u32)glm::log2(texelsPerPixel) : 0;
+    texture.wantedLevel = glm::min(texture.wantedLevel, level);
+}
+
+// Texel density of the visible surfaces is roughly what the GPU derives from the UV derivatives,
+// without reading any feedback back
+static void EstimateWantedLevels(App* app)
+{
+    for (u32 i = 0; i < app->textures.size(); ++i)
+        if (IsStreaming(app, i))
+            app->textures[i].wantedLevel = GetCookedLevelCount(app->textures[i].cooked) - 1;
+
+    const Camera& camera = app->camera;
+    const f32 pixelsPerUnitAtOne = app->renderSize.y / (2.f * glm::tan(glm::radians(camera.fov) * 0.5f));
+
+    for (const Entity& entity : app->entities)
+    {
+        // An unloaded or evicted mesh draws nothing, so it needs no levels either
+        const Model& model = app->models[entity.modelId];
+        if (!IsResourceAlive(app->meshRegistry, model.mesh))
+            continue;
+        const Mesh& mesh = app->meshes[model.mesh.index];
+
+        vec3 worldMin, worldMax;
+        GetEntityWorldBounds(app, entity, worldMin, worldMax);
+        const vec3 outside = glm::max(glm::max(worldMin - camera.cameraPos, camera.cameraPos - worldMax), vec3(0.f));
+        const f32 distance = glm::max(glm::length(outside), camera.zNear);
+
+        const f32 scale = glm::max(glm::max(glm::length(vec3(entity.worldMatrix[0])), glm::length(vec3(entity.worldMatrix[1]))),
+                                   glm::length(vec3(entity.worldMatrix[2])));
+        const f32 pixelsPerUnit = pixelsPerUnitAtOne / distance;
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const f32 worldPerUV = mesh.submeshes[i].worldPerUV * scale;
+            if (worldPerUV <= 0.f)
+                continue;
+            const f32 uvPerPixel = 1.f / (pixelsPerUnit * worldPerUV);
+
+            const Material& material = app->materials[model.materialIdx[i]];
+            RequestTextureLevel(app, material.albedoTexture, uvPerPixel);
+            RequestTextureLevel(app, material.emissiveTexture, uvPerPixel);
+            RequestTextureLevel(app, material.specularTexture, uvPerPixel);
+            RequestTextureLevel(app, material.normalsTexture, uvPerPixel); // Height maps never stream
+        }
+    }
+}
+
+static void SetResidentLevel(App* app, u32 slotIndex, u32 level)
+{
+    Texture& texture = app->textures[slotIndex];
+    const CookedTextureLevel* levels = GetCookedLevels(texture.cooked);
+    const u32 levelCount = GetCookedLevelCount(texture.cooked);
+
+    // Levels both textures hold are copied on the GPU, finer ones come from the mapping
+    GLuint texHandle = AllocateCookedTexture(texture.cooked, level);
+    for (u32 i = glm::max(level, texture.residentLevel); i < levelCount; ++i)
+        glCopyImageSubData(texture.handle, GL_TEXTURE_2D, i - texture.residentLevel, 0, 0, 0,
+                           texHandle, GL_TEXTURE_2D, i - level, 0, 0, 0, levels[i].width, levels[i].height, 1);
+    if (level < texture.residentLevel)
+        UploadCookedLevels(texture.cooked, texHandle, level, level, texture.residentLevel);
+
+    glDeleteTextures(1, &texture.handle);
+    texture.handle = texHandle;
+    texture.residentLevel = level;
+
+    const ResourceHandle handle = { slotIndex, app->textureRegistry.slots[slotIndex].generation };
+    SetResourceSize(app->textureRegistry, handle, GetCookedLevelBytes(texture.cooked, level, levelCount));
+}
+
+// Never below the levels the texture was loaded with
+static void TrimLevels(App* app, u32 slotIndex)
+{
+    const Texture& texture = app->textures[slotIndex];
+    const u32 level = glm::min(texture.wantedLevel, GetInitialStreamingLevel(texture.cooked));
+    if (level > texture.residentLevel)
+        SetResidentLevel(app, slotIndex, level);
+}
+
+void StreamTextureMips(App* app)
+{
+    EstimateWantedLevels(app);
+
+    std::vector<u32> streamIn;
+    for (u32 i = 0; i < app->textures.size(); ++i)
+    {
+        if (!IsStreaming(app, i))
+            continue;
+
+        Texture& texture = app->textures[i];
+        if (texture.wantedLevel <= texture.residentLevel)
+            texture.fineLevelsFrame = app->frameIndex;
+
+        if (texture.wantedLevel < texture.residentLevel)
+            streamIn.push_back(i);
+        else if (app->frameIndex - texture.fineLevelsFrame > MIP_STREAMING_TRIM_FRAMES)
+            TrimLevels(app, i);
+    }
+
+    // The blurriest first, one level per texture and frame
+    std::sort(streamIn.begin(), streamIn.end(), [app](u32 a, u32 b) {
+        const Texture& ta = app->textures[a];
+        const Texture& tb = app->textures[b];
+        return ta.residentLevel - ta.wantedLevel > tb.residentLevel - tb.wantedLevel;
+    });
+
+    u64 uploadedBytes = 0;
+    bool trimmed = false;
+    for (u32 slotIndex : streamIn)
+    {
+        if (uploadedBytes >= MIP_STREAMING_UPLOAD_BUDGET)
+            break;
+
+        const Texture& texture = app->textures[slotIndex];
+        const u32 level = texture.residentLevel - 1;
+        const u64 levelBytes = GetCookedLevelBytes(texture.cooked, level, level + 1);
+
+        // Over budget, levels that are not needed right now go before waiting out their delay
+        bool fits = EvictResources(app, levelBytes);
+        if (!fits && !trimmed)
+        {
+            trimmed = true;
+            for (u32 i = 0; i < app->textures.size(); ++i)
+                if (IsStreaming(app, i) && app->textures[i].wantedLevel > app->textures[i].residentLevel)
+                    TrimLevels(app, i);
+            fits = EvictResources(app, levelBytes);
+        }
+        if (!fits)
+            break;
+
+        SetResidentLevel(app, slotIndex, level);
+        uploadedBytes += levelBytes;
+    }
+}
@@ -0,0 +1,24 @@
+//
+// texture_streaming.h: Cooked textures larger than MIP_STREAMING_INITIAL_SIZE start with their coarse
+// levels only. Every frame the finest level each one needs is estimated on the CPU from the distance
+// and texel density of the entities using it, finer levels are streamed in from the still mapped
+// cooked file while they fit the VRAM budget, and dropped again once nothing has needed them for a
+// while. Height maps are left out, relief mapping reads every level of their max-mip chain.
+//
+// A texture's GL storage always holds a contiguous range of levels down to the smallest, changing
+// the range makes a new texture and copies the shared levels over on the GPU.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define MIP_STREAMING_INITIAL_SIZE  256      // Largest level loaded before anything asks for more
+#define MIP_STREAMING_UPLOAD_BUDGET MB(8)    // Level bytes streamed in per frame
+#define MIP_STREAMING_TRIM_FRAMES   120      // Frames a level goes unneeded before it is dropped
+
+// First cooked level no larger than MIP_STREAMING_INITIAL_SIZE
+u32 GetInitialStreamingLevel(const MappedFile& cooked);
+
+// Estimates the levels needed this frame, then streams levels in and out
+void StreamTextureMips(App* app);
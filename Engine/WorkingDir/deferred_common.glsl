@@ -0,0 +1,17 @@
+// G-buffer inputs shared by the deferred lighting passes
+
+#include "normal_encoding.glsl"
+
+uniform mat4 uInverseViewProjection;
+
+uniform sampler2D uDepthTexture;
+uniform sampler2D uNormalsTexture;
+uniform sampler2D uAlbedoTexture;
+
+// World position of the surface stored at texCoords
+vec3 ReconstructPosition(vec2 texCoords)
+{
+	float depth = texture(uDepthTexture, texCoords).r;
+	vec4 world = uInverseViewProjection * vec4(vec3(texCoords, depth) * 2.0 - 1.0, 1.0);
+	return world.xyz / world.w;
+}
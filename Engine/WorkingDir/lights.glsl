@@ -0,0 +1,56 @@
+// Light storage buffer filled by UpdateLightBuffer, same layout as the one in engine.cpp, and the shading
+// the lighting passes share
+
+struct Light {
+	vec3	color;
+	uint	type; // 0: dir, 1: point
+	vec3	direction;
+	float	intensity;
+	vec3	position;
+	float	radius;
+	int		shadowTile; // First shadow atlas tile, -1 if the light casts no shadows
+};
+
+layout(binding = 2, std430) readonly buffer Lights
+{
+	Light uLights[];
+};
+
+vec3 DirectionalLight(Light light, vec3 normal, vec3 view_dir, vec2 texCoords, float shadow){
+    vec3 lightColor = vec3(1.);
+    // Ambient
+    vec3 ambient = lightColor * 0.15 * light.color;
+
+    // Diffuse
+    vec3 lightDirection = normalize(-light.position);
+    float diffuseIntensity = max(dot(normal, light.direction),0.0);
+    vec3 diffuse = diffuseIntensity * lightColor * light.color;
+
+    // Specular
+    float specularStrength = 0.01;
+    float specularIntensity = pow(max(dot(normal, lightDirection),0.0),0.1);
+    vec3 specular = specularStrength * specularIntensity * lightColor * light.intensity;
+
+    return (ambient + (diffuse + specular) * shadow) * light.intensity;
+}
+
+// radius is where the light was cut off, its culling radius or the volume it is drawn with
+vec3 PointLight(Light light, vec3 normal, vec3 frag_pos, vec3 view_dir, vec2 texCoords, float shadow, float radius)
+{
+    vec3 ambient = light.color;
+
+    vec3 lightDir = normalize(light.position - frag_pos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = ambient * diff;
+
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(view_dir, reflectDir), 0.0), 0.0) * 0.01;
+    vec3 specular = ambient * spec;
+
+    float distance = length(light.position - frag_pos);
+    float range = 1/distance;
+
+    // Fade to zero at the cutoff so cluster, tile and volume borders do not show
+    float falloff = clamp(1.0 - pow(distance / radius, 4.0), 0.0, 1.0);
+	return (diffuse + specular) * shadow * range * light.intensity * falloff * falloff;
+}
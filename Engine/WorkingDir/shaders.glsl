@@ -19,7 +19,7 @@ void main() {
 
 in vec2 vTexCoord;
 
-uniform sampler2D uTexture;
+layout(binding = 0) uniform sampler2D uTexture;
 
 layout(location = 0) out vec4 oColor;
 
@@ -42,25 +42,17 @@ layout(location=0) in vec3 aPosition;
 layout(location=1) in vec3 aNormals;
 layout(location=2) in vec2 aTexCoord;
 
-struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     	 float 			intensity;
-};
-
 layout(binding = 0, std140) uniform GlobalParms
 {
 	vec3 			uCameraPosition;
  	int 			uLightCount;
- 	Light			uLight[16];
 };
 
 layout(binding = 1, std140) uniform LocalParms
 {
 	mat4 uWorldMatrix;
 	mat4 uWorldViewProjectionMatrix;
+	mat3 uNormalMatrix;
 };
 
 out vec2 vTexCoord;
@@ -69,30 +61,25 @@ out vec3 vViewDir;
 out vec3 vPosition;
 
 void main() {
-    gl_Position = uWorldViewProjectionMatrix * uWorldMatrix * vec4(aPosition, 1.0);
-    vNormals = mat3(transpose(inverse(uWorldMatrix))) * aNormals;
+    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    vNormals = uNormalMatrix * aNormals;
     vTexCoord = aTexCoord;
-    vViewDir = uCameraPosition - aPosition;
     vPosition = vec3(uWorldMatrix * vec4(aPosition,1.0));
+    vViewDir = uCameraPosition - vPosition; // aPosition may be quantized, vPosition is in world space
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
- struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     float 			intensity;
-};
+#include "lights.glsl"
 
 layout(binding = 0, std140) uniform GlobalParms
 {
 	vec3 			uCameraPosition;
 	int 			uLightCount;
-	Light			uLight[16];
 };
 
+layout(early_fragment_tests) in;
+
 in vec2 vTexCoord;
 in vec3 vNormals;
 in vec3 vViewDir;
@@ -101,26 +88,24 @@ in vec3 vPosition;
 uniform sampler2D uTexture;
 
 layout(location = 0) out vec4 oColor;
-layout(location = 1) out vec4 oNormals;
-layout(location = 2) out vec4 oAlbedo;
 
 vec3 DirectionalLight(vec3 lightPosition, vec3 color, vec3 normal);
-vec3 PointLight(vec3 lightPosition, vec3 color, vec3 normal, vec3 fragPosition, vec3 view_dir, vec2 texCoords);
 
 void main() {
 	vec3 lightsColors = vec3(0.0,0.0,0.0);
-	for(int i = 0; i < uLightCount; ++i)
-	{		if(uLight[i].type == 0) //Directional
-			    lightsColors += DirectionalLight(uLight[i].position, uLight[i].color, normalize(vNormals));
+	// LIGHT_COUNT_MAX is a compile time bound from the permutation's light tier
+	for(int i = 0; i < LIGHT_COUNT_MAX; ++i)
+	{
+		if (i >= uLightCount)
+			break;
+		if(uLights[i].type == 0) //Directional
+			    lightsColors += DirectionalLight(uLights[i].position, uLights[i].color, normalize(vNormals));
             else //PointLight
             {
-                lightsColors += PointLight(uLight[i].position, uLight[i].color, vNormals, vPosition,normalize(vViewDir), vTexCoord);
+                lightsColors += PointLight(uLights[i], vNormals, vPosition,normalize(vViewDir), vTexCoord, 1.0, uLights[i].radius);
             }
 	}
 	oColor 		= vec4(lightsColors, 1.0)*texture(uTexture, vTexCoord);
-	oNormals 	= vec4(vNormals, 1.0);
-    gl_FragDepth = gl_FragCoord.z - 0.2;
-    oAlbedo   =   texture(uTexture, vTexCoord);
 }
 
 vec3 DirectionalLight(vec3 lightPos, vec3 color, vec3 normal){
@@ -141,27 +126,6 @@ vec3 DirectionalLight(vec3 lightPos, vec3 color, vec3 normal){
     return ambient + diffuse + specular;
 }
 
-vec3 PointLight(vec3 lightPos, vec3 color, vec3 normal, vec3 fragPosition, vec3 view_dir, vec2 texCoords)
-{
-    // Ambient
-    vec3 ambient = color;
-
-    // Diffuse
-    vec3 lightDir = normalize(lightPos - fragPosition);
-    float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = ambient * diff;
-
-     // Specular
-    vec3 reflectDir = reflect(-lightDir, normal);  
-    float spec = pow(max(dot(view_dir, reflectDir), 0.0), 0.0) * 0.01;
-    vec3 specular = ambient * spec;
-
-    // Range
-    float distance = length(lightPos - fragPosition);
-    float range = 4/distance;
-    
-	return (diffuse + specular) * range;
-}
 #endif
 #endif
 
@@ -189,39 +153,36 @@ layout(binding = 1, std140) uniform LocalParms
 {
 	mat4 uWorldMatrix;
 	mat4 uWorldViewProjectionMatrix;
+	mat3 uNormalMatrix;
 };
 
 out vec2 vTexCoord;
 out vec3 vNormals;
-out vec3 vViewDir;
+out vec3 vTangentViewDir;
 out vec3 vPosition;
 out mat3 TBN;
-out mat3 worldViewMatrix;
+
+invariant gl_Position;
 
 void main() {
-    gl_Position = uWorldViewProjectionMatrix * uWorldMatrix * vec4(aPosition, 1.0);
-    vNormals = mat3(transpose(inverse(uWorldMatrix))) * aNormals;
+    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    vNormals = uNormalMatrix * aNormals;
     vTexCoord = aTexCoord;
-    vViewDir = uCameraPosition - aPosition;
     vPosition = vec3(uWorldMatrix * vec4(aPosition,1.0));
-    worldViewMatrix = mat3(uWorldMatrix);
     vec3 T = normalize(vec3(uWorldMatrix * vec4(aTangents,   0.0)));
     vec3 B = normalize(vec3(uWorldMatrix * vec4(aBiTangents, 0.0)));
-    vec3 N = normalize(vec3(uWorldMatrix * vec4(vNormals,    0.0)));
+    vec3 N = normalize(vNormals);
     TBN = mat3(T,B,N);
+
+    // The basis is orthonormal, so its transpose takes world vectors to tangent space
+    vTangentViewDir = transpose(TBN) * (uCameraPosition - vPosition);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
- struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     float 			intensity;
-};
-
-vec2 reliefMapping(vec2 texCoords, vec3 viewDir);
+#ifdef FEATURE_RELIEF
+vec2 reliefMapping(vec2 texCoords, vec3 viewDir, float lod);
+#endif
 
 layout(binding = 0, std140) uniform GlobalParms
 {
@@ -233,80 +194,127 @@ layout(binding = 1, std140) uniform LocalParms
 {
 	mat4 uWorldMatrix;
 	mat4 uWorldViewProjectionMatrix;
+	mat3 uNormalMatrix;
 };
 
 in vec2 vTexCoord;
 in vec3 vNormals;
-in vec3 vViewDir;
+in vec3 vTangentViewDir;
 in vec3 vPosition;
 in mat3 TBN;
-in mat3 worldViewMatrix;
 
-uniform sampler2D uAlbedoTexture;
+layout(early_fragment_tests) in;
 
-uniform sampler2D uNormalTexture;
+layout(binding = 0) uniform sampler2D uAlbedoTexture;
 
-uniform sampler2D uBumpTexture;
-uniform int uShowRelief;
+#ifdef FEATURE_NORMAL_MAP
+layout(binding = 1) uniform sampler2D uNormalTexture;
+#endif
 
-layout(location = 0) out vec4 oColor;
-layout(location = 1) out vec4 oNormals;
+#ifdef FEATURE_RELIEF
+layout(binding = 2) uniform sampler2D uBumpTexture; // Max-mip chain, each texel holds the highest point of its footprint
+layout(location = 0) uniform float uReliefMaxDistance; // RELIEF_MAX_DISTANCE_LOCATION
+
+#define RELIEF_DEPTH_TEXELS 25.0 // Horizontal reach of the full depth range, in base level texels
+#define RELIEF_MIN_ITERATIONS 16
+#define RELIEF_MAX_ITERATIONS 64
+#endif
+
+layout(location = 1) out vec2 oNormals;
 layout(location = 2) out vec4 oAlbedo;
-layout(location = 3) out vec4 oPosition;
+
+#include "normal_encoding.glsl"
+
 void main() {
-    vec3 normals = vec3(0.0);
+    vec3 normals = normalize(vNormals);
     vec2 tCoords = vTexCoord;
 
-    if(uShowRelief == 1)
-    {
-        tCoords = reliefMapping(tCoords, vViewDir);
-        normals = texture(uNormalTexture, vTexCoord).rgb;
-        normals = normals * 2.0 - 1.0;
-        normals = normalize(inverse(transpose(TBN)) * normals);
-    }
+#ifdef FEATURE_RELIEF
+    // Derivatives are only defined outside of the branch below
+    float reliefLod = textureQueryLod(uBumpTexture, vTexCoord).y;
 
+    // Far away the parallax is sub-pixel and plain normal mapping looks the same
+    if (distance(uCameraPosition, vPosition) < uReliefMaxDistance)
+        tCoords = reliefMapping(tCoords, normalize(vTangentViewDir), reliefLod);
+#endif
 
-	oColor 		= texture(uAlbedoTexture, tCoords);
-	oNormals 	= vec4(normals, 1.0);
-    
+#ifdef FEATURE_NORMAL_MAP
+    // Normal maps are cooked to two channels (BC5), z follows from the unit length
+    vec2 normalXY = texture(uNormalTexture, tCoords).rg * 2.0 - 1.0;
+    normals = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
+    normals = normalize(TBN * normals);
+#endif
+
+
+	oNormals 	= EncodeNormal(normals);
     oAlbedo   =   texture(uAlbedoTexture, tCoords);
-    oPosition = vec4(transpose(TBN)*vPosition, 1.0);
-    gl_FragDepth = gl_FragCoord.z - 0.2;
 }
 
-vec2 reliefMapping(vec2 texCoords, vec3 viewDir)
+#ifdef FEATURE_RELIEF
+// Walks the ray down the max-mip chain: a coarse cell whose highest point is below the
+// ray is skipped whole, otherwise the search descends into it. Stops at the level the
+// screen samples at and refines the hit with one secant step on the base level.
+vec2 reliefMapping(vec2 texCoords, vec3 viewDir, float lod)
 {
-	int numSteps = 25;
-
-	// Compute the view ray in texture space
-	vec3 rayTexspace = transpose(TBN) * inverse(worldViewMatrix) * viewDir;
-
-	// Increment
-	vec3 rayIncrementTexspace;
-	rayIncrementTexspace.xy = rayTexspace.xy / abs(rayTexspace.z * textureSize(uBumpTexture,0).x);
-	rayIncrementTexspace.z = 1.0/numSteps;
-
-	// Sampling state
-	vec3 samplePositionTexspace = vec3(texCoords, 0.0);
-	float sampledDepth = 1.0 - texture(uBumpTexture, samplePositionTexspace.xy).r;
-
-	// Linear search
-	for (int i = 0; i < numSteps && samplePositionTexspace.z < sampledDepth; ++i)
+	// Positions along the ray are parametrised by their depth below the surface
+	float baseSize = float(textureSize(uBumpTexture, 0).x);
+	vec2 rayDir = -viewDir.xy / max(viewDir.z, 0.05) * RELIEF_DEPTH_TEXELS / baseSize;
+	rayDir = sign(rayDir) * max(abs(rayDir), vec2(1e-6));
+
+	// Grazing rays cross more cells before they hit
+	int iterations = int(mix(float(RELIEF_MIN_ITERATIONS), float(RELIEF_MAX_ITERATIONS), 1.0 - abs(viewDir.z)));
+	int maxLevel = textureQueryLevels(uBumpTexture) - 1;
+	int minLevel = min(int(max(lod, 0.0)), maxLevel);
+	int level = maxLevel;
+
+	float t = 0.0;
+	float previousT = 0.0;
+	for (int i = 0; i < iterations; ++i)
 	{
-		samplePositionTexspace += rayIncrementTexspace;
-		sampledDepth = 1.0 - texture(uBumpTexture, samplePositionTexspace.xy).r;
+		ivec2 size = textureSize(uBumpTexture, level);
+		vec2 cellPosition = (texCoords + rayDir * t) * vec2(size);
+		ivec2 cell = ivec2(floor(cellPosition + sign(rayDir) * 1e-3));
+		float cellDepth = 1.0 - texelFetch(uBumpTexture, clamp(cell, ivec2(0), size - 1), level).r;
+
+		if (t >= cellDepth)
+		{
+			if (level <= minLevel)
+				break;
+			level--;
+			continue;
+		}
+
+		vec2 border = (vec2(cell) + step(0.0, rayDir)) / vec2(size);
+		vec2 tBorder = (border - texCoords) / rayDir;
+		float tCell = min(tBorder.x, tBorder.y);
+
+		previousT = t;
+		if (cellDepth <= tCell)
+		{
+			t = cellDepth;
+		}
+		else
+		{
+			// The next cell may be lower, try skipping at a coarser level again
+			t = tCell;
+			level = min(level + 1, maxLevel);
+		}
+
+		if (t >= 1.0)
+		{
+			t = 1.0;
+			break;
+		}
 	}
 
-    // get depth after and before collision for linear interpolation
-    float afterDepth  = samplePositionTexspace.z - sampledDepth;
-    float beforeDepth = texture(uBumpTexture, samplePositionTexspace.xy).r - samplePositionTexspace.z + sampledDepth;
- 
-    // interpolation of texture coordinates
-    float weight = afterDepth / (afterDepth - beforeDepth);
-    vec2 finalTexCoords = samplePositionTexspace.xy * weight + samplePositionTexspace.xy * (1.0 - weight);
+	// Secant between the last point above the surface and the first one below it
+	float aboveSurface = (1.0 - textureLod(uBumpTexture, texCoords + rayDir * previousT, 0.0).r) - previousT;
+	float belowSurface = t - (1.0 - textureLod(uBumpTexture, texCoords + rayDir * t, 0.0).r);
+	float weight = clamp(aboveSurface / max(aboveSurface + belowSurface, 1e-5), 0.0, 1.0);
 
-    return finalTexCoords;
+	return texCoords + rayDir * mix(previousT, t, weight);
 }
+#endif
 
 
 #endif
@@ -323,19 +331,10 @@ vec2 reliefMapping(vec2 texCoords, vec3 viewDir)
 layout(location=0) in vec3 aPosition;
 layout(location=1) in vec2 aTexCoord;
 
-struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     float 	intensity;
-};
-
 layout(binding = 0, std140) uniform GlobalParms
 {
 	vec3 			uCameraPosition;
  	int 			uLightCount;
- 	Light			uLight[16];
 };
 
 out vec2 vTexCoord;
@@ -349,80 +348,132 @@ void main() {
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
- struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     float 	intensity;
+#include "lights.glsl"
+
+#include "shadows.glsl"
+
+layout(binding = 0, std140) uniform GlobalParms
+{
+	vec3 			uCameraPosition;
+	int 			uLightCount;
 };
 
-vec3 DirectionalLight(Light light, vec3 normal, vec3 view_dir, vec2 texCoords){
-    vec3 lightColor = vec3(1.);
-    // Ambient
-    vec3 ambient = lightColor * 0.15 * light.color;
+#include "deferred_common.glsl"
 
-    // Diffuse
-    vec3 lightDirection = normalize(-light.position);
-    float diffuseIntensity = max(dot(normal, light.direction),0.0);
-    vec3 diffuse = diffuseIntensity * lightColor * light.color;
+// Reduced rate lighting leaves the albedo term to the upsample
+uniform bool uLightingOnly;
 
-    // Specular
-    float specularStrength = 0.01;
-    float specularIntensity = pow(max(dot(normal, lightDirection),0.0),0.1);
-    vec3 specular = specularStrength * specularIntensity * lightColor * light.intensity;
-    
-    return (ambient + diffuse + specular) * light.intensity;
+in vec2 vTexCoord;
+
+layout(location = 0) out vec4 oColor;
+
+void main() {
+	vec3 fragPos = ReconstructPosition(vTexCoord);
+	vec3 norms = DecodeNormal(texture(uNormalsTexture, vTexCoord).rg);
+	vec3 diffuseCol = uLightingOnly ? vec3(0.0) : texture(uAlbedoTexture, vTexCoord).rgb;
+
+	vec3 viewDir = normalize(uCameraPosition - fragPos);
+	vec3 lightsColors = vec3(0.0,0.0,0.0);
+	for(int i = 0; i < uLightCount; ++i)
+	{		
+        if(uLights[i].type == 0) //Directional
+        {
+			lightsColors += DirectionalLight(uLights[i], norms, normalize(viewDir), vTexCoord, Shadow(uLights[i], fragPos, norms));
+        }
+        else //PointLight
+        {
+            lightsColors += PointLight(uLights[i], norms, fragPos, viewDir, vTexCoord, Shadow(uLights[i], fragPos, norms), uLights[i].radius);
+        }
+	}
+    oColor = vec4(lightsColors + diffuseCol * 0.2, 1.0);
 }
+#endif
+#endif
 
-vec3 PointLight(Light light, vec3 normal, vec3 frag_pos, vec3 view_dir, vec2 texCoords)
-{
-    vec3 ambient = light.color;
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef SHOW_LIGHT_CLUSTERED
 
-    vec3 lightDir = normalize(light.position - frag_pos);
-    float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = ambient * diff;
+// Keep in sync with the CLUSTER_* defines in engine.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
 
-    vec3 reflectDir = reflect(-lightDir, normal);  
-    float spec = pow(max(dot(view_dir, reflectDir), 0.0), 0.0) * 0.01;
-    vec3 specular = ambient * spec;
+#if defined(VERTEX) ///////////////////////////////////////////////////
 
-    float distance = length(light.position - frag_pos);
-    float range = 1/distance;      
-	return (diffuse + specular) * range * light.intensity;
+layout(location=0) in vec3 aPosition;
+layout(location=1) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main() {
+
+	gl_Position = vec4(aPosition, 1.0);
+
+	vTexCoord = aTexCoord;
 }
 
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+#include "lights.glsl"
+
+#include "shadows.glsl"
+
+layout(binding = 4, std430) readonly buffer ClusterLightGrid
+{
+	uint  uLightIndexCount;
+	uint  uLightGridPadding;
+	uvec2 uClusterLightGrid[]; // Offset into uClusterLightIndices and light count
+};
+
+layout(binding = 5, std430) readonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
+
 layout(binding = 0, std140) uniform GlobalParms
 {
 	vec3 			uCameraPosition;
 	int 			uLightCount;
-	Light			uLight[16];
 };
 
-uniform sampler2D uPositionTexture;
-uniform sampler2D uNormalsTexture;
-uniform sampler2D uAlbedoTexture;
+uniform mat4 uView;
+uniform vec2 uScreenSize;
+uniform float uZNear;
+uniform float uZFar;
+
+#include "deferred_common.glsl"
 
 in vec2 vTexCoord;
 
 layout(location = 0) out vec4 oColor;
 
 void main() {
-	vec3 fragPos = texture(uPositionTexture, vTexCoord).rgb;
-	vec3 norms = texture(uNormalsTexture, vTexCoord).rgb;
+	vec3 fragPos = ReconstructPosition(vTexCoord);
+	vec3 norms = DecodeNormal(texture(uNormalsTexture, vTexCoord).rg);
 	vec3 diffuseCol = texture(uAlbedoTexture, vTexCoord).rgb;
 
+	// Find the cluster of this pixel
+	float viewDepth = max(-(uView * vec4(fragPos, 1.0)).z, uZNear);
+	uint slice = uint(clamp(log(viewDepth / uZNear) / log(uZFar / uZNear) * CLUSTER_GRID_Z, 0.0, CLUSTER_GRID_Z - 1.0));
+	uvec2 tile = min(uvec2(gl_FragCoord.xy / uScreenSize * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y)), uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+	uint cluster = tile.x + tile.y * CLUSTER_GRID_X + slice * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+
 	vec3 viewDir = normalize(uCameraPosition - fragPos);
 	vec3 lightsColors = vec3(0.0,0.0,0.0);
-	for(int i = 0; i < uLightCount; ++i)
-	{		
-        if(uLight[i].type == 0) //Directional
+	uvec2 lightRange = uClusterLightGrid[cluster];
+	for(uint i = 0; i < lightRange.y; ++i)
+	{
+		Light light = uLights[uClusterLightIndices[lightRange.x + i]];
+        if(light.type == 0) //Directional
         {
-			lightsColors += DirectionalLight(uLight[i], norms, normalize(viewDir), vTexCoord);
+			lightsColors += DirectionalLight(light, norms, normalize(viewDir), vTexCoord, Shadow(light, fragPos, norms));
         }
         else //PointLight
         {
-            lightsColors += PointLight(uLight[i], norms, fragPos, viewDir, vTexCoord);
+            lightsColors += PointLight(light, norms, fragPos, viewDir, vTexCoord, Shadow(light, fragPos, norms), light.radius);
         }
 	}
     oColor = vec4(lightsColors + diffuseCol * 0.2, 1.0);
@@ -430,6 +481,70 @@ void main() {
 #endif
 #endif
 
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef SHOW_LIGHT_VOLUME
+
+uniform vec4 uLightVolume; // xyz: center, w: radius (0 for fullscreen passes)
+uniform float uVolumeScale; // RenderSphere() is inscribed in the unit sphere, grows it to cover the radius
+uniform int uLightIndex;   // -1 for the ambient pass
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+
+uniform mat4 uViewProjection;
+
+void main() {
+	if (uLightVolume.w > 0.0)
+		gl_Position = uViewProjection * vec4(uLightVolume.xyz + aPosition * uLightVolume.w * uVolumeScale, 1.0);
+	else
+		gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+#include "lights.glsl"
+
+#include "shadows.glsl"
+
+layout(binding = 0, std140) uniform GlobalParms
+{
+	vec3 			uCameraPosition;
+	int 			uLightCount;
+};
+
+uniform vec2 uScreenSize;
+
+#include "deferred_common.glsl"
+
+layout(location = 0) out vec4 oColor;
+
+void main() {
+	vec2 texCoords = gl_FragCoord.xy / uScreenSize;
+	vec3 fragPos = ReconstructPosition(texCoords);
+	vec3 norms = DecodeNormal(texture(uNormalsTexture, texCoords).rg);
+	vec3 diffuseCol = texture(uAlbedoTexture, texCoords).rgb;
+
+	if (uLightIndex < 0)
+	{
+		oColor = vec4(diffuseCol * 0.2, 1.0);
+		return;
+	}
+
+	Light light = uLights[uLightIndex];
+	vec3 viewDir = normalize(uCameraPosition - fragPos);
+	if (light.type == 0) //Directional
+		oColor = vec4(DirectionalLight(light, norms, viewDir, texCoords, Shadow(light, fragPos, norms)), 1.0);
+	else //PointLight
+		oColor = vec4(PointLight(light, norms, fragPos, viewDir, texCoords, Shadow(light, fragPos, norms), uLightVolume.w), 1.0);
+}
+
+#endif
+#endif
+
 #ifdef DRAW_LIGHT
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
@@ -445,14 +560,758 @@ void main() {
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
+layout(early_fragment_tests) in;
+
 layout(location = 0) out vec4 oColor;
 
 uniform vec3 lightColor;
 
 void main() {
 	oColor = vec4(lightColor, 1.0);
-    gl_FragDepth = gl_FragCoord.z - 0.2;
 }
 
 #endif
-#endif
\ No newline at end of file
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef DEPTH_PREPASS
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+
+layout(binding = 1, std140) uniform LocalParms
+{
+	mat4 uWorldMatrix;
+	mat4 uWorldViewProjectionMatrix;
+	mat3 uNormalMatrix;
+};
+
+// Must match SHOW_GEOMETRY bit for bit so its GL_LEQUAL test passes
+invariant gl_Position;
+
+void main() {
+	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main() {
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef HIZ_BUILD
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D uDepthTexture;
+layout(binding = 0, rg32f) uniform readonly image2D uSourceLevel;
+layout(binding = 1, rg32f) uniform writeonly image2D uDestinationLevel;
+
+uniform int uFirstLevel;
+
+void main() {
+	ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 dstSize = imageSize(uDestinationLevel);
+	if (dst.x >= dstSize.x || dst.y >= dstSize.y)
+		return;
+
+	if (uFirstLevel == 1)
+	{
+		float depth = texelFetch(uDepthTexture, dst, 0).r;
+		imageStore(uDestinationLevel, dst, vec4(depth, depth, 0.0, 0.0));
+		return;
+	}
+
+	// Odd source sizes fold their last row/column into the last destination texel
+	ivec2 srcSize = imageSize(uSourceLevel);
+	ivec2 extent = ivec2(2) + ivec2(equal(dst, dstSize - 1)) * (srcSize & 1);
+
+	vec2 minMax = vec2(1.0, 0.0);
+	for (int y = 0; y < extent.y; ++y)
+	{
+		for (int x = 0; x < extent.x; ++x)
+		{
+			vec2 depth = imageLoad(uSourceLevel, min(dst * 2 + ivec2(x, y), srcSize - 1)).rg;
+			minMax = vec2(min(minMax.x, depth.x), max(minMax.y, depth.y));
+		}
+	}
+	imageStore(uDestinationLevel, dst, vec4(minMax, 0.0, 0.0));
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef HIZ_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance; // entity index
+};
+
+struct Bounds {
+	vec4 aabbMin;
+	vec4 aabbMax;
+};
+
+layout(binding = 0, std430) readonly buffer EntityBounds
+{
+	Bounds uBounds[];
+};
+
+layout(binding = 1, std430) buffer DrawCommands
+{
+	DrawCommand uCommands[];
+};
+
+layout(binding = 0) uniform sampler2D uHiZTexture;
+
+uniform mat4 uPreviousViewProjection;
+uniform int uCommandCount;
+uniform int uMaxLevel;
+
+bool IsOccluded(Bounds bounds)
+{
+	vec3 ndcMin = vec3(1.0);
+	vec3 ndcMax = vec3(-1.0);
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = mix(bounds.aabbMin.xyz, bounds.aabbMax.xyz, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+		vec4 clip = uPreviousViewProjection * vec4(corner, 1.0);
+		if (clip.w <= 0.0) // Crosses the near plane
+			return false;
+		vec3 ndc = clip.xyz / clip.w;
+		ndcMin = min(ndcMin, ndc);
+		ndcMax = max(ndcMax, ndc);
+	}
+
+	// Outside of last frame's view there is no depth information
+	if (any(lessThan(ndcMax.xy, vec2(-1.0))) || any(greaterThan(ndcMin.xy, vec2(1.0))))
+		return false;
+
+	vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+	vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+	float boxDepth = ndcMin.z * 0.5 + 0.5;
+
+	// Pick the level where the rectangle covers at most 2x2 texels
+	vec2 extent = (uvMax - uvMin) * vec2(textureSize(uHiZTexture, 0));
+	int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, uMaxLevel);
+	ivec2 levelSize = textureSize(uHiZTexture, level);
+	ivec2 texelMin = min(ivec2(uvMin * vec2(levelSize)), levelSize - 1);
+	ivec2 texelMax = min(ivec2(uvMax * vec2(levelSize)), levelSize - 1);
+
+	float occluderDepth = 0.0;
+	for (int y = texelMin.y; y <= texelMax.y; ++y)
+		for (int x = texelMin.x; x <= texelMax.x; ++x)
+			occluderDepth = max(occluderDepth, texelFetch(uHiZTexture, ivec2(x, y), level).g);
+
+	return boxDepth > occluderDepth;
+}
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= uint(uCommandCount))
+		return;
+
+	uCommands[i].instanceCount = IsOccluded(uBounds[uCommands[i].baseInstance]) ? 0u : 1u;
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef CLUSTER_BUILD
+
+// Keep in sync with the CLUSTER_* defines in engine.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = CLUSTER_GRID_X, local_size_y = CLUSTER_GRID_Y) in;
+
+struct ClusterBounds {
+	vec4 aabbMin;
+	vec4 aabbMax;
+};
+
+layout(binding = 3, std430) writeonly buffer Clusters
+{
+	ClusterBounds uClusters[];
+};
+
+uniform mat4 uInverseProjection;
+uniform float uZNear;
+uniform float uZFar;
+
+vec3 NdcToView(vec2 ndc)
+{
+	vec4 view = uInverseProjection * vec4(ndc, -1.0, 1.0);
+	return view.xyz / view.w;
+}
+
+void main() {
+	uvec3 id = gl_GlobalInvocationID;
+	uint cluster = id.x + id.y * CLUSTER_GRID_X + id.z * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+
+	// Tile corners on the near plane
+	vec2 tileSize = 2.0 / vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+	vec3 minPoint = NdcToView(-1.0 + vec2(id.xy) * tileSize);
+	vec3 maxPoint = NdcToView(-1.0 + vec2(id.xy + 1u) * tileSize);
+
+	// Exponential depth slices
+	float sliceNear = -uZNear * pow(uZFar / uZNear, float(id.z) / CLUSTER_GRID_Z);
+	float sliceFar  = -uZNear * pow(uZFar / uZNear, float(id.z + 1u) / CLUSTER_GRID_Z);
+
+	// Rays from the eye through the corners, cut by both slice planes
+	vec3 minNear = minPoint * (sliceNear / minPoint.z);
+	vec3 minFar  = minPoint * (sliceFar / minPoint.z);
+	vec3 maxNear = maxPoint * (sliceNear / maxPoint.z);
+	vec3 maxFar  = maxPoint * (sliceFar / maxPoint.z);
+
+	uClusters[cluster].aabbMin = vec4(min(min(minNear, minFar), min(maxNear, maxFar)), 0.0);
+	uClusters[cluster].aabbMax = vec4(max(max(minNear, minFar), max(maxNear, maxFar)), 0.0);
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef CLUSTER_CULL_LIGHTS
+
+// Keep in sync with the CLUSTER_* defines in engine.h
+#define CLUSTER_COUNT (16u * 9u * 24u)
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define BATCH_SIZE 128
+
+layout(local_size_x = BATCH_SIZE) in;
+
+#include "lights.glsl"
+
+struct ClusterBounds {
+	vec4 aabbMin;
+	vec4 aabbMax;
+};
+
+layout(binding = 3, std430) readonly buffer Clusters
+{
+	ClusterBounds uClusters[];
+};
+
+layout(binding = 4, std430) buffer ClusterLightGrid
+{
+	uint  uLightIndexCount; // Cleared every frame, ends up at the total asked for even past the capacity
+	uint  uLightGridPadding;
+	uvec2 uClusterLightGrid[]; // Offset into uClusterLightIndices and light count
+};
+
+layout(binding = 5, std430) writeonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
+
+uniform mat4 uView;
+uniform int uLightCount;
+uniform uint uLightIndexCapacity;
+
+// View space position and radius, negative radius for lights that reach everything
+shared vec4 sharedLightSpheres[BATCH_SIZE];
+
+bool SphereIntersectsAabb(vec4 sphere, ClusterBounds bounds)
+{
+	vec3 closest = clamp(sphere.xyz, bounds.aabbMin.xyz, bounds.aabbMax.xyz);
+	vec3 delta = closest - sphere.xyz;
+	return dot(delta, delta) <= sphere.w * sphere.w;
+}
+
+void main() {
+	uint cluster = gl_GlobalInvocationID.x;
+	bool active = cluster < CLUSTER_COUNT;
+	ClusterBounds bounds = uClusters[min(cluster, CLUSTER_COUNT - 1u)];
+
+	// Lights are counted first, then written to the range the cluster takes from the shared index list
+	uint count = 0;
+	uint offset = 0;
+	for (uint pass = 0; pass < 2; ++pass)
+	{
+		if (pass == 1 && active)
+		{
+			offset = atomicAdd(uLightIndexCount, count);
+			count = 0;
+		}
+
+		for (uint batch = 0; batch < uint(uLightCount); batch += BATCH_SIZE)
+		{
+			// Every invocation loads one light of the batch
+			uint lightIndex = batch + gl_LocalInvocationIndex;
+			if (lightIndex < uint(uLightCount))
+			{
+				Light light = uLights[lightIndex];
+				sharedLightSpheres[gl_LocalInvocationIndex] = light.type == 0
+					? vec4(0.0, 0.0, 0.0, -1.0)
+					: vec4((uView * vec4(light.position, 1.0)).xyz, light.radius);
+			}
+			barrier();
+
+			uint batchSize = min(uint(BATCH_SIZE), uint(uLightCount) - batch);
+			for (uint i = 0; active && i < batchSize; ++i)
+			{
+				vec4 sphere = sharedLightSpheres[i];
+				if (sphere.w < 0.0 || SphereIntersectsAabb(sphere, bounds))
+				{
+					if (pass == 1 && offset + count < uLightIndexCapacity)
+						uClusterLightIndices[offset + count] = batch + i;
+					count++;
+				}
+			}
+			barrier();
+		}
+	}
+
+	// Past the capacity the list is cut short, the engine grows it from the total and reports it
+	if (active)
+		uClusterLightGrid[cluster] = uvec2(offset, offset < uLightIndexCapacity ? min(count, uLightIndexCapacity - offset) : 0u);
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef TILE_CULL_LIGHTS
+
+// Keep in sync with the TILE_* defines in engine.h
+#define TILE_SIZE 16
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+#include "lights.glsl"
+
+layout(binding = 0) uniform sampler2D uDepthTexture;
+
+layout(binding = 6, std430) buffer TileLightGrid
+{
+	uint  uLightIndexCount; // Cleared every frame, ends up at the total asked for even past the capacity
+	uint  uLightGridPadding;
+	uvec2 uTileLightGrid[]; // Offset into uTileLightIndices and light count
+};
+
+layout(binding = 7, std430) writeonly buffer TileLightIndices
+{
+	uint uTileLightIndices[];
+};
+
+uniform mat4 uInverseProjection;
+uniform mat4 uView;
+uniform int uLightCount;
+uniform uint uLightIndexCapacity;
+
+// Depths are positive, so their bits order like the floats
+shared uint sharedMinDepth;
+shared uint sharedMaxDepth;
+shared uint sharedLightCount;
+shared uint sharedLightOffset;
+shared vec3 sharedTileMin;
+shared vec3 sharedTileMax;
+
+vec3 ScreenToView(vec2 pixel, float depth, vec2 screenSize)
+{
+	vec4 ndc = vec4(pixel / screenSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec4 view = uInverseProjection * ndc;
+	return view.xyz / view.w;
+}
+
+void main() {
+	ivec2 screenSize = textureSize(uDepthTexture, 0);
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	uint tile = gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		sharedMinDepth = floatBitsToUint(1.0);
+		sharedMaxDepth = 0u;
+		sharedLightCount = 0u;
+	}
+	barrier();
+
+	if (all(lessThan(pixel, screenSize)))
+	{
+		uint depth = floatBitsToUint(texelFetch(uDepthTexture, pixel, 0).r);
+		atomicMin(sharedMinDepth, depth);
+		atomicMax(sharedMaxDepth, depth);
+	}
+	barrier();
+
+	// Nothing but background in this tile
+	float minDepth = uintBitsToFloat(sharedMinDepth);
+	float maxDepth = uintBitsToFloat(sharedMaxDepth);
+	if (minDepth >= 1.0)
+	{
+		if (gl_LocalInvocationIndex == 0)
+			uTileLightGrid[tile] = uvec2(0u);
+		return;
+	}
+
+	// View space bounds of the tile between its nearest and farthest surface
+	if (gl_LocalInvocationIndex == 0)
+	{
+		vec2 tileMin = vec2(gl_WorkGroupID.xy * TILE_SIZE);
+		vec2 tileMax = min(tileMin + TILE_SIZE, vec2(screenSize));
+		vec3 boundsMin = vec3(1e30);
+		vec3 boundsMax = vec3(-1e30);
+		for (int c = 0; c < 8; ++c)
+		{
+			vec2 corner = vec2((c & 1) != 0 ? tileMax.x : tileMin.x, (c & 2) != 0 ? tileMax.y : tileMin.y);
+			vec3 view = ScreenToView(corner, (c & 4) != 0 ? maxDepth : minDepth, vec2(screenSize));
+			boundsMin = min(boundsMin, view);
+			boundsMax = max(boundsMax, view);
+		}
+		sharedTileMin = boundsMin;
+		sharedTileMax = boundsMax;
+	}
+	barrier();
+
+	// Lights are counted first, then written to the range the tile takes from the shared index list
+	for (uint pass = 0; pass < 2; ++pass)
+	{
+		if (pass == 1)
+		{
+			if (gl_LocalInvocationIndex == 0)
+			{
+				sharedLightOffset = atomicAdd(uLightIndexCount, sharedLightCount);
+				sharedLightCount = 0u;
+			}
+			barrier();
+		}
+
+		for (uint i = gl_LocalInvocationIndex; i < uint(uLightCount); i += TILE_SIZE * TILE_SIZE)
+		{
+			Light light = uLights[i];
+			bool visible = light.type == 0;
+			if (!visible)
+			{
+				vec3 center = (uView * vec4(light.position, 1.0)).xyz;
+				vec3 delta = clamp(center, sharedTileMin, sharedTileMax) - center;
+				visible = dot(delta, delta) <= light.radius * light.radius;
+			}
+			if (visible)
+			{
+				uint slot = atomicAdd(sharedLightCount, 1u);
+				if (pass == 1 && sharedLightOffset + slot < uLightIndexCapacity)
+					uTileLightIndices[sharedLightOffset + slot] = i;
+			}
+		}
+		barrier();
+	}
+
+	// Past the capacity the list is cut short, the engine grows it from the total and reports it
+	if (gl_LocalInvocationIndex == 0)
+	{
+		uint offset = sharedLightOffset;
+		uTileLightGrid[tile] = uvec2(offset, offset < uLightIndexCapacity ? min(sharedLightCount, uLightIndexCapacity - offset) : 0u);
+	}
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef SHOW_FORWARD_PLUS
+
+// Keep in sync with the TILE_* defines in engine.h
+#define TILE_SIZE 16
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=1) in vec3 aNormals;
+layout(location=2) in vec2 aTexCoord;
+
+layout(binding = 1, std140) uniform LocalParms
+{
+	mat4 uWorldMatrix;
+	mat4 uWorldViewProjectionMatrix;
+	mat3 uNormalMatrix;
+};
+
+// Must match DEPTH_PREPASS bit for bit so the GL_LEQUAL test passes
+invariant gl_Position;
+
+out vec2 vTexCoord;
+out vec3 vNormals;
+out vec3 vPosition;
+
+void main() {
+	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	vNormals = uNormalMatrix * aNormals;
+	vTexCoord = aTexCoord;
+	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+#include "lights.glsl"
+
+#include "shadows.glsl"
+
+layout(binding = 6, std430) readonly buffer TileLightGrid
+{
+	uint  uLightIndexCount;
+	uint  uLightGridPadding;
+	uvec2 uTileLightGrid[]; // Offset into uTileLightIndices and light count
+};
+
+layout(binding = 7, std430) readonly buffer TileLightIndices
+{
+	uint uTileLightIndices[];
+};
+
+layout(binding = 0, std140) uniform GlobalParms
+{
+	vec3 			uCameraPosition;
+	int 			uLightCount;
+};
+
+layout(early_fragment_tests) in;
+
+uniform sampler2D uTexture;
+uniform int uTileCountX;
+
+in vec2 vTexCoord;
+in vec3 vNormals;
+in vec3 vPosition;
+
+layout(location = 0) out vec4 oColor;
+
+void main() {
+	vec3 norms = normalize(vNormals);
+	vec3 diffuseCol = texture(uTexture, vTexCoord).rgb;
+	vec3 viewDir = normalize(uCameraPosition - vPosition);
+
+	uvec2 tileCoords = uvec2(gl_FragCoord.xy) / uint(TILE_SIZE);
+	uint tile = tileCoords.x + tileCoords.y * uint(uTileCountX);
+
+	vec3 lightsColors = vec3(0.0,0.0,0.0);
+	uvec2 lightRange = uTileLightGrid[tile];
+	for(uint i = 0; i < lightRange.y; ++i)
+	{
+		Light light = uLights[uTileLightIndices[lightRange.x + i]];
+        if(light.type == 0) //Directional
+			lightsColors += DirectionalLight(light, norms, viewDir, vTexCoord, Shadow(light, vPosition, norms));
+        else //PointLight
+            lightsColors += PointLight(light, norms, vPosition, viewDir, vTexCoord, Shadow(light, vPosition, norms), light.radius);
+	}
+    oColor = vec4(lightsColors + diffuseCol * 0.2, 1.0);
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef DOWNSAMPLE_GBUFFER
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=1) in vec2 aTexCoord;
+
+void main() {
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+uniform sampler2D uDepthTexture;
+uniform sampler2D uNormalsTexture;
+uniform int uDownsample;
+
+layout(location = 0) out float oDepth;
+layout(location = 1) out vec2 oNormals;
+
+// Keeps one real sample per block, averaging depths or normals across an edge
+// would invent a surface. Alternating the nearest and farthest sample in a
+// checkerboard leaves both sides of a silhouette for the upsample to pick from.
+void main() {
+	ivec2 lowTexel = ivec2(gl_FragCoord.xy);
+	ivec2 maxTexel = textureSize(uDepthTexture, 0) - 1;
+	bool keepFarthest = ((lowTexel.x + lowTexel.y) & 1) != 0;
+
+	ivec2 best = min(lowTexel * uDownsample, maxTexel);
+	float bestDepth = texelFetch(uDepthTexture, best, 0).r;
+	for (int y = 0; y < uDownsample; ++y)
+	{
+		for (int x = 0; x < uDownsample; ++x)
+		{
+			ivec2 texel = min(lowTexel * uDownsample + ivec2(x, y), maxTexel);
+			float depth = texelFetch(uDepthTexture, texel, 0).r;
+			if (keepFarthest ? depth > bestDepth : depth < bestDepth)
+			{
+				bestDepth = depth;
+				best = texel;
+			}
+		}
+	}
+
+	oDepth = bestDepth;
+	oNormals = texelFetch(uNormalsTexture, best, 0).rg;
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef BILATERAL_UPSAMPLE
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=1) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main() {
+	gl_Position = vec4(aPosition, 1.0);
+	vTexCoord = aTexCoord;
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+#define DEPTH_SHARPNESS 50.0
+#define NORMAL_POWER 8.0
+
+uniform sampler2D uDepthTexture;
+uniform sampler2D uNormalsTexture;
+uniform sampler2D uAlbedoTexture;
+uniform sampler2D uLowDepthTexture;
+uniform sampler2D uLowNormalsTexture;
+uniform sampler2D uLowLightingTexture;
+uniform float uZNear;
+uniform float uZFar;
+
+in vec2 vTexCoord;
+
+layout(location = 0) out vec4 oColor;
+
+#include "normal_encoding.glsl"
+
+float LinearDepth(float depth)
+{
+	float z = depth * 2.0 - 1.0;
+	return 2.0 * uZNear * uZFar / (uZFar + uZNear - z * (uZFar - uZNear));
+}
+
+void main() {
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	float depth = LinearDepth(texelFetch(uDepthTexture, texel, 0).r);
+	vec3 normal = DecodeNormal(texelFetch(uNormalsTexture, texel, 0).rg);
+
+	ivec2 lowSize = textureSize(uLowLightingTexture, 0);
+	vec2 lowPosition = vTexCoord * vec2(lowSize) - 0.5;
+	ivec2 base = ivec2(floor(lowPosition));
+	vec2 f = lowPosition - vec2(base);
+
+	// Bilinear weights, damped for taps that lie on another surface
+	vec3 lighting = vec3(0.0);
+	float totalWeight = 0.0;
+	vec3 closestLighting = vec3(0.0);
+	float closestDelta = 1e30;
+	for (int i = 0; i < 4; ++i)
+	{
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 tap = clamp(base + offset, ivec2(0), lowSize - 1);
+		float tapDepth = LinearDepth(texelFetch(uLowDepthTexture, tap, 0).r);
+		vec3 tapNormal = DecodeNormal(texelFetch(uLowNormalsTexture, tap, 0).rg);
+		vec3 tapLighting = texelFetch(uLowLightingTexture, tap, 0).rgb;
+
+		vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+		float depthDelta = abs(tapDepth - depth) / depth;
+		float weight = bilinear.x * bilinear.y * exp(-depthDelta * DEPTH_SHARPNESS) * pow(max(dot(tapNormal, normal), 0.0), NORMAL_POWER);
+
+		lighting += tapLighting * weight;
+		totalWeight += weight;
+
+		if (depthDelta < closestDelta)
+		{
+			closestDelta = depthDelta;
+			closestLighting = tapLighting;
+		}
+	}
+
+	// No tap matches, e.g. a thin feature lost in the downsample
+	lighting = totalWeight > 1e-3 ? lighting / totalWeight : closestLighting;
+
+	vec3 albedo = texelFetch(uAlbedoTexture, texel, 0).rgb;
+	oColor = vec4(lighting + albedo * 0.2, 1.0);
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef SHADOW_CASTER
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+
+uniform mat4 uWorld;
+uniform mat4 uViewProjection;
+
+void main() {
+	gl_Position = uViewProjection * uWorld * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main() {
+}
+
+#endif
+#endif
@@ -0,0 +1,45 @@
+// Shadow atlas lookups, the matrices are written by UpdateShadowTiles
+
+#include "lights.glsl"
+
+#define SHADOW_ATLAS_TILES 4 // Per atlas row, SHADOW_ATLAS_SIZE / SHADOW_TILE_SIZE
+#define SHADOW_BIAS 0.0005
+#define SHADOW_NORMAL_OFFSET 0.02
+
+layout(binding = 8, std430) readonly buffer ShadowMatrices
+{
+	mat4 uShadowMatrices[];
+};
+
+layout(binding = 7) uniform sampler2DShadow uShadowAtlas;
+
+float Shadow(Light light, vec3 fragPos, vec3 normal)
+{
+	if (light.shadowTile < 0)
+		return 1.0;
+
+	// Point lights own six tiles, one per cube face in +X -X +Y -Y +Z -Z order
+	int tile = light.shadowTile;
+	if (light.type == 1)
+	{
+		vec3 d = fragPos - light.position;
+		vec3 a = abs(d);
+		if (a.x >= a.y && a.x >= a.z)
+			tile += d.x > 0.0 ? 0 : 1;
+		else if (a.y >= a.z)
+			tile += d.y > 0.0 ? 2 : 3;
+		else
+			tile += d.z > 0.0 ? 4 : 5;
+	}
+
+	vec4 clip = uShadowMatrices[tile] * vec4(fragPos + normal * SHADOW_NORMAL_OFFSET, 1.0);
+	vec3 coords = clip.xyz / clip.w * 0.5 + 0.5;
+	if (any(lessThan(coords, vec3(0.0))) || any(greaterThan(coords, vec3(1.0))))
+		return 1.0;
+
+	// Keep the filter footprint inside the tile
+	float tileTexels = float(textureSize(uShadowAtlas, 0).x) / float(SHADOW_ATLAS_TILES);
+	vec2 local = clamp(coords.xy, vec2(0.5 / tileTexels), vec2(1.0 - 0.5 / tileTexels));
+	vec2 uv = (vec2(tile % SHADOW_ATLAS_TILES, tile / SHADOW_ATLAS_TILES) + local) / float(SHADOW_ATLAS_TILES);
+	return texture(uShadowAtlas, vec3(uv, coords.z - SHADOW_BIAS));
+}